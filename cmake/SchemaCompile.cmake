@@ -0,0 +1,9 @@
+# Compile a JSON Schema into a C++ header defining an ECISchema named k${NAME}.
+function(SchemaCompile SOURCE NAME OUTPUT)
+    set(schemac $<TARGET_FILE:schemac>)
+    add_custom_command(
+        OUTPUT ${OUTPUT}
+        COMMAND ${schemac}
+        ARGS -n ${NAME} -o ${CMAKE_CURRENT_BINARY_DIR}/${OUTPUT} ${SOURCE}
+        DEPENDS ${SOURCE} ${schemac})
+endfunction(SchemaCompile)
@@ -15,103 +15,373 @@ included with this software
         All rights reserved.
 ********************************************************************/
 /**
- * addsys(8) imports a service bundle into the system. The layer into which the
- * bundle is to be imported must be specified with the -l argument. If there is
- * no `live` snapshot for the services specified in the bundle, the changes made
- * are reflected immediately in the configuration of the services; otherwise the
- * new configuration will not be made live until a refresh command is issued.
+ * addsys(8) imports service bundles into the system. The layer into which the
+ * bundles are to be imported must be specified with the -l argument. If there
+ * is no `live` snapshot for the services specified in a bundle, the changes
+ * made are reflected immediately in the configuration of the services;
+ * otherwise the new configuration will not be made live until a refresh
+ * command is issued.
+ *
+ * Any number of bundles, or directories to be searched for bundles, may be
+ * given. They are parsed and validated in parallel, then all imported in a
+ * single transaction.
+ *
+ * Given -, addsys instead reads a stream of bundles from stdin, which may be a
+ * pipe or socket, so that generated bundles need not be written to files
+ * first. Each is preceded by a header line giving its length and a logical
+ * name to stand in for its path; they are imported in batches, each batch in
+ * its own transaction.
+ *
+ * A bundle imported before is compared with what the repository holds of it,
+ * and only the differences are written. With -n, they are printed instead.
  */
 
 #include <sys/param.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdarg>
+#include <cstdlib>
+#include <dirent.h>
 #include <limits.h>
+#include <map>
 #include <memory>
+#include <new>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <unistd.h>
+#include <vector>
 
 #include "eci/Event.hh"
+#include "eci/Hash.h"
 #include "eci/Logger.hh"
 #include "eci/Platform.h"
 #include "eci/SQLite.h"
 #include "io.eComCloud.eci.IManager.hh"
-#include "serviceBundleSchema.json.h"
+#include "serviceBundleSchema.schema.hh"
 #include "sqlite3.h"
 
-struct Property
+/**
+ * Largest bundle accepted in a stream. Its buffer is sized from the length in
+ * its header before any of it is read, so that length must be bounded.
+ */
+static const size_t kMaxStreamBundleBytes = 16 * 1024 * 1024;
+
+/* A string belonging to someone else - usually the bundle's UCL object. */
+struct StrView
 {
-    std::string key;
+    const char *ptr = NULL;
+    size_t len = 0;
+
+    StrView() = default;
+    StrView(const char *ptr, size_t len) : ptr(ptr), len(len){};
 
-    Property() = default;
-    Property(std::string key) : key(std::move(key)){};
-    virtual ~Property() = default;
+    std::string str() const { return std::string(ptr, len); }
 };
 
-struct PropString : public Property
+/**
+ * Bump allocator for a bundle's model. Nothing allocated from it is
+ * destroyed; all its memory is freed at once when the arena is.
+ */
+class Arena
 {
-    std::string value;
+    enum
+    {
+        kChunkSize = 16384
+    };
+
+    std::vector<std::unique_ptr<char[]>> chunks;
+    char *cur = NULL;
+    size_t left = 0;
+
+  public:
+    void *alloc(size_t size, size_t align);
+
+    template <class T> T *make()
+    {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "arena objects are never destroyed");
+        return new (alloc(sizeof(T), alignof(T))) T();
+    }
 
-    PropString() = default;
-    PropString(std::string key, std::string value)
-        : Property(std::move(key)), value(std::move(value)){};
+    /* Copy a string into the arena. */
+    StrView dup(const std::string &str);
 };
 
-struct PropPage : public Property
+/* Singly-linked list of arena objects, each with a `next` pointer. */
+template <class T> struct ArenaList
 {
-    std::list<std::unique_ptr<Property>> properties;
+    T *first = NULL;
+    T **tail = &first;
+
+    void append(T *item)
+    {
+        *tail = item;
+        tail = &item->next;
+    }
+};
 
-    PropPage() = default;
-    PropPage(std::string key) : Property(std::move(key)){};
-    PropPage(const PropPage &) = delete;
+struct Property
+{
+    enum Kind
+    {
+        kString,
+        kPage,
+    } kind;
+    StrView key;
+    /* For kString. */
+    StrView value;
+    /* For kPage. */
+    ArenaList<Property> properties;
+    Property *next = NULL;
 };
 
 struct Instance
 {
-    std::string clsName;
-    std::string name;
-    std::list<std::unique_ptr<Property>> properties;
-
-    Instance() = default;
-    Instance(const Instance &) = delete;
+    StrView name;
+    ArenaList<Property> properties;
+    Instance *next = NULL;
 };
 
 struct Class
 {
-    std::string name;
-    std::list<Instance> instances;
-    std::list<std::unique_ptr<Property>> properties;
+    StrView name;
+    ArenaList<Instance> instances;
+    ArenaList<Property> properties;
+    Class *next = NULL;
+};
 
-    Class() = default;
-    Class(const Class &) = delete;
+/* A service bundle to be imported. */
+struct Bundle
+{
+    /**
+     * Full path to the bundle; or, if it was read from a stream, the logical
+     * name it was given there. Either way, it is its Bundles.Filename.
+     */
+    std::string path;
+    /* Whether it was read from a stream; if so, its text is in contents. */
+    bool streamed = false;
+    std::string contents;
+    /* Hash of its contents; see eciHashFile(). */
+    uint64_t hash = 0;
+    /* Whether it was imported already, with the same contents and layer. */
+    bool unchanged = false;
+    /* Whether it was parsed and validated successfully. */
+    bool valid = false;
+    /* Parsed bundle; the model's strings point into it. */
+    ucl_object_t *obj = NULL;
+    /* Holds the model. */
+    Arena arena;
+    /* Processed classes to be imported */
+    ArenaList<Class> classes;
+
+    Bundle(std::string path) : path(std::move(path)){};
+    Bundle(const Bundle &) = delete;
+    ~Bundle()
+    {
+        if (obj)
+            ucl_obj_unref(obj);
+    }
 };
 
+/**
+ * A property of a bundle as it is in the repository: its Properties row and
+ * the PropertyValues row to which that refers.
+ */
+struct OldProp
+{
+    int propID;
+    int propValID;
+    bool isPage;
+    std::string value;
+    int pageID;
+    /* The key's text, which is read only in a dry run, to describe removal. */
+    std::string key;
+};
+
+/* Which of a property's parent columns is set. */
+enum PropParent
+{
+    kParentService,
+    kParentInstance,
+    kParentPage,
+};
+
+/* Old properties by parent kind, parent ID, and key string ID. */
+typedef std::multimap<std::tuple<PropParent, int, int>, OldProp> OldProps;
+
 class AddSys : Logger, io_eComCloud_eci_IManagerDelegate, Handler
 {
     sqlite3 *conn;
-    struct ucl_parser *parser;
-    ucl_object_t *schemaBundle;
+    /* Layer into which to import. */
+    int layer = 0;
+    /* Whether only to print the changes that would be made. */
+    bool dryRun = false;
+    /**
+     * In a dry run, stands in for the IDs of rows that would be inserted.
+     * Counts down from INT_MAX, so as never to be found in the repository.
+     */
+    int lastDryRunID = INT_MAX;
 
-    /* List of processed classes to be imported */
-    std::list<Class> classes;
+    /* Bundles to be imported, in the order in which they were given. */
+    std::list<Bundle> bundles;
 
-    /* Delete a bundle from the repository, along with all its PropertyValues
-     * and their Properties. */
-    void deleteBundle(int bundleID);
+    /**
+     * Prepared statements used in importing, prepared once per run by
+     * stmtsPrepare(). Parameters are bound by name.
+     */
+    sqlite3_stmt *stmtBundleLookup;
+    sqlite3_stmt *stmtBundleNew;
+    sqlite3_stmt *stmtBundleSet;
+    sqlite3_stmt *stmtBundleProps;
+    sqlite3_stmt *stmtStrLookup;
+    sqlite3_stmt *stmtStrNew;
+    sqlite3_stmt *stmtSvcLookup;
+    sqlite3_stmt *stmtSvcNew;
+    sqlite3_stmt *stmtNstLookup;
+    sqlite3_stmt *stmtNstNew;
+    /* Property groups, by parent service and parent group respectively. */
+    sqlite3_stmt *stmtSvcPageLookup;
+    sqlite3_stmt *stmtSvcPageNew;
+    sqlite3_stmt *stmtPagePageLookup;
+    sqlite3_stmt *stmtPagePageNew;
+    sqlite3_stmt *stmtPropValStringNew;
+    sqlite3_stmt *stmtPropValPageNew;
+    sqlite3_stmt *stmtPropValStringSet;
+    sqlite3_stmt *stmtPropValPageSet;
+    sqlite3_stmt *stmtPropValDel;
+    /* Properties, by parent service, instance, and group respectively. */
+    sqlite3_stmt *stmtSvcPropNew;
+    sqlite3_stmt *stmtNstPropNew;
+    sqlite3_stmt *stmtPagePropNew;
+    sqlite3_stmt *stmtPropDel;
 
-    void import(int layer, const char *bundlePath, Class *klass);
-    void importProp(int bundleID, int parentSvcId, int parentInstId,
-                    int parentPageId, Property *prop);
+    /**
+     * IDs of the interned strings, services, instances (by service ID and
+     * name), and property groups (by parent service ID or 0, parent group ID
+     * or 0, and name string ID) looked up or created so far this run, so that
+     * each is sought but once.
+     */
+    std::map<std::string, int> strIDs;
+    std::map<std::string, int> svcIDs;
+    std::map<std::pair<int, std::string>, int> nstIDs;
+    std::map<std::tuple<int, int, int>, int> pageIDs;
+
+    /**
+     * Content hash and layer of the latest import of each bundle already in
+     * the repository, by filename. Read-only once parsing starts.
+     */
+    std::map<std::string, std::pair<uint64_t, int>> knownBundles;
+
+    /**
+     * Properties of the old version of the bundle being imported, which are
+     * removed as they are matched with those of the new. Those left over at
+     * the end are deleted.
+     */
+    OldProps oldProps;
+    /* Changes made (or, in a dry run, to be made) to the bundle. */
+    int nAdded, nChanged, nRemoved;
+    /**
+     * Bundles processed so far this run, how many were unchanged, and how
+     * many failed, whether to parse, to validate, or to import (and were
+     * rolled back.)
+     */
+    size_t nBundles = 0;
+    size_t nUnchanged = 0;
+    size_t nFailed = 0;
+
+    /* Fill knownBundles. */
+    void knownBundlesLoad();
+
+    void stmtsPrepare();
+    void stmtsFinalize();
+    sqlite3_stmt *stmtPrepare(const char *sql);
+    /**
+     * Step an INSERT, UPDATE, or DELETE statement to completion and reset it.
+     *
+     * @returns the last inserted row ID.
+     * @returns -1 if the statement failed.
+     */
+    int stmtStepDone(sqlite3_stmt *stmt, const char *what);
+
+    /**
+     * Look up an ID with \p lookup; if there is none, insert a row with \p
+     * insert and return its ID. Both statements must already be bound. In a
+     * dry run, nothing is inserted, and a placeholder ID is returned. As with
+     * the *GetOrCreate() methods, -1 is returned on failure.
+     */
+    int idGetOrCreate(sqlite3_stmt *lookup, sqlite3_stmt *insert,
+                      const char *what, const std::string &name);
+    /* Get the ID of an interned string, interning it if need be. */
+    int strGetOrCreate(const std::string &value);
+    /* \p name is of the form type$service; the type may be empty. */
+    int svcGetOrCreate(const std::string &name);
+    int nstGetOrCreate(int svcID, const std::string &name);
+    int pageGetOrCreate(int parentSvcID, int parentPageID, int nameID,
+                        const std::string &name);
+
+    /* Fill oldProps with the properties of a bundle in the repository. */
+    int oldPropsLoad(int bundleID);
+    /* Count a change, and describe it if this is a dry run. */
+    void change(char op, const char *fmt, ...);
+
+    /**
+     * Add a bundle to be imported; or, if \p path is a directory, all the
+     * bundles (files ending ".ucl") found beneath it, in order of filename.
+     */
+    void addPath(const char *path);
+
+    /**
+     * Import a bundle within the caller's transaction. If an old version is
+     * to be replaced, only the differences between the two are written.
+     *
+     * @returns 0 if successful.
+     * @returns -1 if a statement failed; the bundle is then part-imported,
+     * and must be rolled back.
+     */
+    int import(Bundle *bundle);
+    /**
+     * Import all parsed bundles in one transaction, then free them. Each
+     * bundle is imported under a savepoint, so that one which fails is rolled
+     * back alone. In a dry run, the transaction is rolled back.
+     */
+    void importAll();
+    int importClass(int bundleID, Class *klass);
+    int importProp(int bundleID, int parentSvcId, int parentInstId,
+                   int parentPageId, Property *prop, const std::string &path);
+
+    /**
+     * Read up to \p max bundles from a stream into bundles. Each is framed by
+     * a header line, giving the length in bytes of its text and its logical
+     * name, separated by a space: "<length> <name>\n<text>". A length over
+     * kMaxStreamBundleBytes is refused.
+     *
+     * @returns the number of bundles read; 0 at the end of the stream.
+     */
+    size_t streamRead(FILE *in, size_t max);
 
-    void parse(int layer, const char *bundlePath);
-    void process(const ucl_object_t *obj);
-    void processDeps(std::list<std::unique_ptr<Property>> &properties,
+    /* Parse all bundles on \p nThreads threads. */
+    void parseAll(unsigned nThreads);
+    /**
+     * Hash a bundle, then, unless it is unchanged since it was last imported,
+     * parse and validate it against the service bundle schema. Thread-safe.
+     */
+    void parse(Bundle *bundle);
+    /* Build the model of a bundle in its arena. */
+    void process(Bundle *bundle, const ucl_object_t *obj);
+    void processDeps(Arena &arena, ArenaList<Property> &properties,
                      const ucl_object_t *obj, bool isDependents = false);
-    void processInst(std::list<Instance> &nsts, const ucl_object_t *obj);
+    void processInst(Arena &arena, ArenaList<Instance> &nsts,
+                     const ucl_object_t *obj);
     /* Process a UCL page adding it to the properties list */
-    void processPage(std::list<std::unique_ptr<Property>> &properties,
+    void processPage(Arena &arena, ArenaList<Property> &properties,
                      const ucl_object_t *obj, const char *type = NULL);
-    void processProp(std::list<std::unique_ptr<Property>> &properties,
+    void processProp(Arena &arena, ArenaList<Property> &properties,
                      const ucl_object_t *obj);
 
   public:
@@ -120,277 +390,852 @@ class AddSys : Logger, io_eComCloud_eci_IManagerDelegate, Handler
     int main(int argc, char *argv[]);
 };
 
-void AddSys::deleteBundle(int bundleID)
+static void bindInt(sqlite3_stmt *stmt, const char *param, int val)
+{
+    sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, param), val);
+}
+
+static void bindInt64(sqlite3_stmt *stmt, const char *param, uint64_t val)
+{
+    sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, param),
+                       (sqlite3_int64)val);
+}
+
+static void bindText(sqlite3_stmt *stmt, const char *param,
+                     const std::string &val)
+{
+    sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, param),
+                      val.c_str(), val.size(), SQLITE_TRANSIENT);
+}
+
+/* The view must outlive the statement's next reset. */
+static void bindText(sqlite3_stmt *stmt, const char *param, StrView val)
+{
+    sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, param), val.ptr,
+                      val.len, SQLITE_STATIC);
+}
+
+/* Views of a UCL object's key and string value. */
+static StrView uclKey(const ucl_object_t *obj)
+{
+    StrView view;
+    view.ptr = ucl_object_keyl(obj, &view.len);
+    return view;
+}
+
+static StrView uclString(const ucl_object_t *obj)
+{
+    StrView view;
+    view.ptr = ucl_object_tolstring(obj, &view.len);
+    return view;
+}
+
+void *Arena::alloc(size_t size, size_t align)
+{
+    size_t pad = -(uintptr_t)cur & (align - 1);
+
+    if (pad + size > left)
+    {
+        size_t chunkSize = std::max<size_t>(kChunkSize, size + align);
+
+        chunks.emplace_back(new char[chunkSize]);
+        cur = chunks.back().get();
+        left = chunkSize;
+        pad = -(uintptr_t)cur & (align - 1);
+    }
+
+    cur += pad;
+    left -= pad + size;
+    cur += size;
+
+    return cur - size;
+}
+
+StrView Arena::dup(const std::string &str)
+{
+    char *copy = (char *)alloc(str.size(), 1);
+
+    memcpy(copy, str.data(), str.size());
+    return StrView(copy, str.size());
+}
+
+sqlite3_stmt *AddSys::stmtPrepare(const char *sql)
 {
     sqlite3_stmt *stmt;
-    int res = sqlite3_prepare_v2f(conn, &stmt, NULL,
-                                  "SELECT rowid FROM PropertyValues "
-                                  "WHERE FK_BundleID = %d;",
-                                  bundleID);
 
-    if (res != SQLITE_OK)
-        die("Failed to get old property values: %s\n", sqlite3_errmsg(conn));
+    if (sqlite3_prepare_v2(conn, sql, -1, &stmt, NULL) != SQLITE_OK)
+        die("Failed to prepare statement: %s\n", sqlite3_errmsg(conn));
+
+    return stmt;
+}
+
+void AddSys::stmtsPrepare()
+{
+    /* snapshots may keep older rows for the same file alive */
+    stmtBundleLookup = stmtPrepare("SELECT BundleID, RefCount FROM Bundles "
+                                   "WHERE Filename = :filename "
+                                   "ORDER BY BundleID DESC LIMIT 1;");
+    stmtBundleNew = stmtPrepare("INSERT INTO Bundles(Filename, MD5Sum, Layer) "
+                                "VALUES(:filename, :hash, :layer);");
+    stmtBundleSet = stmtPrepare("UPDATE Bundles SET MD5Sum = :hash, "
+                                "Layer = :layer WHERE BundleID = :bundleID;");
+    stmtBundleProps = stmtPrepare(
+        "SELECT P.PropertyID, P.FK_Parent_ServiceID, P.FK_Parent_InstanceID, "
+        "P.FK_Parent_PropertyGroupID, V.PropertyValueID, V.Type, "
+        "V.FK_Key_StringID, V.StringValue, V.FK_PageValue_PropertyGroupID, "
+        "S.Value "
+        "FROM PropertyValues V "
+        "JOIN Properties P ON P.FK_PropertyValueID = V.PropertyValueID "
+        "JOIN Strings S ON S.StringID = V.FK_Key_StringID "
+        "WHERE V.FK_BundleID = :bundleID;");
+
+    stmtStrLookup =
+        stmtPrepare("SELECT StringID FROM Strings WHERE Value = :value;");
+    stmtStrNew = stmtPrepare("INSERT INTO Strings(Value) VALUES (:value);");
+    stmtSvcLookup =
+        stmtPrepare("SELECT ServiceID FROM Services "
+                    "WHERE Type = :type AND FK_Name_StringID = :nameID;");
+    stmtSvcNew = stmtPrepare("INSERT INTO Services(Type, FK_Name_StringID) "
+                             "VALUES (:type, :nameID);");
+    stmtNstLookup = stmtPrepare("SELECT InstanceID FROM Instances "
+                                "WHERE FK_Parent_ServiceID = :parentID "
+                                "AND Name = :name;");
+    stmtNstNew = stmtPrepare("INSERT INTO Instances(FK_Parent_ServiceID, Name) "
+                             "VALUES (:parentID, :name);");
+
+    stmtSvcPageLookup =
+        stmtPrepare("SELECT PropertyGroupID FROM PropertyGroups "
+                    "WHERE FK_Parent_ServiceID = :parentID "
+                    "AND FK_Name_StringID = :nameID;");
+    stmtSvcPageNew = stmtPrepare(
+        "INSERT INTO PropertyGroups(FK_Name_StringID, FK_Parent_ServiceID) "
+        "VALUES (:nameID, :parentID);");
+    stmtPagePageLookup =
+        stmtPrepare("SELECT PropertyGroupID FROM PropertyGroups "
+                    "WHERE FK_Parent_PropertyGroupID = :parentID "
+                    "AND FK_Name_StringID = :nameID;");
+    stmtPagePageNew = stmtPrepare(
+        "INSERT INTO PropertyGroups(FK_Name_StringID, "
+        "FK_Parent_PropertyGroupID) VALUES (:nameID, :parentID);");
+
+    stmtPropValStringNew = stmtPrepare(
+        "INSERT INTO PropertyValues"
+        "(FK_BundleID, Type, FK_Key_StringID, StringValue) "
+        "VALUES(:bundleID, 'String', :keyID, :value);");
+    stmtPropValPageNew = stmtPrepare(
+        "INSERT INTO PropertyValues "
+        "(FK_BundleID, Type, FK_Key_StringID, FK_PageValue_PropertyGroupID) "
+        "VALUES(:bundleID, 'Page', :keyID, :pageID);");
+    stmtPropValStringSet = stmtPrepare(
+        "UPDATE PropertyValues SET Type = 'String', StringValue = :value, "
+        "FK_PageValue_PropertyGroupID = NULL "
+        "WHERE PropertyValueID = :propValID;");
+    stmtPropValPageSet = stmtPrepare(
+        "UPDATE PropertyValues SET Type = 'Page', StringValue = NULL, "
+        "FK_PageValue_PropertyGroupID = :pageID "
+        "WHERE PropertyValueID = :propValID;");
+    stmtPropValDel = stmtPrepare(
+        "DELETE FROM PropertyValues WHERE PropertyValueID = :propValID;");
+
+    stmtSvcPropNew =
+        stmtPrepare("INSERT INTO Properties(FK_Parent_ServiceID, "
+                    "FK_PropertyValueID) VALUES (:parentID, :propValID);");
+    stmtNstPropNew =
+        stmtPrepare("INSERT INTO Properties(FK_Parent_InstanceID, "
+                    "FK_PropertyValueID) VALUES (:parentID, :propValID);");
+    stmtPagePropNew =
+        stmtPrepare("INSERT INTO Properties(FK_Parent_PropertyGroupID, "
+                    "FK_PropertyValueID) VALUES (:parentID, :propValID);");
+    stmtPropDel =
+        stmtPrepare("DELETE FROM Properties WHERE PropertyID = :propID;");
+}
+
+void AddSys::knownBundlesLoad()
+{
+    sqlite3_stmt *stmt = stmtPrepare("SELECT Filename, MD5Sum, Layer "
+                                     "FROM Bundles ORDER BY BundleID;");
+    int res;
+
+    /* later rows supersede earlier ones retained for snapshots' sake */
+    while ((res = sqlite3_step(stmt)) == SQLITE_ROW)
+        knownBundles[(const char *)sqlite3_column_text(stmt, 0)] =
+            std::make_pair((uint64_t)sqlite3_column_int64(stmt, 1),
+                           sqlite3_column_int(stmt, 2));
+
+    if (res != SQLITE_DONE)
+        die("Failed to get existing bundles: %s\n", sqlite3_errmsg(conn));
+
+    sqlite3_finalize(stmt);
+}
+
+void AddSys::stmtsFinalize()
+{
+    sqlite3_stmt *stmts[] = {
+        stmtBundleLookup,     stmtBundleNew,        stmtBundleSet,
+        stmtBundleProps,      stmtStrLookup,        stmtStrNew,
+        stmtSvcLookup,        stmtSvcNew,           stmtNstLookup,
+        stmtNstNew,           stmtSvcPageLookup,    stmtSvcPageNew,
+        stmtPagePageLookup,   stmtPagePageNew,      stmtPropValStringNew,
+        stmtPropValPageNew,   stmtPropValStringSet, stmtPropValPageSet,
+        stmtPropValDel,       stmtSvcPropNew,       stmtNstPropNew,
+        stmtPagePropNew,      stmtPropDel};
+
+    for (auto stmt : stmts)
+        sqlite3_finalize(stmt);
+}
+
+int AddSys::stmtStepDone(sqlite3_stmt *stmt, const char *what)
+{
+    int res = sqlite3_step(stmt);
+
+    sqlite3_reset(stmt);
+    if (res != SQLITE_DONE)
+    {
+        log(kErr, "Failed to %s: %s\n", what, sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    return sqlite3_last_insert_rowid(conn);
+}
+
+int AddSys::idGetOrCreate(sqlite3_stmt *lookup, sqlite3_stmt *insert,
+                          const char *what, const std::string &name)
+{
+    int res = sqlite3_step(lookup);
+    int id;
+
+    if (res == SQLITE_ROW)
+    {
+        id = sqlite3_column_int(lookup, 0);
+        sqlite3_reset(lookup);
+        return id;
+    }
 
-    while ((res = sqlite3_step(stmt)) != SQLITE_DONE)
+    sqlite3_reset(lookup);
+    if (res != SQLITE_DONE)
     {
-        if (res == SQLITE_ROW)
+        log(kErr, "Failed to get %s ID: %s\n", what, sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    change('+', "%s %s", what, name.c_str());
+    if (dryRun)
+        return lastDryRunID--;
+
+    res = sqlite3_step(insert);
+    sqlite3_reset(insert);
+    if (res != SQLITE_DONE)
+    {
+        log(kErr, "Failed to insert %s: %s\n", what, sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    return sqlite3_last_insert_rowid(conn);
+}
+
+int AddSys::strGetOrCreate(const std::string &value)
+{
+    auto it = strIDs.find(value);
+    int res;
+    int id;
+
+    if (it != strIDs.end())
+        return it->second;
+
+    /* interning a string is not counted as a change */
+    bindText(stmtStrLookup, ":value", value);
+    res = sqlite3_step(stmtStrLookup);
+    id = res == SQLITE_ROW ? sqlite3_column_int(stmtStrLookup, 0) : 0;
+    sqlite3_reset(stmtStrLookup);
+
+    if (res == SQLITE_DONE)
+    {
+        if (dryRun)
+            id = lastDryRunID--;
+        else
         {
-            int rowID = sqlite3_column_int(stmt, 0);
+            bindText(stmtStrNew, ":value", value);
+            id = stmtStepDone(stmtStrNew, "intern string");
+        }
+    }
+    else if (res != SQLITE_ROW)
+    {
+        log(kErr, "Failed to get string ID: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
 
-            res = sqlite3_execf(conn, NULL, NULL, NULL,
-                                "DELETE FROM PropertyValues WHERE rowid = %d;",
-                                rowID);
-            if (res != SQLITE_OK)
-                die("Failed to delete old property values: %s\n",
-                    sqlite3_errmsg(conn));
+    if (id >= 0)
+        strIDs[value] = id;
 
-            /* accordingly we delete any properties referring to it
-               TODO: deref propertygroup if needed??? */
-            res = sqlite3_execf(conn, NULL, NULL, NULL,
-                                "DELETE FROM Properties "
-                                "WHERE FK_PropertyValueID = %d;",
-                                rowID);
-            if (res != SQLITE_OK)
-                die("Failed to delete old properties: %s\n",
-                    sqlite3_errmsg(conn));
+    return id;
+}
+
+int AddSys::svcGetOrCreate(const std::string &name)
+{
+    auto it = svcIDs.find(name);
+    int id;
+    int nameID;
+    size_t dollar = name.find('$');
+    std::string type =
+        dollar == std::string::npos ? "" : name.substr(0, dollar);
+    std::string svc =
+        dollar == std::string::npos ? name : name.substr(dollar + 1);
+
+    if (it != svcIDs.end())
+        return it->second;
+
+    if ((nameID = strGetOrCreate(svc)) < 0)
+        return -1;
+
+    bindText(stmtSvcLookup, ":type", type);
+    bindInt(stmtSvcLookup, ":nameID", nameID);
+    bindText(stmtSvcNew, ":type", type);
+    bindInt(stmtSvcNew, ":nameID", nameID);
+
+    id = idGetOrCreate(stmtSvcLookup, stmtSvcNew, "service", name);
+    if (id >= 0)
+        svcIDs[name] = id;
+
+    return id;
+}
+
+int AddSys::nstGetOrCreate(int svcID, const std::string &name)
+{
+    auto key = std::make_pair(svcID, name);
+    auto it = nstIDs.find(key);
+    int id;
+
+    if (it != nstIDs.end())
+        return it->second;
+
+    bindInt(stmtNstLookup, ":parentID", svcID);
+    bindText(stmtNstLookup, ":name", name);
+    bindInt(stmtNstNew, ":parentID", svcID);
+    bindText(stmtNstNew, ":name", name);
+
+    id = idGetOrCreate(stmtNstLookup, stmtNstNew, "instance", name);
+    if (id >= 0)
+        nstIDs[key] = id;
+
+    return id;
+}
+
+int AddSys::pageGetOrCreate(int parentSvcID, int parentPageID, int nameID,
+                            const std::string &name)
+{
+    auto key = std::make_tuple(parentPageID ? 0 : parentSvcID, parentPageID,
+                               nameID);
+    auto it = pageIDs.find(key);
+    sqlite3_stmt *lookup =
+        parentPageID ? stmtPagePageLookup : stmtSvcPageLookup;
+    sqlite3_stmt *insert = parentPageID ? stmtPagePageNew : stmtSvcPageNew;
+    int parentID = parentPageID ? parentPageID : parentSvcID;
+    int id;
+
+    if (it != pageIDs.end())
+        return it->second;
+
+    bindInt(lookup, ":parentID", parentID);
+    bindInt(lookup, ":nameID", nameID);
+    bindInt(insert, ":parentID", parentID);
+    bindInt(insert, ":nameID", nameID);
+
+    id = idGetOrCreate(lookup, insert, "property group", name);
+    if (id >= 0)
+        pageIDs[key] = id;
+
+    return id;
+}
+
+int AddSys::oldPropsLoad(int bundleID)
+{
+    int res;
+
+    bindInt(stmtBundleProps, ":bundleID", bundleID);
+
+    while ((res = sqlite3_step(stmtBundleProps)) == SQLITE_ROW)
+    {
+        OldProp prop;
+        PropParent parent;
+        int parentID;
+        const char *type =
+            (const char *)sqlite3_column_text(stmtBundleProps, 5);
+        int keyID = sqlite3_column_int(stmtBundleProps, 6);
+        const char *value =
+            (const char *)sqlite3_column_text(stmtBundleProps, 7);
+
+        if ((parentID = sqlite3_column_int(stmtBundleProps, 3)))
+            parent = kParentPage;
+        else if ((parentID = sqlite3_column_int(stmtBundleProps, 2)))
+            parent = kParentInstance;
+        else
+        {
+            parent = kParentService;
+            parentID = sqlite3_column_int(stmtBundleProps, 1);
         }
+
+        prop.propID = sqlite3_column_int(stmtBundleProps, 0);
+        prop.propValID = sqlite3_column_int(stmtBundleProps, 4);
+        prop.isPage = !strcmp(type, "Page");
+        prop.value = value ? value : "";
+        prop.pageID = sqlite3_column_int(stmtBundleProps, 8);
+        if (dryRun)
+            prop.key = (const char *)sqlite3_column_text(stmtBundleProps, 9);
+
+        oldProps.emplace(std::make_tuple(parent, parentID, keyID),
+                         std::move(prop));
     }
 
-    sqlite3_finalize(stmt);
+    sqlite3_reset(stmtBundleProps);
+    if (res != SQLITE_DONE)
+    {
+        log(kErr, "Failed to get old properties: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
 
-    res = sqlite3_execf(conn, NULL, NULL, NULL,
-                        "DELETE FROM Bundles WHERE BundleID = %d;", bundleID);
-    if (res != SQLITE_OK)
-        die("Failed to delete old bundle: %s\n", sqlite3_errmsg(conn));
+    return 0;
+}
+
+void AddSys::change(char op, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (op == '+')
+        nAdded++;
+    else if (op == '~')
+        nChanged++;
+    else
+        nRemoved++;
+
+    if (!dryRun)
+        return;
+
+    printf("  %c ", op);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
 }
 
-void AddSys::import(int layer, const char *bundleFullPath, Class *klass)
+int AddSys::import(Bundle *bundle)
 {
     int res;
-    int bundleID;
-    int rcOldBundle;
-    int svcId;
+    int bundleID = 0;
+    int ret = -1;
 
-    /**
-     * Step 1: Begin the transaction.
-     */
-    res = sqlite3_exec(conn, "BEGIN TRANSACTION;", NULL, NULL, NULL);
-    if (res != SQLITE_OK)
-        die("Failed to begin transaction: %s\n", sqlite3_errmsg(conn));
+    nAdded = nChanged = nRemoved = 0;
+    if (dryRun)
+        printf("%s:\n", bundle->path.c_str());
 
     /**
-     * Step 2: If there is an old Bundle entry, then if its refcount is 0,
-     * delete it and all associated property values.
-     * TODO: check if old Bundle entry's MD5sum differs; if it doesn't, let it
-     * alone.
+     * Step 1: If there is an old Bundle entry, then if its refcount is 0, it
+     * is to be brought up to date in place. (If its contents were unchanged,
+     * we would not have got this far.) Otherwise it is retained for the sake
+     * of the snapshots referring to it, and a new entry is added.
      * TODO: add an 'old' field to either PropertyValues or Properties, and set
      * it true if the backing bundle is gone but it's been retained due to
      * extant references?
      * TODO: what about administrative customisations? do we need to refcount
      * per-prop rather than per bundle for these? I don't think we do.
      */
-
-    res = sqlite3_get_two_intf(
-        conn, &bundleID, &rcOldBundle,
-        "SELECT BundleID, RefCount FROM Bundles WHERE Filename = '%s';",
-        bundleFullPath);
+    bindText(stmtBundleLookup, ":filename", bundle->path);
+    res = sqlite3_step(stmtBundleLookup);
 
     if (res == SQLITE_ROW)
     {
-        printf("Have old bundle id %d.\n", bundleID);
+        /* a bundle's refcount is incremented during the creation of a
+         * snapshot. */
+        if (!sqlite3_column_int(stmtBundleLookup, 1))
+            bundleID = sqlite3_column_int(stmtBundleLookup, 0);
+        sqlite3_reset(stmtBundleLookup);
+    }
+    else
+    {
+        sqlite3_reset(stmtBundleLookup);
+        if (res != SQLITE_DONE)
+        {
+            log(kErr, "Failed to get bundle ID: %s\n", sqlite3_errmsg(conn));
+            return -1;
+        }
+    }
+
+    /**
+     * Step 2: Update the Bundles entry, loading the properties it has now to
+     * compare with the new; or add a new one.
+     */
+    if (bundleID)
+    {
+        if (oldPropsLoad(bundleID) < 0)
+            goto cleanup;
 
-        /* a bundle's refcount is incremented during the creation of a snapshot.
-         * If the refcount is 0 - abolish it*/
-        if (!rcOldBundle)
-            deleteBundle(bundleID);
+        if (!dryRun)
+        {
+            bindInt64(stmtBundleSet, ":hash", bundle->hash);
+            bindInt(stmtBundleSet, ":layer", layer);
+            bindInt(stmtBundleSet, ":bundleID", bundleID);
+            if (stmtStepDone(stmtBundleSet, "update bundle descriptor") < 0)
+                goto cleanup;
+        }
+    }
+    else if (!dryRun)
+    {
+        bindText(stmtBundleNew, ":filename", bundle->path);
+        bindInt64(stmtBundleNew, ":hash", bundle->hash);
+        bindInt(stmtBundleNew, ":layer", layer);
+        bundleID = stmtStepDone(stmtBundleNew, "insert bundle descriptor");
+        if (bundleID < 0)
+            goto cleanup;
     }
-    else if (res != SQLITE_DONE)
-        die("Failed to get bundle ID: %s\n", sqlite3_errmsg(conn));
 
     /**
-     * Step 3: Add a Bundles entry.
+     * Step 3: Import each class, writing only what differs from the old
+     * properties.
      */
-    res = sqlite3_execf(
-        conn, NULL, NULL, NULL,
-        "INSERT INTO Bundles(Filename, MD5Sum, Layer) VALUES('%s', 0, %d);",
-        bundleFullPath, layer);
-    if (res != SQLITE_OK)
-        die("Failed to insert bundle descriptor: %s\n", sqlite3_errmsg(conn));
-    bundleID = sqlite3_last_insert_rowid(conn);
+    for (Class *klass = bundle->classes.first; klass; klass = klass->next)
+        if (importClass(bundleID, klass) < 0)
+            goto cleanup;
 
     /**
-     * Step 4: get or create a Services entry.
+     * Step 4: Delete the old properties that are no longer present.
+     * TODO: deref propertygroup if needed???
      */
-    res = sqlite3_get_single_intf(
-        conn, &svcId, "SELECT ServiceID FROM Services WHERE Name = '%s';",
-        klass->name.c_str());
-    if (res == SQLITE_DONE)
+    for (auto &old : oldProps)
     {
-        res = sqlite3_execf(conn, NULL, NULL, NULL,
-                            "INSERT INTO Services(Name) VALUES ('%s');",
-                            klass->name.c_str());
-        if (res != SQLITE_OK)
-            die("Failed to insert service name: %d\n", sqlite3_errmsg(conn));
-        svcId = sqlite3_last_insert_rowid(conn);
+        change('-', "%s (property value %d)", old.second.key.c_str(),
+               old.second.propValID);
+
+        if (dryRun)
+            continue;
+
+        bindInt(stmtPropDel, ":propID", old.second.propID);
+        if (stmtStepDone(stmtPropDel, "delete old property") < 0)
+            goto cleanup;
+        bindInt(stmtPropValDel, ":propValID", old.second.propValID);
+        if (stmtStepDone(stmtPropValDel, "delete old property value") < 0)
+            goto cleanup;
     }
-    else if (res != SQLITE_ROW)
-        die("Failed to get service ID: %s\n", sqlite3_errmsg(conn));
 
-    printf("Service ID: %d\n", svcId);
+    log(kInfo, "%s: %d added, %d changed, %d removed\n", bundle->path.c_str(),
+        nAdded, nChanged, nRemoved);
+    ret = 0;
+
+cleanup:
+    oldProps.clear();
+    return ret;
+}
+
+int AddSys::importClass(int bundleID, Class *klass)
+{
+    int svcId;
+    std::string svcName = klass->name.str();
 
     /**
-     * Step 5: Import all service-level properties.
+     * Step 1: get or create a Services entry.
      */
-    for (auto &prop : klass->properties)
-        importProp(bundleID, svcId, 0, 0, prop.get());
+    if ((svcId = svcGetOrCreate(svcName)) < 0)
+        return -1;
 
     /**
-     * Step 5: Import all instances.
+     * Step 2: Import all service-level properties.
      */
-    for (auto &inst : klass->instances)
+    for (Property *prop = klass->properties.first; prop; prop = prop->next)
+        if (importProp(bundleID, svcId, 0, 0, prop, svcName) < 0)
+            return -1;
+
+    /**
+     * Step 3: Import all instances.
+     */
+    for (Instance *inst = klass->instances.first; inst; inst = inst->next)
     {
-        int instId;
+        std::string nstName = inst->name.str();
 
         /**
-         * Step 5.1: Get or create an Instances entry.
+         * Step 3.1: Get or create an Instances entry.
          */
-        res = sqlite3_get_single_intf(
-            conn, &instId,
-            "SELECT InstanceID FROM Instances "
-            "WHERE FK_Parent_ServiceID = %d AND Name = '%s';",
-            svcId, inst.name.c_str());
-        if (res == SQLITE_DONE)
-        {
-            printf("ADd instance\n");
-            res = sqlite3_execf(
-                conn, NULL, NULL, NULL,
-                "INSERT INTO Instances(FK_Parent_ServiceID, Name) "
-                "VALUES (%d, '%s');",
-                svcId, inst.name.c_str());
-            if (res != SQLITE_OK)
-                die("Failed to insert instance name: %d\n",
-                    sqlite3_errmsg(conn));
-            instId = sqlite3_last_insert_rowid(conn);
-        }
-        else if (res != SQLITE_ROW)
-            die("Failed to get instance ID: %s\n", sqlite3_errmsg(conn));
+        int instId = nstGetOrCreate(svcId, nstName);
+
+        if (instId < 0)
+            return -1;
 
         /**
-         * Step 5.2: Add all instance-level properties.
+         * Step 3.2: Add all instance-level properties.
          */
-        for (auto &prop : inst.properties)
-            importProp(bundleID, svcId, instId, 0, prop.get());
+        for (Property *prop = inst->properties.first; prop; prop = prop->next)
+            if (importProp(bundleID, svcId, instId, 0, prop,
+                           svcName + ":" + nstName) < 0)
+                return -1;
     }
 
-    /**
-     * Finally: Commit the transaction.
-     */
-    res = sqlite3_exec(conn, "COMMIT;", NULL, NULL, NULL);
-    if (res != SQLITE_OK)
-        die("Failed to commit: %s\n", sqlite3_errmsg(conn));
+    return 0;
 }
 
-void AddSys::importProp(int bundleID, int parentSvcId, int parentInstId,
-                        int parentPageId, Property *prop)
+int AddSys::importProp(int bundleID, int parentSvcId, int parentInstId,
+                       int parentPageId, Property *prop,
+                       const std::string &path)
 {
     int propValId;
-    int res;
-    const char *propParentKey;
-    int propParentID;
-
-    PropString *str = dynamic_cast<PropString *>(prop);
-    PropPage *page = dynamic_cast<PropPage *>(prop);
-
-    if (str)
+    int pageID = 0;
+    sqlite3_stmt *stmtProp;
+    PropParent parent = parentPageId   ? kParentPage
+                        : parentInstId ? kParentInstance
+                                       : kParentService;
+    int parentID = parentPageId   ? parentPageId
+                   : parentInstId ? parentInstId
+                                  : parentSvcId;
+    std::string key = prop->key.str();
+    std::string propPath = path + "/" + key;
+    int keyID = strGetOrCreate(key);
+    OldProps::iterator old;
+
+    if (keyID < 0)
+        return -1;
+    old = oldProps.find(std::make_tuple(parent, parentID, keyID));
+
+    if (prop->kind == Property::kPage)
     {
-        res = sqlite3_execf(conn, NULL, NULL, NULL,
-                            "INSERT INTO PropertyValues"
-                            "(FK_BundleID, Type, PropertyKey, StringValue)"
-                            "VALUES(%d, 'String', '%s', '%s');",
-                            bundleID, prop->key.c_str(), str->value.c_str());
-
-        if (res != SQLITE_OK)
-            die("Failed to insert property value: %s\n", sqlite3_errmsg(conn));
-
-        propValId = sqlite3_last_insert_rowid(conn);
+        pageID = pageGetOrCreate(parentSvcId, parentPageId, keyID, key);
+        if (pageID < 0)
+            return -1;
+
+        for (Property *child = prop->properties.first; child;
+             child = child->next)
+            if (importProp(bundleID, parentSvcId, parentInstId, pageID, child,
+                           propPath) < 0)
+                return -1;
     }
-    else if (page)
-    {
-        int pageID;
-        const char *parentKey = parentPageId ? "FK_Parent_PropertyGroupID"
-                                             : "FK_Parent_ServiceID";
-        int parentID = parentPageId ? parentPageId : parentSvcId;
 
-        res = sqlite3_get_single_intf(
-            conn, &pageID,
-            "SELECT PropertyGroupID FROM PropertyGroups "
-            "WHERE %s = %d AND Name = '%s';",
-            parentKey, parentID, page->key.c_str());
+    /* an old property of the same key is updated, if need be */
+    if (old != oldProps.end())
+    {
+        OldProp &was = old->second;
 
-        if (res == SQLITE_DONE)
+        if (prop->kind == Property::kString &&
+            (was.isPage || was.value != prop->value.str()))
         {
-            res = sqlite3_execf(
-                conn, NULL, NULL, NULL,
-                "INSERT INTO PropertyGroups(Name, %s) VALUES ('%s', %d);",
-                parentKey, page->key.c_str(), parentID);
-            if (res != SQLITE_OK)
-                die("Failed to insert property group entry: %s\n",
-                    sqlite3_errmsg(conn));
-            pageID = sqlite3_last_insert_rowid(conn);
+            change('~', "%s = \"%.*s\"", propPath.c_str(),
+                   (int)prop->value.len, prop->value.ptr);
+
+            if (!dryRun)
+            {
+                bindText(stmtPropValStringSet, ":value", prop->value);
+                bindInt(stmtPropValStringSet, ":propValID", was.propValID);
+                if (stmtStepDone(stmtPropValStringSet,
+                                 "update property value") < 0)
+                    return -1;
+            }
+        }
+        else if (prop->kind == Property::kPage &&
+                 (!was.isPage || was.pageID != pageID))
+        {
+            change('~', "%s (property group)", propPath.c_str());
+
+            if (!dryRun)
+            {
+                bindInt(stmtPropValPageSet, ":pageID", pageID);
+                bindInt(stmtPropValPageSet, ":propValID", was.propValID);
+                if (stmtStepDone(stmtPropValPageSet,
+                                 "update property value") < 0)
+                    return -1;
+            }
         }
-        else if (res != SQLITE_ROW)
-            die("Failed to get property group ID: %s\n", sqlite3_errmsg(conn));
 
-        for (auto &prop : page->properties)
-            importProp(bundleID, parentSvcId, parentInstId, pageID, prop.get());
+        oldProps.erase(old);
+        return 0;
+    }
 
-        res = sqlite3_execf(
-            conn, NULL, NULL, NULL,
-            "INSERT INTO PropertyValues "
-            "(FK_BundleID, Type, PropertyKey, FK_PageValue_PropertyGroupID) "
-            "VALUES(%d, 'Page', '%s', '%d');",
-            bundleID, prop->key.c_str(), pageID);
+    if (prop->kind == Property::kString)
+        change('+', "%s = \"%.*s\"", propPath.c_str(), (int)prop->value.len,
+               prop->value.ptr);
+    else
+        change('+', "%s (property group)", propPath.c_str());
 
-        if (res != SQLITE_OK)
-            die("Failed to insert property value: %s\n", sqlite3_errmsg(conn));
+    if (dryRun)
+        return 0;
 
-        propValId = sqlite3_last_insert_rowid(conn);
+    switch (prop->kind)
+    {
+    case Property::kString:
+        bindInt(stmtPropValStringNew, ":bundleID", bundleID);
+        bindInt(stmtPropValStringNew, ":keyID", keyID);
+        bindText(stmtPropValStringNew, ":value", prop->value);
+        propValId =
+            stmtStepDone(stmtPropValStringNew, "insert property value");
+        break;
+
+    case Property::kPage:
+        bindInt(stmtPropValPageNew, ":bundleID", bundleID);
+        bindInt(stmtPropValPageNew, ":keyID", keyID);
+        bindInt(stmtPropValPageNew, ":pageID", pageID);
+        propValId = stmtStepDone(stmtPropValPageNew, "insert property value");
+        break;
     }
 
-    if (parentPageId)
+    if (propValId < 0)
+        return -1;
+
+    switch (parent)
     {
-        propParentKey = "FK_Parent_PropertyGroupID";
-        propParentID = parentPageId;
+    case kParentPage:
+        stmtProp = stmtPagePropNew;
+        break;
+    case kParentInstance:
+        stmtProp = stmtNstPropNew;
+        break;
+    case kParentService:
+        stmtProp = stmtSvcPropNew;
+        break;
     }
-    else if (parentInstId)
+
+    bindInt(stmtProp, ":parentID", parentID);
+    bindInt(stmtProp, ":propValID", propValId);
+    return stmtStepDone(stmtProp, "insert property") < 0 ? -1 : 0;
+}
+
+void AddSys::addPath(const char *path)
+{
+    char fullPath[MAXPATHLEN];
+    struct stat sb;
+    DIR *dir;
+    struct dirent *ent;
+    std::vector<std::string> names;
+
+    if (!realpath(path, fullPath) || stat(fullPath, &sb) == -1)
+        edie(errno, "Failed to find %s", path);
+
+    if (!S_ISDIR(sb.st_mode))
     {
-        propParentKey = "FK_Parent_InstanceID";
-        propParentID = parentInstId;
+        bundles.emplace_back(fullPath);
+        return;
     }
-    else
+
+    if (!(dir = opendir(fullPath)))
+        edie(errno, "Failed to open directory %s", fullPath);
+
+    while ((ent = readdir(dir)))
+        if (ent->d_name[0] != '.')
+            names.emplace_back(ent->d_name);
+
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+
+    for (auto &name : names)
     {
-        propParentKey = "FK_Parent_ServiceID";
-        propParentID = parentSvcId;
+        std::string entPath = std::string(fullPath) + "/" + name;
+
+        if (stat(entPath.c_str(), &sb) == -1)
+            continue;
+        else if (S_ISDIR(sb.st_mode))
+            addPath(entPath.c_str());
+        else if (name.size() > 4 && !name.compare(name.size() - 4, 4, ".ucl"))
+            bundles.emplace_back(entPath);
     }
+}
 
-    res = sqlite3_execf(conn, NULL, NULL, NULL,
-                        "INSERT INTO Properties(%s, FK_PropertyValueID) "
-                        "VALUES (%d, %d);",
-                        propParentKey, propParentID, propValId);
+size_t AddSys::streamRead(FILE *in, size_t max)
+{
+    char *line = NULL;
+    size_t lineCap = 0;
+    size_t n;
 
-    if (res != SQLITE_OK)
-        die("Failed to insert property: %s\n", sqlite3_errmsg(conn));
+    for (n = 0; n < max; n++)
+    {
+        ssize_t lineLen = getline(&line, &lineCap, in);
+        size_t len;
+        int nameOff = 0;
+
+        if (lineLen == -1)
+        {
+            if (ferror(in))
+                edie(errno, "Failed to read bundle stream");
+            break;
+        }
+
+        if (lineLen && line[lineLen - 1] == '\n')
+            line[--lineLen] = '\0';
+
+        if (sscanf(line, "%zu %n", &len, &nameOff) != 1 || !nameOff ||
+            !line[nameOff])
+            die("Invalid bundle header in stream: \"%s\"\n", line);
+        else if (len > kMaxStreamBundleBytes)
+            die("Invalid bundle length %zu for %s in stream (at most %zu)\n",
+                len, line + nameOff, kMaxStreamBundleBytes);
+
+        bundles.emplace_back(line + nameOff);
+        bundles.back().streamed = true;
+        bundles.back().contents.resize(len);
+
+        if (fread(&bundles.back().contents[0], 1, len, in) != len)
+            die("Bundle stream ended within %s\n", line + nameOff);
+    }
+
+    free(line);
+    return n;
 }
 
-void AddSys::parse(int layer, const char *bundlePath)
+void AddSys::parseAll(unsigned nThreads)
 {
-    ucl_object_t *obj = NULL;
-    ucl_schema_error errValidation;
+    std::vector<Bundle *> work;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> next(0);
+
+    for (auto &bundle : bundles)
+        work.push_back(&bundle);
+
+    nThreads = std::max(1u, std::min(nThreads, (unsigned)work.size()));
+
+    auto worker = [this, &work, &next]() {
+        size_t i;
+
+        while ((i = next++) < work.size())
+            parse(work[i]);
+    };
+
+    for (unsigned i = 1; i < nThreads; i++)
+        threads.emplace_back(worker);
+    worker();
+
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void AddSys::parse(Bundle *bundle)
+{
+    struct ucl_parser *parser = ucl_parser_new(0);
+    ucl_object_t *obj;
+    std::string errValidation;
+    const char *bundlePath = bundle->path.c_str();
+    int res = 0;
+
+    if (bundle->streamed)
+        bundle->hash =
+            eciHash64(bundle->contents.data(), bundle->contents.size(), 0);
+    else
+        res = eciHashFile(bundlePath, &bundle->hash);
+
+    if (res < 0)
+    {
+        loge(kWarn, -res, "  %s: failed to hash", bundlePath);
+        goto cleanup;
+    }
+    else
+    {
+        auto known = knownBundles.find(bundle->path);
 
-    parser = ucl_parser_new(0);
-    parser = ucl_parser_new(0);
+        if (known != knownBundles.end() &&
+            known->second == std::make_pair(bundle->hash, layer))
+        {
+            bundle->unchanged = true;
+            goto cleanup;
+        }
+    }
 
-    ucl_parser_add_file(parser, bundlePath);
+    if (bundle->streamed)
+        ucl_parser_add_chunk(parser,
+                             (const unsigned char *)bundle->contents.data(),
+                             bundle->contents.size());
+    else
+        ucl_parser_add_file(parser, bundlePath);
 
     if (ucl_parser_get_error(parser))
     {
@@ -402,20 +1247,22 @@ void AddSys::parse(int layer, const char *bundlePath)
 
     obj = ucl_parser_get_object(parser);
 
-    if (!ucl_object_validate(schemaBundle, obj, &errValidation))
+    if (!kserviceBundleSchema.validate(obj, errValidation))
     {
-        log(kWarn, "  %s: %s in:\n%s\n", bundlePath, errValidation.msg);
-        printf("%s\n",
-               ((char *)ucl_object_emit(errValidation.obj, UCL_EMIT_JSON)));
+        log(kWarn, "  %s: %s\n", bundlePath, errValidation.c_str());
+        ucl_obj_unref(obj);
         goto cleanup;
     }
 
-    process(obj);
+    /* the model refers to the object's strings, so it lives as long */
+    bundle->obj = obj;
+    process(bundle, obj);
+    bundle->valid = true;
 
 cleanup:
     ucl_parser_free(parser);
-    if (obj)
-        ucl_obj_unref(obj);
+    /* the parsed object has copies of whatever the model needs */
+    std::string().swap(bundle->contents);
 }
 
 #define UclIterate(top, iterName, objName, expand)                             \
@@ -429,87 +1276,104 @@ cleanup:
     }                                                                          \
     while (0)
 
-void AddSys::process(const ucl_object_t *uclCls)
+void AddSys::process(Bundle *bundle, const ucl_object_t *uclCls)
 {
-    Class *cls;
+    Arena &arena = bundle->arena;
+    Class *cls = arena.make<Class>();
     ucl_object_iter_t it = NULL;
     const ucl_object_t *obj;
 
-    classes.emplace_back();
-    cls = &classes.back();
+    bundle->classes.append(cls);
 
     while ((obj = ucl_iterate_object(uclCls, &it, true)))
     {
         const char *key = ucl_object_key(obj);
         if (!strcmp(key, "name"))
-            cls->name = ucl_object_tostring(obj);
+            cls->name = uclString(obj);
         else if (!strcmp(key, "depends"))
-            processDeps(cls->properties, obj);
+            processDeps(arena, cls->properties, obj);
         else if (!strcmp(key, "dependents"))
-            processDeps(cls->properties, obj, true);
+            processDeps(arena, cls->properties, obj, true);
         else if (!strcmp(key, "instances"))
         {
             UclIterate(obj, instIt, inst, true)
-                processInst(cls->instances, inst);
+                processInst(arena, cls->instances, inst);
             UclCloseIterate();
         }
         else if (!strcmp(key, "methods"))
         {
             UclIterate(obj, depsIt, uclPage, true)
-                processPage(cls->properties, uclPage, "method");
+                processPage(arena, cls->properties, uclPage, "method");
             UclCloseIterate();
         }
         else
-            processProp(cls->properties, obj);
+            processProp(arena, cls->properties, obj);
     }
 }
 
-void AddSys::processDeps(std::list<std::unique_ptr<Property>> &properties,
+static Property *propStringNew(Arena &arena, StrView key, StrView value)
+{
+    Property *prop = arena.make<Property>();
+
+    prop->kind = Property::kString;
+    prop->key = key;
+    prop->value = value;
+
+    return prop;
+}
+
+void AddSys::processDeps(Arena &arena, ArenaList<Property> &properties,
                          const ucl_object_t *obj, bool isDependents)
 {
+    static const char kDependent[] = "dependent";
+    static const char kDependency[] = "dependency";
+
     UclIterate(obj, depsIt, uclArrDep, true)
     {
         const char *depType = ucl_object_key(uclArrDep);
 
         UclIterate(uclArrDep, depIt, uclDep, true)
         {
-            PropPage *page = new PropPage;
-            const char *nstName = ucl_object_tostring(uclDep);
-            PropString *propNstPath = new PropString("instance", nstName);
-            PropString *propDepType = new PropString(
-                "type", isDependents ? "dependent" : "dependency");
-
-            page->key.append("dependency_");
-            page->key.append(depType);
-            page->key.append(nstName);
-
-            properties.emplace_back(page);
+            Property *page = arena.make<Property>();
+            StrView nstName = uclString(uclDep);
+
+            page->kind = Property::kPage;
+            page->key = arena.dup(std::string("dependency_") + depType +
+                                  nstName.str());
+            page->properties.append(
+                propStringNew(arena, StrView("instance", 8), nstName));
+            page->properties.append(propStringNew(
+                arena, StrView("type", 4),
+                isDependents ? StrView(kDependent, sizeof(kDependent) - 1)
+                             : StrView(kDependency, sizeof(kDependency) - 1)));
+
+            properties.append(page);
         }
         UclCloseIterate();
     }
     UclCloseIterate();
 }
 
-void AddSys::processInst(std::list<Instance> &nsts, const ucl_object_t *inst)
+void AddSys::processInst(Arena &arena, ArenaList<Instance> &nsts,
+                         const ucl_object_t *inst)
 {
-    Instance *nst;
+    Instance *nst = arena.make<Instance>();
 
-    nsts.emplace_back();
-    nst = &nsts.back();
+    nsts.append(nst);
 
-    nst->name = ucl_object_key(inst);
+    nst->name = uclKey(inst);
 
     UclIterate(inst, objIt, obj, true)
     {
         const char *key = ucl_object_key(obj);
         if (!strcmp(key, "depends"))
-            processDeps(nst->properties, obj);
+            processDeps(arena, nst->properties, obj);
         else if (!strcmp(key, "dependents"))
-            processDeps(nst->properties, obj, true);
+            processDeps(arena, nst->properties, obj, true);
         else if (!strcmp(key, "methods"))
         {
             UclIterate(obj, depsIt, uclPage, true)
-                processPage(nst->properties, uclPage, "method");
+                processPage(arena, nst->properties, uclPage, "method");
             UclCloseIterate();
         }
         else
@@ -519,69 +1383,135 @@ void AddSys::processInst(std::list<Instance> &nsts, const ucl_object_t *inst)
     UclCloseIterate();
 }
 
-void AddSys::processPage(std::list<std::unique_ptr<Property>> &properties,
+void AddSys::processPage(Arena &arena, ArenaList<Property> &properties,
                          const ucl_object_t *obj, const char *type)
 {
-    PropPage *page = new PropPage;
+    Property *page = arena.make<Property>();
 
     assert(ucl_object_type(obj) == UCL_OBJECT);
 
-    page->key = ucl_object_key(obj);
+    page->kind = Property::kPage;
+    page->key = uclKey(obj);
 
-    if (!type)
-        page->properties.emplace_back(new PropString("type", type));
+    if (type)
+        page->properties.append(propStringNew(arena, StrView("type", 4),
+                                              StrView(type, strlen(type))));
 
     UclIterate(obj, propsIt, member, true)
-    {
-        if (ucl_object_type(member) == UCL_STRING)
-            page->properties.emplace_back(new PropString(
-                ucl_object_key(member), ucl_object_tostring(member)));
-        else
-            processPage(page->properties, member);
-    }
+        processProp(arena, page->properties, member);
     UclCloseIterate();
 
-    properties.emplace_back(std::move(page));
+    properties.append(page);
 }
 
-void AddSys::processProp(std::list<std::unique_ptr<Property>> &properties,
+void AddSys::processProp(Arena &arena, ArenaList<Property> &properties,
                          const ucl_object_t *obj)
 {
     if (ucl_object_type(obj) == UCL_STRING)
-        properties.emplace_back(
-            new PropString(ucl_object_key(obj), ucl_object_tostring(obj)));
+        properties.append(propStringNew(arena, uclKey(obj), uclString(obj)));
     else
-        processPage(properties, obj);
+        processPage(arena, properties, obj);
 }
 
-int AddSys::main(int argc, char *argv[])
+void AddSys::importAll()
 {
-    char c;
-    int res;
-    int layer = 0;
-    const char *pathDb = NULL;
+    int res = sqlite3_exec(conn, "BEGIN TRANSACTION;", NULL, NULL, NULL);
 
-    parser = ucl_parser_new(0);
-    ucl_parser_add_string(parser, kserviceBundleSchema_json, 0);
+    if (res != SQLITE_OK)
+        die("Failed to begin transaction: %s\n", sqlite3_errmsg(conn));
 
-    if (ucl_parser_get_error(parser))
+    for (auto &bundle : bundles)
     {
-        /* ought to not happen */
-        die("Internal error while parsing schema: %s\n",
-            ucl_parser_get_error(parser));
+        if (bundle.unchanged)
+        {
+            nUnchanged++;
+            continue;
+        }
+        else if (!bundle.valid)
+        {
+            /* why was logged when it was parsed */
+            nFailed++;
+            continue;
+        }
+
+        res = sqlite3_exec(conn, "SAVEPOINT bundle;", NULL, NULL, NULL);
+        if (res != SQLITE_OK)
+            die("Failed to create savepoint: %s\n", sqlite3_errmsg(conn));
+
+        if (import(&bundle) == 0)
+        {
+            res = sqlite3_exec(conn, "RELEASE bundle;", NULL, NULL, NULL);
+            if (res != SQLITE_OK)
+                die("Failed to release savepoint: %s\n",
+                    sqlite3_errmsg(conn));
+            continue;
+        }
+
+        /* some errors (e.g. SQLITE_FULL) abort the whole transaction; then
+         * there is nothing left to save */
+        if (sqlite3_get_autocommit(conn))
+            die("%s: failed to import, aborting the transaction\n",
+                bundle.path.c_str());
+
+        res = sqlite3_exec(conn, "ROLLBACK TO bundle; RELEASE bundle;", NULL,
+                           NULL, NULL);
+        if (res != SQLITE_OK)
+            die("Failed to roll back savepoint: %s\n", sqlite3_errmsg(conn));
+
+        /* the rollback may have undone rows whose IDs were cached */
+        strIDs.clear();
+        svcIDs.clear();
+        nstIDs.clear();
+        pageIDs.clear();
+
+        log(kErr, "%s: failed to import; rolled back\n", bundle.path.c_str());
+        nFailed++;
     }
 
-    schemaBundle = ucl_parser_get_object(parser);
-    ucl_parser_free(parser);
+    /* a dry run has only read, but ends its transaction all the same */
+    res = sqlite3_exec(conn, dryRun ? "ROLLBACK;" : "COMMIT;", NULL, NULL,
+                       NULL);
+    if (res != SQLITE_OK)
+        die("Failed to commit: %s\n", sqlite3_errmsg(conn));
+
+    nBundles += bundles.size();
+    /* frees every bundle's model at once */
+    bundles.clear();
+}
+
+int AddSys::main(int argc, char *argv[])
+{
+    char c;
+    int res;
+    const char *pathDb = NULL;
+    unsigned nThreads = std::thread::hardware_concurrency();
+    bool fromStdin = false;
+    size_t batchSize = 100;
 
     /*
      * -l {1,2,3,4}: layer into which to import
      * -r <path>: path to the repository database
-     * <path>: path of the service bundle
+     * -j <n>: number of threads on which to parse bundles
+     * -n: dry run; print the changes that would be made, but make none
+     * -b <n>: number of bundles read from stdin to import per transaction
+     * <path>...: paths of service bundles, or of directories of them; or -,
+     *  to read a stream of bundles from stdin (see streamRead())
      */
-    while ((c = getopt(argc, argv, "l:r:")) != -1)
+    while ((c = getopt(argc, argv, "b:j:l:nr:")) != -1)
         switch (c)
         {
+        case 'b':
+            if (atoi(optarg) < 1)
+                die("Invalid argument: %s is not a batch size\n", optarg);
+            batchSize = atoi(optarg);
+            break;
+
+        case 'j':
+            if (atoi(optarg) < 1)
+                die("Invalid argument: %s is not a thread count\n", optarg);
+            nThreads = atoi(optarg);
+            break;
+
         case 'l':
 #define CASE(i)                                                                \
     if (!strcmp(optarg, #i))                                                   \
@@ -593,6 +1523,10 @@ int AddSys::main(int argc, char *argv[])
             else die("Invalid argument: %s is not a layer", optarg);
             break;
 
+        case 'n':
+            dryRun = true;
+            break;
+
         case 'r':
             pathDb = optarg;
             break;
@@ -602,25 +1536,56 @@ int AddSys::main(int argc, char *argv[])
         die("Invalid argument: no layer specified\n");
     else if (!pathDb)
         die("Invalid argument: no repository path specified\n");
-    if (argc - optind != 1)
-        die("Invalid argument: only one service bundle path is allowed\n");
+    if (argc - optind < 1)
+        die("Invalid argument: no service bundle path specified\n");
+
+    for (int i = optind; i < argc; i++)
+        if (!strcmp(argv[i], "-"))
+            fromStdin = true;
+        else
+            addPath(argv[i]);
+
+    if (fromStdin && !bundles.empty())
+        die("Invalid argument: cannot read bundles from both stdin and "
+            "paths\n");
 
     res = sqlite3_open_v2(pathDb, &conn,
-                          SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
+                          (dryRun ? SQLITE_OPEN_READONLY
+                                  : SQLITE_OPEN_READWRITE) |
+                              SQLITE_OPEN_NOMUTEX,
+                          NULL);
     if (res != SQLITE_OK)
         die("Failed to open repository: %s\n", sqlite3_errmsg(conn));
 
-    parse(layer, argv[optind]);
+    knownBundlesLoad();
+    stmtsPrepare();
 
-    for (auto &klass : classes)
+    if (fromStdin)
+        /* so that a long stream is neither held in memory nor in one
+         * transaction, it is imported a batch at a time */
+        while (streamRead(stdin, batchSize))
+        {
+            parseAll(nThreads);
+            importAll();
+        }
+    else
     {
-        char fullPath[MAXPATHLEN];
-        realpath(argv[optind], fullPath);
-        import(layer, fullPath, &klass);
+        parseAll(nThreads);
+        importAll();
     }
 
+    stmtsFinalize();
     sqlite3_close_v2(conn);
 
+    if (nUnchanged)
+        log(kInfo, "%zu of %zu bundles unchanged since last imported\n",
+            nUnchanged, nBundles);
+    if (nFailed)
+    {
+        log(kErr, "%zu of %zu bundles failed to import\n", nFailed, nBundles);
+        return EXIT_FAILURE;
+    }
+
     return 0;
 }
 
@@ -0,0 +1,530 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+/**
+ * benchsys measures how the repository scales. It generates a set of
+ * synthetic service bundles, of a size given by its arguments, then times:
+ * - importing them all with addsys(8), one run per layer;
+ * - importing them all again, unchanged;
+ * - importing them again after a single property of one has changed;
+ * - querying the composed view of properties of every instance;
+ * - creating a snapshot of every instance;
+ * - spawning /bin/true with eciSpawn(), then with fork() and exec, from a
+ *   process grown by a ballast of a given size, as the manager grows.
+ *
+ * The results are written as JSON, for tracking regressions across builds.
+ * This is a benchmark, not a test: it checks nothing about the results save
+ * that each step succeeded.
+ */
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "eci/Core.h"
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+#include "eci/queryGetInstancePropertiesComposed.sql.h"
+#include "manager/Backend.hh"
+#include "sqlite3.h"
+#include "ucl.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class BenchSys : Logger
+{
+    /* Dimensions of the generated bundles. */
+    int nServices = 100;
+    int nInstances = 4;
+    int nProps = 8;
+    int pageDepth = 2;
+    int nLayers = 2;
+    /* MiB made resident before spawning, and how many times to spawn. */
+    int ballastMiB = 1024;
+    int nSpawns = 100;
+
+    const char *pathAddSys = "addsys";
+    std::string pathWork;
+    std::string pathDb;
+
+    struct Result
+    {
+        const char *name;
+        double secs;
+        /* Number of items (bundles, queries, snapshots) processed. */
+        long count;
+    };
+    std::vector<Result> results;
+
+    /* Run a step, recording how long it took. */
+    template <class F> void measure(const char *name, long count, F step)
+    {
+        double start = now();
+
+        step();
+        results.push_back({name, now() - start, count});
+        log(kInfo, "%s: %.3fs for %ld\n", name, results.back().secs, count);
+    }
+
+    std::string bundlePath(int layer, int svc);
+    /* Write out a page of properties, and beneath it pages to pageDepth. */
+    void genPage(FILE *out, int layer, int depth, const char *indent);
+    /**
+     * Write out the bundle of a service for a layer. If \p variant is
+     * nonzero, one property's value is made different.
+     */
+    void genBundle(int layer, int svc, int variant = 0);
+    void genAll();
+
+    /* Run addsys on the bundles of a layer. */
+    void import(int layer);
+    void importAll();
+
+    /* Query the composed view of every instance. */
+    void queryAll(const std::vector<int> &nstIDs);
+    void snapshotAll(const std::vector<int> &nstIDs);
+    std::vector<int> instanceIDs();
+
+    /* Wait for the child \p pid, and return its status. */
+    int reap(pid_t pid);
+    /* Spawn /bin/true nSpawns times each way, with the ballast resident. */
+    void spawnAll();
+
+    void emit(FILE *out);
+
+  public:
+    BenchSys() : Logger("benchsys"){};
+
+    int main(int argc, char *argv[]);
+};
+
+std::string BenchSys::bundlePath(int layer, int svc)
+{
+    return pathWork + "/layer" + std::to_string(layer) + "/svc" +
+           std::to_string(svc) + ".ucl";
+}
+
+void BenchSys::genPage(FILE *out, int layer, int depth, const char *indent)
+{
+    std::string inner = std::string(indent) + "    ";
+
+    for (int i = 0; i < nProps; i++)
+        fprintf(out, "%sprop%d = \"layer%d-value%d\";\n", indent, i, layer, i);
+
+    if (depth >= pageDepth)
+        return;
+
+    fprintf(out, "%spage%d {\n", indent, depth);
+    genPage(out, layer, depth + 1, inner.c_str());
+    fprintf(out, "%s};\n", indent);
+}
+
+void BenchSys::genBundle(int layer, int svc, int variant)
+{
+    std::string path = bundlePath(layer, svc);
+    FILE *out = fopen(path.c_str(), "w");
+
+    if (!out)
+        edie(errno, "Failed to create %s", path.c_str());
+
+    fprintf(out, "name bench$svc%d;\n\n", svc);
+    fprintf(out, "variant \"%d\";\n", variant);
+    genPage(out, layer, 0, "");
+
+    fprintf(out, "\nmethods start {\n    command = \"/bin/svc%d\";\n};\n",
+            svc);
+
+    fprintf(out, "\ninstances {\n");
+    for (int i = 0; i < nInstances; i++)
+    {
+        fprintf(out, "    i%d {\n", i);
+        if (svc > 0)
+            fprintf(out,
+                    "        depends { after [ \"bench$svc%d:i%d\" ]; };\n",
+                    svc - 1, i);
+        fprintf(out,
+                "        methods start {\n"
+                "            command = \"/bin/svc%d -i %d\";\n"
+                "        };\n",
+                svc, i);
+        fprintf(out, "    };\n");
+    }
+    fprintf(out, "};\n");
+
+    fclose(out);
+}
+
+void BenchSys::genAll()
+{
+    for (int layer = 1; layer <= nLayers; layer++)
+    {
+        std::string dir = pathWork + "/layer" + std::to_string(layer);
+
+        if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST)
+            edie(errno, "Failed to create %s", dir.c_str());
+
+        for (int svc = 0; svc < nServices; svc++)
+            genBundle(layer, svc);
+    }
+}
+
+void BenchSys::import(int layer)
+{
+    std::string layerArg = std::to_string(layer);
+    std::string dir = pathWork + "/layer" + layerArg;
+    pid_t pid;
+    int status;
+
+    if ((pid = fork()) == -1)
+        edie(errno, "Failed to fork");
+    else if (pid == 0)
+    {
+        /* addsys is chatty, and its chatter is not what is measured */
+        int null = open("/dev/null", O_WRONLY);
+
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execlp(pathAddSys, pathAddSys, "-l", layerArg.c_str(), "-r",
+               pathDb.c_str(), dir.c_str(), NULL);
+        _exit(127);
+    }
+
+    status = reap(pid);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        die("addsys failed importing layer %d (status %d)\n", layer, status);
+}
+
+void BenchSys::importAll()
+{
+    for (int layer = 1; layer <= nLayers; layer++)
+        import(layer);
+}
+
+std::vector<int> BenchSys::instanceIDs()
+{
+    sqlite3 *conn;
+    sqlite3_stmt *stmt;
+    std::vector<int> ids;
+
+    if (sqlite3_open_v2(pathDb.c_str(), &conn, SQLITE_OPEN_READONLY, NULL) !=
+            SQLITE_OK ||
+        sqlite3_prepare_v2(conn, "SELECT InstanceID FROM Instances;", -1,
+                           &stmt, NULL) != SQLITE_OK)
+        die("Failed to get instance IDs: %s\n", sqlite3_errmsg(conn));
+
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+        ids.push_back(sqlite3_column_int(stmt, 0));
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(conn);
+
+    return ids;
+}
+
+void BenchSys::queryAll(const std::vector<int> &nstIDs)
+{
+    sqlite3 *conn;
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_open_v2(pathDb.c_str(), &conn, SQLITE_OPEN_READONLY, NULL) !=
+            SQLITE_OK ||
+        sqlite3_prepare_v2(conn, kqueryGetInstancePropertiesComposed_sql, -1,
+                           &stmt, NULL) != SQLITE_OK)
+        die("Failed to prepare composed query: %s\n", sqlite3_errmsg(conn));
+
+    for (int id : nstIDs)
+    {
+        int res;
+
+        sqlite3_bind_int(
+            stmt, sqlite3_bind_parameter_index(stmt, ":instanceID"), id);
+        while ((res = sqlite3_step(stmt)) == SQLITE_ROW)
+            ;
+        sqlite3_reset(stmt);
+
+        if (res != SQLITE_DONE)
+            die("Failed to run composed query: %s\n", sqlite3_errmsg(conn));
+    }
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(conn);
+}
+
+/* Snapshots every instance, on the DB worker as sys.manager would. */
+class SnapshotAllJob : public DBJob
+{
+    const std::vector<int> &nstIDs;
+    bool &done;
+
+  public:
+    int res = 0;
+
+    SnapshotAllJob(const std::vector<int> &nstIDs, bool &done)
+        : nstIDs(nstIDs), done(done){};
+
+    void run(Backend *bend)
+    {
+        res = bend->persistentInstancesSnapshotCreate(
+            nstIDs.data(), nstIDs.size(), "bench", NULL);
+    }
+
+    void complete()
+    {
+        if (res < 0)
+            fprintf(stderr, "Failed to create snapshots: %s\n",
+                    strerror(-res));
+        done = true;
+    }
+};
+
+void BenchSys::snapshotAll(const std::vector<int> &nstIDs)
+{
+    EventLoop loop(this);
+    Backend bend(NULL, &loop);
+    bool done = false;
+
+    if (loop.init() < 0)
+        die("Failed to initialise event loop\n");
+
+    bend.init(pathDb.c_str(), NULL, false, false, false, 0);
+
+    measure("snapshot", nstIDs.size(), [&]() {
+        bend.submit(new SnapshotAllJob(nstIDs, done));
+        while (!done)
+            loop.loop(NULL);
+    });
+
+    bend.shutdown();
+}
+
+int BenchSys::reap(pid_t pid)
+{
+    int status;
+
+    while (waitpid(pid, &status, 0) == -1)
+        if (errno != EINTR)
+            edie(errno, "Failed to wait for child %d", (int)pid);
+
+    return status;
+}
+
+void BenchSys::spawnAll()
+{
+    char *const argv[] = {(char *)"/bin/true", NULL};
+    /* filled, so that it is resident and fork() must copy its page tables */
+    std::vector<char> ballast((size_t)ballastMiB << 20, 1);
+    ECISpawnAttr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.argv = argv;
+
+    measure("spawn", nSpawns, [&]() {
+        for (int i = 0; i < nSpawns; i++)
+        {
+            pid_t pid;
+            int r = eciSpawn(&attr, &pid);
+
+            if (r < 0)
+                edie(-r, "Failed to spawn %s", argv[0]);
+            reap(pid);
+        }
+    });
+
+    measure("fork-spawn", nSpawns, [&]() {
+        for (int i = 0; i < nSpawns; i++)
+        {
+            pid_t pid = fork();
+
+            if (pid == -1)
+                edie(errno, "Failed to fork");
+            else if (pid == 0)
+            {
+                execv(argv[0], argv);
+                _exit(127);
+            }
+            reap(pid);
+        }
+    });
+}
+
+void BenchSys::emit(FILE *out)
+{
+    ucl_object_t *top = ucl_object_typed_new(UCL_OBJECT);
+    ucl_object_t *params = ucl_object_typed_new(UCL_OBJECT);
+    ucl_object_t *arr = ucl_object_typed_new(UCL_ARRAY);
+    unsigned char *json;
+
+#define PARAM(name, val)                                                       \
+    ucl_object_insert_key(params, ucl_object_fromint(val), name, 0, false)
+    PARAM("services", nServices);
+    PARAM("instances", nInstances);
+    PARAM("properties", nProps);
+    PARAM("pageDepth", pageDepth);
+    PARAM("layers", nLayers);
+    PARAM("ballastMiB", ballastMiB);
+    PARAM("spawns", nSpawns);
+#undef PARAM
+
+    for (auto &result : results)
+    {
+        ucl_object_t *obj = ucl_object_typed_new(UCL_OBJECT);
+
+        ucl_object_insert_key(obj, ucl_object_fromstring(result.name), "name",
+                              0, false);
+        ucl_object_insert_key(obj, ucl_object_fromdouble(result.secs),
+                              "seconds", 0, false);
+        ucl_object_insert_key(obj, ucl_object_fromint(result.count), "count",
+                              0, false);
+        ucl_array_append(arr, obj);
+    }
+
+    ucl_object_insert_key(top, params, "parameters", 0, false);
+    ucl_object_insert_key(top, arr, "results", 0, false);
+
+    json = ucl_object_emit(top, UCL_EMIT_JSON);
+    fprintf(out, "%s\n", json);
+
+    free(json);
+    ucl_object_unref(top);
+}
+
+int BenchSys::main(int argc, char *argv[])
+{
+    char c;
+    char tmpl[] = "/tmp/benchsys.XXXXXX";
+    const char *pathOut = NULL;
+    FILE *out = stdout;
+    std::vector<int> nstIDs;
+    long nBundles;
+
+    /*
+     * -a <path>: path of addsys
+     * -d <n>: depth of nested property groups
+     * -i <n>: instances per service
+     * -l <n>: layers, 1 to 4, each with a bundle for every service
+     * -m <n>: MiB of ballast to make resident before spawning
+     * -o <path>: where to write the results; by default, stdout
+     * -p <n>: properties per property group
+     * -s <n>: services
+     * -w <path>: directory in which to generate bundles and the repository;
+     *  by default, a new temporary directory
+     */
+    while ((c = getopt(argc, argv, "a:d:i:l:m:o:p:s:w:")) != -1)
+        switch (c)
+        {
+        case 'a':
+            pathAddSys = optarg;
+            break;
+        case 'd':
+            pageDepth = atoi(optarg);
+            break;
+        case 'i':
+            nInstances = atoi(optarg);
+            break;
+        case 'l':
+            nLayers = atoi(optarg);
+            if (nLayers < 1 || nLayers > 4)
+                die("Invalid argument: %s is not a layer count\n", optarg);
+            break;
+        case 'm':
+            ballastMiB = atoi(optarg);
+            break;
+        case 'o':
+            pathOut = optarg;
+            break;
+        case 'p':
+            nProps = atoi(optarg);
+            break;
+        case 's':
+            nServices = atoi(optarg);
+            break;
+        case 'w':
+            pathWork = optarg;
+            break;
+        }
+
+    if (nServices < 1 || nInstances < 0 || nProps < 0 || pageDepth < 0 ||
+        ballastMiB < 0)
+        die("Invalid argument: negative or zero size\n");
+
+    if (pathWork.empty())
+    {
+        if (!mkdtemp(tmpl))
+            edie(errno, "Failed to create work directory");
+        pathWork = tmpl;
+    }
+    else if (mkdir(pathWork.c_str(), 0755) == -1 && errno != EEXIST)
+        edie(errno, "Failed to create %s", pathWork.c_str());
+
+    pathDb = pathWork + "/repository.db";
+    nBundles = (long)nServices * nLayers;
+
+    log(kInfo, "generating %ld bundles in %s\n", nBundles, pathWork.c_str());
+    genAll();
+
+    /* create the repository empty; sys.manager's backend knows how */
+    {
+        EventLoop loop(this);
+        Backend bend(NULL, &loop);
+
+        if (loop.init() < 0)
+            die("Failed to initialise event loop\n");
+        bend.init(pathDb.c_str(), NULL, false, true, false, 0);
+        bend.shutdown();
+    }
+
+    measure("import", nBundles, [&]() { importAll(); });
+    measure("reimport-unchanged", nBundles, [&]() { importAll(); });
+
+    genBundle(1, 0, 1);
+    measure("reimport-one-changed", nServices, [&]() { import(1); });
+
+    nstIDs = instanceIDs();
+    if (nstIDs.empty())
+        die("No instances were imported; see addsys's diagnostics\n");
+    measure("composed-query", nstIDs.size(), [&]() { queryAll(nstIDs); });
+    snapshotAll(nstIDs);
+    spawnAll();
+
+    if (pathOut && !(out = fopen(pathOut, "w")))
+        edie(errno, "Failed to open %s", pathOut);
+
+    emit(out);
+
+    if (out != stdout)
+        fclose(out);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchSys benchsys;
+    return benchsys.main(argc, argv);
+}
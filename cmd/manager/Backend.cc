@@ -18,10 +18,14 @@ included with this software
 #include <cassert>
 #include <cstdarg>
 #include <cstring>
+#include <string>
 #include <unistd.h>
+#include <unordered_map>
 
 #include "Backend.hh"
+#include "Graph.hh"
 #include "Manager.hh"
+#include "StateStore.hh"
 #include "eci/Core.h"
 #include "eci/SQLite.h"
 #include "eci/queryGetInstancePropertiesComposed.sql.h"
@@ -31,6 +35,150 @@ included with this software
 
 #define Str(s) #s
 
+/**
+ * Rows copied per transaction when a migration rebuilds a table. Small enough
+ * that other writers to the repository are not held up for long.
+ */
+static const int kMigrateBatchRows = 4096;
+
+/**
+ * Pages of the volatile repository copied to disk per DB worker job when
+ * leaving read-only mode, and the interval between jobs.
+ */
+static const int kVolatileBackupPages = 64;
+static const long kVolatileBackupIntervalNSecs = 1000000;
+
+/** The tables rebuilt to refer to names and keys by string ID. */
+static const MigrationCopy internCopies[] = {
+    {"Services",
+     "CREATE TABLE \"%s\" ("
+     "\"ServiceID\" INTEGER NOT NULL UNIQUE,"
+     "\"FK_Name_StringID\" INTEGER NOT NULL,"
+     "\"Type\" TEXT NOT NULL,"
+     "PRIMARY KEY(\"ServiceID\" AUTOINCREMENT),"
+     "FOREIGN KEY(\"FK_Name_StringID\") REFERENCES \"Strings\"(\"StringID\"));",
+     "ServiceID, FK_Name_StringID, Type",
+     "ServiceID, (SELECT StringID FROM Strings WHERE Value = Name), Type"},
+    {"PropertyGroups",
+     "CREATE TABLE \"%s\" ("
+     "\"PropertyGroupID\" INTEGER NOT NULL UNIQUE,"
+     "\"FK_Name_StringID\" INTEGER NOT NULL,"
+     "\"RefCount\" INTEGER NOT NULL DEFAULT 0,"
+     "\"FK_Parent_ServiceID\" INTEGER,"
+     "\"FK_Parent_PropertyGroupID\" INTEGER,"
+     "PRIMARY KEY(\"PropertyGroupID\" AUTOINCREMENT),"
+     "FOREIGN KEY(\"FK_Parent_PropertyGroupID\") "
+     "REFERENCES \"PropertyGroups\"(\"PropertyGroupID\"),"
+     "FOREIGN KEY(\"FK_Parent_ServiceID\") "
+     "REFERENCES \"Services\"(\"ServiceID\"),"
+     "FOREIGN KEY(\"FK_Name_StringID\") REFERENCES \"Strings\"(\"StringID\"));",
+     "PropertyGroupID, FK_Name_StringID, RefCount, FK_Parent_ServiceID, "
+     "FK_Parent_PropertyGroupID",
+     "PropertyGroupID, (SELECT StringID FROM Strings WHERE Value = Name), "
+     "RefCount, FK_Parent_ServiceID, FK_Parent_PropertyGroupID"},
+    {"PropertyValues",
+     "CREATE TABLE \"%s\" ("
+     "\"PropertyValueID\" INTEGER NOT NULL UNIQUE,"
+     "\"FK_BundleID\" INTEGER,"
+     "\"Type\" TEXT NOT NULL CHECK(\"Type\" = 'String' OR \"Type\" = 'Page'),"
+     "\"FK_Key_StringID\" INTEGER NOT NULL,"
+     "\"StringValue\" TEXT,"
+     "\"FK_PageValue_PropertyGroupID\" INTEGER,"
+     "PRIMARY KEY(\"PropertyValueID\" AUTOINCREMENT),"
+     "FOREIGN KEY(\"FK_PageValue_PropertyGroupID\") "
+     "REFERENCES \"PropertyGroups\"(\"PropertyGroupID\"),"
+     "FOREIGN KEY(\"FK_BundleID\") REFERENCES \"Bundles\"(\"BundleID\"),"
+     "FOREIGN KEY(\"FK_Key_StringID\") REFERENCES \"Strings\"(\"StringID\"));",
+     "PropertyValueID, FK_BundleID, Type, FK_Key_StringID, StringValue, "
+     "FK_PageValue_PropertyGroupID",
+     "PropertyValueID, FK_BundleID, Type, "
+     "(SELECT StringID FROM Strings WHERE Value = PropertyKey), StringValue, "
+     "FK_PageValue_PropertyGroupID"},
+    {NULL}};
+
+/**
+ * Upgrades to the persistent repository's schema. A newly-created repository
+ * is already at ECI_BACKEND_SCHEMA_VERSION and needs none of them.
+ */
+static const Migration persistentMigrations[] = {
+    {2, "index foreign keys and lookup columns", NULL, NULL,
+     "CREATE INDEX IF NOT EXISTS \"IdxInstances_Parent\" "
+     "ON \"Instances\" (\"FK_Parent_ServiceID\", \"Name\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxServices_Name\" "
+     "ON \"Services\" (\"Name\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxBundles_Filename\" "
+     "ON \"Bundles\" (\"Filename\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxSnapshotProperty_Snapshot\" "
+     "ON \"SnapshotProperty\" (\"FK_SnapshotID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxProperties_Instance\" "
+     "ON \"Properties\" (\"FK_Parent_InstanceID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxProperties_Service\" "
+     "ON \"Properties\" (\"FK_Parent_ServiceID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxProperties_PropertyGroup\" "
+     "ON \"Properties\" (\"FK_Parent_PropertyGroupID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxProperties_PropertyValue\" "
+     "ON \"Properties\" (\"FK_PropertyValueID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxPropertyValues_Bundle\" "
+     "ON \"PropertyValues\" (\"FK_BundleID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxPropertyGroups_Service\" "
+     "ON \"PropertyGroups\" (\"FK_Parent_ServiceID\", \"Name\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxPropertyGroups_PropertyGroup\" "
+     "ON \"PropertyGroups\" (\"FK_Parent_PropertyGroupID\", \"Name\");"},
+    {3, "intern service names, property group names, and property keys",
+     internCopies,
+     "CREATE TABLE IF NOT EXISTS \"Strings\" ("
+     "\"StringID\" INTEGER NOT NULL UNIQUE,"
+     "\"Value\" TEXT NOT NULL UNIQUE,"
+     "PRIMARY KEY(\"StringID\" AUTOINCREMENT));"
+     "INSERT OR IGNORE INTO Strings(Value) "
+     "SELECT Name FROM Services UNION SELECT Name FROM PropertyGroups "
+     "UNION SELECT PropertyKey FROM PropertyValues;"
+     /* and intern those written while the copies are under way */
+     "CREATE TRIGGER \"Services_intern_ins\" BEFORE INSERT ON \"Services\" "
+     "BEGIN INSERT OR IGNORE INTO Strings(Value) VALUES (NEW.Name); END;"
+     "CREATE TRIGGER \"Services_intern_upd\" "
+     "BEFORE UPDATE OF Name ON \"Services\" "
+     "BEGIN INSERT OR IGNORE INTO Strings(Value) VALUES (NEW.Name); END;"
+     "CREATE TRIGGER \"PropertyGroups_intern_ins\" "
+     "BEFORE INSERT ON \"PropertyGroups\" "
+     "BEGIN INSERT OR IGNORE INTO Strings(Value) VALUES (NEW.Name); END;"
+     "CREATE TRIGGER \"PropertyGroups_intern_upd\" "
+     "BEFORE UPDATE OF Name ON \"PropertyGroups\" "
+     "BEGIN INSERT OR IGNORE INTO Strings(Value) VALUES (NEW.Name); END;"
+     "CREATE TRIGGER \"PropertyValues_intern_ins\" "
+     "BEFORE INSERT ON \"PropertyValues\" "
+     "BEGIN INSERT OR IGNORE INTO Strings(Value) "
+     "VALUES (NEW.PropertyKey); END;"
+     "CREATE TRIGGER \"PropertyValues_intern_upd\" "
+     "BEFORE UPDATE OF PropertyKey ON \"PropertyValues\" "
+     "BEGIN INSERT OR IGNORE INTO Strings(Value) "
+     "VALUES (NEW.PropertyKey); END;",
+     "CREATE INDEX IF NOT EXISTS \"IdxServices_Name\" "
+     "ON \"Services\" (\"FK_Name_StringID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxPropertyValues_Bundle\" "
+     "ON \"PropertyValues\" (\"FK_BundleID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxPropertyGroups_Service\" "
+     "ON \"PropertyGroups\" (\"FK_Parent_ServiceID\", \"FK_Name_StringID\");"
+     "CREATE INDEX IF NOT EXISTS \"IdxPropertyGroups_PropertyGroup\" "
+     "ON \"PropertyGroups\" "
+     "(\"FK_Parent_PropertyGroupID\", \"FK_Name_StringID\");"},
+    {0}};
+
+/** Upgrades to the volatile repository's schema. */
+static const Migration volatileMigrations[] = {
+    {2, "record live instances' state", NULL, NULL,
+     "ALTER TABLE LiveInstances "
+     "ADD COLUMN \"State\" TEXT NOT NULL DEFAULT 'offline';"
+     "ALTER TABLE LiveInstances "
+     "ADD COLUMN \"MainPID\" INTEGER NOT NULL DEFAULT 0;"
+     "ALTER TABLE LiveInstances "
+     "ADD COLUMN \"StateSince\" INTEGER NOT NULL DEFAULT 0;"
+     "ALTER TABLE LiveInstances "
+     "ADD COLUMN \"Generation\" INTEGER NOT NULL DEFAULT 0;"
+     "CREATE UNIQUE INDEX IF NOT EXISTS \"IdxLiveInstances_Name\" "
+     "ON \"LiveInstances\" (\"Name\");"},
+    {0}};
+
 static int eciVASPrintF(char **out, const char *fmt, va_list args)
 {
     va_list args2;
@@ -50,18 +198,86 @@ static int eciVASPrintF(char **out, const char *fmt, va_list args)
     return vsprintf(*out, fmt, args);
 }
 
-Backend::Backend(Manager *mgr) : mgr(mgr), Logger("db-backend", mgr)
+/* Bind an int to the named parameter of a prepared statement. */
+static int bindInt(sqlite3_stmt *stmt, const char *param, int value)
+{
+    return sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, param),
+                            value);
+}
+
+/* Bind an int64 to the named parameter of a prepared statement. */
+static int bindInt64(sqlite3_stmt *stmt, const char *param, sqlite3_int64 value)
+{
+    return sqlite3_bind_int64(stmt, sqlite3_bind_parameter_index(stmt, param),
+                              value);
+}
+
+/* Bind a string, which must outlive the binding, to the named parameter. */
+static int bindText(sqlite3_stmt *stmt, const char *param, const char *value)
+{
+    return sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, param),
+                             value, -1, SQLITE_STATIC);
+}
+
+/* Run a prepared statement which returns no rows, then reset it. */
+static int stepReset(sqlite3_stmt *stmt)
+{
+    int res = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    return res == SQLITE_DONE ? SQLITE_OK : res;
+}
+
+/** Leaves read-only mode, then schedules writing out the volatile repo. */
+class Backend::ReadWriteJob : public DBJob
+{
+    Backend *bend;
+    int res;
+    /** Whether the volatile repository has begun to be written out. */
+    bool persisting;
+
+  public:
+    void run(Backend *aBend)
+    {
+        bend = aBend;
+        res = bend->setReadWrite();
+        persisting = bend->volatileBackup != NULL;
+    }
+
+    void complete();
+};
+
+/** Carries out a step of writing out the volatile repository. */
+class Backend::VolatilePersistStepJob : public DBJob
+{
+    Backend *bend;
+    bool more;
+
+  public:
+    void run(Backend *aBend)
+    {
+        bend = aBend;
+        more = bend->volatilePersistStep();
+    }
+
+    void complete()
+    {
+        if (more)
+            bend->volatilePersistSchedule();
+    }
+};
+
+Backend::Backend(Manager *mgr, EventLoop *loop)
+    : Logger("db-backend", mgr), mgr(mgr), loop(loop),
+      worker(this, this, loop), periodicBackup(this)
 {
     log(kInfo, "repository server backed by SQLite version %s\n",
         sqlite3_version);
 }
 
-int Backend::metadataInit(sqlite3 *conn)
+int Backend::metadataInit(sqlite3 *conn, int version)
 {
-    return sqlite3_exec(conn,
-                        "INSERT INTO \"METADATA\""
-                        "VALUES (" MStr(ECI_BACKEND_SCHEMA_VERSION) ");",
-                        NULL, NULL, NULL);
+    return sqlite3_execf(conn, NULL, NULL, NULL,
+                         "INSERT INTO \"METADATA\" VALUES (%d);", version);
 }
 
 int Backend::metadataValidate(sqlite3 *conn)
@@ -79,8 +295,377 @@ int Backend::metadataValidate(sqlite3 *conn)
     return ver;
 }
 
-int Backend::metadataSetVersion(sqlite3 *conn)
+int Backend::metadataSetVersion(sqlite3 *conn, int version)
+{
+    int res = sqlite3_execf(conn, NULL, NULL, NULL,
+                            "UPDATE Metadata SET Version = %d;", version);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to set version in the metadata table: %s\n",
+            sqlite3_errmsg(conn));
+        return -1;
+    }
+    return 0;
+}
+
+int Backend::migrate(sqlite3 *conn, const Migration *migrations, int toVersion)
+{
+    int ver = metadataValidate(conn);
+
+    if (ver == -1)
+        return -1;
+    else if (ver > toVersion)
+    {
+        log(kErr, "Repository schema version %d is newer than ours (%d).\n",
+            ver, toVersion);
+        return -1;
+    }
+
+    for (const Migration *mig = migrations; mig->toVersion; mig++)
+    {
+        int res;
+
+        if (mig->toVersion <= ver)
+            continue;
+        else if (mig->toVersion != ver + 1)
+            break;
+
+        log(kInfo, "migrating repository from schema version %d to %d: %s\n",
+            ver, mig->toVersion, mig->desc);
+
+        if (mig->copies)
+            res = migrationCopySwap(conn, mig);
+        else
+            res = migrationApply(conn, mig);
+
+        if (res == -1)
+            return -1;
+
+        ver = mig->toVersion;
+    }
+
+    if (ver != toVersion)
+    {
+        log(kErr, "No migration from schema version %d to %d.\n", ver,
+            toVersion);
+        return -1;
+    }
+
+    return 0;
+}
+
+int Backend::migrationApply(sqlite3 *conn, const Migration *mig)
+{
+    int res = sqlite3_exec(conn, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to begin migration: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    if (mig->sql && sqlite3_exec(conn, mig->sql, NULL, NULL, NULL) != SQLITE_OK)
+    {
+        log(kErr, "Migration to schema version %d failed: %s\n",
+            mig->toVersion, sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    if (metadataSetVersion(conn, mig->toVersion) == -1)
+        goto rollback;
+
+    res = sqlite3_exec(conn, "COMMIT;", NULL, NULL, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to commit migration: %s\n", sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    return 0;
+
+rollback:
+    sqlite3_exec(conn, "ROLLBACK;", NULL, NULL, NULL);
+    return -1;
+}
+
+int Backend::migrationCopyBegin(sqlite3 *conn, const Migration *mig)
+{
+    int nCopying = 0;
+    int res = sqlite3_exec(conn, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to begin migration: %s\n", sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    res = sqlite3_exec(conn,
+                       "CREATE TABLE IF NOT EXISTS \"MigrationProgress\" ("
+                       "\"TableName\" TEXT NOT NULL UNIQUE,"
+                       "\"CopiedRowID\" INTEGER NOT NULL,"
+                       "\"MaxRowID\" INTEGER NOT NULL);",
+                       NULL, NULL, NULL);
+    if (res == SQLITE_OK)
+        res = sqlite3_get_single_int(conn, &nCopying,
+                                     "SELECT COUNT(*) FROM MigrationProgress;");
+    if (res != SQLITE_ROW)
+    {
+        log(kErr, "Failed to read migration progress: %s\n",
+            sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    if (nCopying)
+    {
+        /* an earlier attempt set them up already */
+        log(kInfo, "resuming interrupted migration\n");
+        sqlite3_exec(conn, "ROLLBACK;", NULL, NULL, NULL);
+        return 0;
+    }
+
+    if (mig->copyPrepare &&
+        sqlite3_exec(conn, mig->copyPrepare, NULL, NULL, NULL) != SQLITE_OK)
+    {
+        log(kErr, "Failed to prepare migration: %s\n", sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    for (const MigrationCopy *copy = mig->copies; copy->table; copy++)
+    {
+        std::string shadow = std::string(copy->table) + "_migrate";
+        const char *table = copy->table;
+        const char *select = copy->select ? copy->select : copy->columns;
+
+        res = sqlite3_execf(conn, NULL, NULL, NULL, copy->ddl, shadow.c_str());
+        if (res == SQLITE_OK)
+            res = sqlite3_execf(
+                conn, NULL, NULL, NULL,
+                "CREATE TRIGGER \"%s_ins\" AFTER INSERT ON \"%s\" "
+                "BEGIN INSERT OR REPLACE INTO \"%s\"(rowid, %s) "
+                "SELECT rowid, %s FROM \"%s\" WHERE rowid = NEW.rowid; END;"
+                "CREATE TRIGGER \"%s_upd\" AFTER UPDATE ON \"%s\" "
+                "BEGIN DELETE FROM \"%s\" WHERE rowid = OLD.rowid; "
+                "INSERT OR REPLACE INTO \"%s\"(rowid, %s) "
+                "SELECT rowid, %s FROM \"%s\" WHERE rowid = NEW.rowid; END;"
+                "CREATE TRIGGER \"%s_del\" AFTER DELETE ON \"%s\" "
+                "BEGIN DELETE FROM \"%s\" WHERE rowid = OLD.rowid; END;"
+                "INSERT INTO MigrationProgress "
+                "SELECT '%s', 0, IFNULL(MAX(rowid), 0) FROM \"%s\";",
+                shadow.c_str(), table, shadow.c_str(), copy->columns, select,
+                table, shadow.c_str(), table, shadow.c_str(), shadow.c_str(),
+                copy->columns, select, table, shadow.c_str(), table,
+                shadow.c_str(), table, table);
+        if (res != SQLITE_OK)
+        {
+            log(kErr, "Failed to prepare copy of table %s: %s\n", table,
+                sqlite3_errmsg(conn));
+            goto rollback;
+        }
+    }
+
+    res = sqlite3_exec(conn, "COMMIT;", NULL, NULL, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to commit: %s\n", sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    return 0;
+
+rollback:
+    sqlite3_exec(conn, "ROLLBACK;", NULL, NULL, NULL);
+    return -1;
+}
+
+int Backend::migrationCopyRows(sqlite3 *conn, const MigrationCopy *copy)
+{
+    std::string shadow = std::string(copy->table) + "_migrate";
+    const char *select = copy->select ? copy->select : copy->columns;
+    sqlite3_stmt *stmtCopy = NULL;
+    sqlite3_stmt *stmtProgress = NULL;
+    int copiedRowID, maxRowID;
+    int res;
+
+    res = sqlite3_get_two_intf(conn, &copiedRowID, &maxRowID,
+                               "SELECT CopiedRowID, MaxRowID "
+                               "FROM MigrationProgress "
+                               "WHERE TableName = '%s';",
+                               copy->table);
+    if (res != SQLITE_ROW)
+    {
+        log(kErr, "Failed to read progress of copy of table %s: %s\n",
+            copy->table, sqlite3_errmsg(conn));
+        return -1;
+    }
+    else if (copiedRowID)
+        log(kInfo, "resuming copy of table %s after row %d of %d\n",
+            copy->table, copiedRowID, maxRowID);
+
+    /*
+     * Rows the triggers have already copied are newer than ours, so they are
+     * left alone.
+     */
+    res = sqlite3_prepare_v2f(conn, &stmtCopy, NULL,
+                              "INSERT OR IGNORE INTO \"%s\"(rowid, %s) "
+                              "SELECT rowid, %s FROM \"%s\" "
+                              "WHERE rowid > :lo AND rowid <= :hi;",
+                              shadow.c_str(), copy->columns, select,
+                              copy->table);
+    if (res == SQLITE_OK)
+        res = sqlite3_prepare_v2f(conn, &stmtProgress, NULL,
+                                  "UPDATE MigrationProgress "
+                                  "SET CopiedRowID = :hi "
+                                  "WHERE TableName = '%s';",
+                                  copy->table);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to prepare copy of table %s: %s\n", copy->table,
+            sqlite3_errmsg(conn));
+        goto fail;
+    }
+
+    for (int lo = copiedRowID; lo < maxRowID; lo += kMigrateBatchRows)
+    {
+        res = sqlite3_exec(conn, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+        if (res != SQLITE_OK)
+        {
+            log(kErr, "Failed to begin copy batch: %s\n",
+                sqlite3_errmsg(conn));
+            goto fail;
+        }
+
+        bindInt(stmtCopy, ":lo", lo);
+        bindInt(stmtCopy, ":hi", lo + kMigrateBatchRows);
+        bindInt(stmtProgress, ":hi", lo + kMigrateBatchRows);
+
+        if (stepReset(stmtCopy) != SQLITE_OK ||
+            stepReset(stmtProgress) != SQLITE_OK ||
+            sqlite3_exec(conn, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK)
+        {
+            log(kErr, "Failed to copy rows of table %s: %s\n", copy->table,
+                sqlite3_errmsg(conn));
+            sqlite3_exec(conn, "ROLLBACK;", NULL, NULL, NULL);
+            goto fail;
+        }
+    }
+
+    sqlite3_finalize(stmtCopy);
+    sqlite3_finalize(stmtProgress);
+    return 0;
+
+fail:
+    sqlite3_finalize(stmtCopy);
+    sqlite3_finalize(stmtProgress);
+    return -1;
+}
+
+int Backend::migrationCopySwap(sqlite3 *conn, const Migration *mig)
 {
+    int foreignKeys = 0;
+    int nViolations = 0;
+    int r = -1;
+    int res;
+
+    /**
+     * Step 1: Create the shadow tables, the triggers which reflect into them
+     * any writes made to the old tables while we are copying, and the record
+     * of how far each copy has got.
+     */
+    if (migrationCopyBegin(conn, mig) == -1)
+        return -1;
+
+    /**
+     * Step 2: Copy the existing rows across in batches, from where an earlier
+     * attempt left off.
+     */
+    for (const MigrationCopy *copy = mig->copies; copy->table; copy++)
+        if (migrationCopyRows(conn, copy) == -1)
+            return -1;
+
+    /**
+     * Step 3: Swap the shadow tables in for the old ones, and do whatever else
+     * the migration requires. Foreign key enforcement is turned off for this,
+     * as otherwise dropping a table others refer to would delete from them;
+     * it can't be turned off within a transaction, so is turned off around
+     * it, and if it was on, the foreign keys are checked before committing.
+     */
+    res = sqlite3_get_single_int(conn, &foreignKeys, "PRAGMA foreign_keys;");
+    if (res != SQLITE_ROW ||
+        sqlite3_exec(conn, "PRAGMA foreign_keys = OFF;", NULL, NULL, NULL) !=
+            SQLITE_OK)
+    {
+        log(kErr, "Failed to disable foreign keys: %s\n",
+            sqlite3_errmsg(conn));
+        return -1;
+    }
+
+    res = sqlite3_exec(conn, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to begin swap: %s\n", sqlite3_errmsg(conn));
+        goto out;
+    }
+
+    /* the old tables' triggers go with them */
+    for (const MigrationCopy *copy = mig->copies; copy->table; copy++)
+    {
+        res = sqlite3_execf(conn, NULL, NULL, NULL,
+                            "DROP TABLE \"%s\";"
+                            "ALTER TABLE \"%s_migrate\" RENAME TO \"%s\";",
+                            copy->table, copy->table, copy->table);
+        if (res != SQLITE_OK)
+        {
+            log(kErr, "Failed to swap in rebuilt table %s: %s\n", copy->table,
+                sqlite3_errmsg(conn));
+            goto rollback;
+        }
+    }
+
+    if (mig->sql && sqlite3_exec(conn, mig->sql, NULL, NULL, NULL) != SQLITE_OK)
+    {
+        log(kErr, "Migration to schema version %d failed: %s\n",
+            mig->toVersion, sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    if (sqlite3_exec(conn, "DROP TABLE MigrationProgress;", NULL, NULL,
+                     NULL) != SQLITE_OK)
+    {
+        log(kErr, "Failed to drop migration progress: %s\n",
+            sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    if (foreignKeys &&
+        (sqlite3_get_single_int(conn, &nViolations,
+                                "SELECT COUNT(*) "
+                                "FROM pragma_foreign_key_check;") !=
+             SQLITE_ROW ||
+         nViolations))
+    {
+        log(kErr, "Migration to schema version %d broke foreign keys: %s\n",
+            mig->toVersion,
+            nViolations ? "constraint failed" : sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    if (metadataSetVersion(conn, mig->toVersion) == -1)
+        goto rollback;
+
+    res = sqlite3_exec(conn, "COMMIT;", NULL, NULL, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to commit migration: %s\n", sqlite3_errmsg(conn));
+        goto rollback;
+    }
+
+    r = 0;
+    goto out;
+
+rollback:
+    sqlite3_exec(conn, "ROLLBACK;", NULL, NULL, NULL);
+out:
+    if (foreignKeys)
+        sqlite3_exec(conn, "PRAGMA foreign_keys = ON;", NULL, NULL, NULL);
+    return r;
 }
 
 int Backend::persistentInstanceLookup(InstanceName &name)
@@ -90,8 +675,9 @@ int Backend::persistentInstanceLookup(InstanceName &name)
     int res;
 
     res = sqlite3_get_single_intf(connPersistent, &svcId,
-                                  "SELECT ServiceID FROM Services"
-                                  "WHERE Type = '%s' AND Name = '%s';",
+                                  "SELECT ServiceID FROM Services "
+                                  "JOIN Strings ON StringID = FK_Name_StringID "
+                                  "WHERE Type = '%s' AND Value = '%s';",
                                   name.type.c_str(), name.svc.c_str());
     if (res != SQLITE_ROW)
     {
@@ -101,8 +687,8 @@ int Backend::persistentInstanceLookup(InstanceName &name)
     }
 
     res = sqlite3_get_single_intf(connPersistent, &instId,
-                                  "SELECT InstanceID FROM Instances"
-                                  "WHERE FK_Parent_ServiceID = %d"
+                                  "SELECT InstanceID FROM Instances "
+                                  "WHERE FK_Parent_ServiceID = %d "
                                   "AND Name = '%s';",
                                   svcId, name.nst.c_str());
     if (res != SQLITE_ROW)
@@ -115,35 +701,436 @@ int Backend::persistentInstanceLookup(InstanceName &name)
     return instId;
 }
 
+void Backend::persistentStatementsPrepare()
+{
+    std::string composed(kqueryGetInstancePropertiesComposed_sql);
+    std::string copy;
+
+    /* the composed query is embedded as a common table expression */
+    composed.erase(composed.find_last_of(';'));
+    copy = "INSERT INTO SnapshotProperty(FK_SnapshotID, FK_PropertyID) "
+           "WITH RECURSIVE "
+           "Composed(PropertyID) AS (" +
+           composed +
+           "), "
+           "Tree(PropertyID) AS ("
+           "  SELECT PropertyID FROM Composed"
+           "  UNION"
+           "  SELECT Child.PropertyID FROM Tree"
+           "  JOIN Properties Prop ON Prop.PropertyID = Tree.PropertyID"
+           "  JOIN PropertyValues Val"
+           "    ON Val.PropertyValueID = Prop.FK_PropertyValueID"
+           "  JOIN Properties Child"
+           "    ON Child.FK_Parent_PropertyGroupID ="
+           "      Val.FK_PageValue_PropertyGroupID"
+           "  WHERE Val.Type = 'Page') "
+           "SELECT :snapshotID, PropertyID FROM Tree;";
+
+    struct
+    {
+        sqlite3_stmt **stmt;
+        const char *sql;
+    } stmts[] = {
+        {&permNstCurProps, kqueryGetInstancePropertiesComposed_sql},
+        {&permSnapLookup, "SELECT SnapshotID FROM Snapshots "
+                          "WHERE FK_Parent_InstanceID = :instanceID "
+                          "AND Name = :name;"},
+        {&permSnapRefBundles,
+         "UPDATE Bundles SET RefCount = RefCount + :delta "
+         "WHERE BundleID IN ("
+         "  SELECT Val.FK_BundleID FROM SnapshotProperty Snap"
+         "  JOIN Properties Prop ON Prop.PropertyID = Snap.FK_PropertyID"
+         "  JOIN PropertyValues Val"
+         "    ON Val.PropertyValueID = Prop.FK_PropertyValueID"
+         "  WHERE Snap.FK_SnapshotID = :snapshotID);"},
+        {&permSnapDelProps, "DELETE FROM SnapshotProperty "
+                            "WHERE FK_SnapshotID = :snapshotID;"},
+        {&permSnapDel, "DELETE FROM Snapshots WHERE SnapshotID = :snapshotID;"},
+        {&permSnapNew, "INSERT INTO Snapshots(Name, FK_Parent_InstanceID) "
+                       "SELECT :name, InstanceID FROM Instances "
+                       "WHERE InstanceID = :instanceID;"},
+        {&permSnapCopy, copy.c_str()},
+        {&permDepsNsts,
+         "SELECT Nst.InstanceID, Nst.FK_Parent_ServiceID, Svc.Type, "
+         "SvcName.Value, Nst.Name FROM Instances Nst "
+         "JOIN Services Svc ON Svc.ServiceID = Nst.FK_Parent_ServiceID "
+         "JOIN Strings SvcName ON SvcName.StringID = Svc.FK_Name_StringID "
+         "WHERE :instanceID = 0 OR Nst.InstanceID = :instanceID;"},
+        {&permDeps,
+         "SELECT DISTINCT Prop.FK_Parent_ServiceID, Prop.FK_Parent_InstanceID, "
+         "DepKey.Value, Target.StringValue, DepType.StringValue "
+         "FROM Properties Prop "
+         "JOIN PropertyValues Val"
+         "  ON Val.PropertyValueID = Prop.FK_PropertyValueID "
+         "JOIN Strings DepKey ON DepKey.StringID = Val.FK_Key_StringID "
+         "JOIN Properties TargetProp"
+         "  ON TargetProp.FK_Parent_PropertyGroupID ="
+         "    Val.FK_PageValue_PropertyGroupID "
+         "JOIN PropertyValues Target"
+         "  ON Target.PropertyValueID = TargetProp.FK_PropertyValueID "
+         "JOIN Properties TypeProp"
+         "  ON TypeProp.FK_Parent_PropertyGroupID ="
+         "    Val.FK_PageValue_PropertyGroupID "
+         "JOIN PropertyValues DepType"
+         "  ON DepType.PropertyValueID = TypeProp.FK_PropertyValueID "
+         "WHERE Val.Type = 'Page' AND DepKey.Value GLOB 'dependency_*' "
+         "AND Target.FK_Key_StringID ="
+         "  (SELECT StringID FROM Strings WHERE Value = 'instance') "
+         "AND DepType.FK_Key_StringID ="
+         "  (SELECT StringID FROM Strings WHERE Value = 'type') "
+         "AND (:instanceID = 0 OR Prop.FK_Parent_InstanceID = :instanceID "
+         "  OR Prop.FK_Parent_ServiceID = (SELECT FK_Parent_ServiceID"
+         "    FROM Instances WHERE InstanceID = :instanceID));"},
+        {&permPropString,
+         "SELECT PropKey.Value, Val.StringValue FROM Properties Prop "
+         "JOIN PropertyValues Val"
+         "  ON Val.PropertyValueID = Prop.FK_PropertyValueID "
+         "JOIN Strings PropKey ON PropKey.StringID = Val.FK_Key_StringID "
+         "WHERE Prop.PropertyID = :propertyID AND Val.Type = 'String';"},
+    };
+
+    for (auto &stmt : stmts)
+        if (sqlite3_prepare_v2(connPersistent, stmt.sql, -1, stmt.stmt,
+                               NULL) != SQLITE_OK)
+            die("Failed to ready prepared statements: %s\n",
+                sqlite3_errmsg(connPersistent));
+}
+
+void Backend::persistentStatementsFinalize()
+{
+    sqlite3_stmt **stmts[] = {&permNstCurProps,    &permSnapLookup,
+                              &permSnapRefBundles, &permSnapDelProps,
+                              &permSnapDel,        &permSnapNew,
+                              &permSnapCopy,       &permDepsNsts,
+                              &permDeps,           &permPropString};
+
+    for (auto stmt : stmts)
+    {
+        sqlite3_finalize(*stmt);
+        *stmt = NULL;
+    }
+}
+
+void Backend::volatileStatementsPrepare()
+{
+    struct
+    {
+        sqlite3_stmt **stmt;
+        const char *sql;
+    } stmts[] = {
+        {&volLiveUpdate,
+         "UPDATE LiveInstances SET State = :state, MainPID = :mainPID, "
+         "StateSince = :since, Generation = :generation WHERE Name = :name;"},
+        {&volLiveInsert,
+         "INSERT INTO LiveInstances(Name, PersistentFK_Parent_InstanceID, "
+         "State, MainPID, StateSince, Generation) "
+         "VALUES (:name, :instanceID, :state, :mainPID, :since, "
+         ":generation);"},
+    };
+
+    for (auto &stmt : stmts)
+        if (sqlite3_prepare_v2(connVolatile, stmt.sql, -1, stmt.stmt,
+                               NULL) != SQLITE_OK)
+            die("Failed to ready prepared statements: %s\n",
+                sqlite3_errmsg(connVolatile));
+}
+
+void Backend::volatileStatementsFinalize()
+{
+    sqlite3_stmt **stmts[] = {&volLiveUpdate, &volLiveInsert};
+
+    for (auto stmt : stmts)
+    {
+        sqlite3_finalize(*stmt);
+        *stmt = NULL;
+    }
+}
+
+int Backend::snapshotCreate(int instanceID, const char *name)
+{
+    int res;
+    int oldSnapID;
+    int snapID;
+
+    /**
+     * Step 1: If the instance already has a snapshot of this name, release
+     * its references to its bundles, and delete it.
+     */
+    bindInt(permSnapLookup, ":instanceID", instanceID);
+    sqlite3_bind_text(permSnapLookup,
+                      sqlite3_bind_parameter_index(permSnapLookup, ":name"),
+                      name, -1, SQLITE_STATIC);
+
+    res = sqlite3_step(permSnapLookup);
+    oldSnapID = res == SQLITE_ROW ? sqlite3_column_int(permSnapLookup, 0) : 0;
+    sqlite3_reset(permSnapLookup);
+    sqlite3_clear_bindings(permSnapLookup);
+
+    if (oldSnapID)
+    {
+        bindInt(permSnapRefBundles, ":delta", -1);
+        bindInt(permSnapRefBundles, ":snapshotID", oldSnapID);
+        bindInt(permSnapDelProps, ":snapshotID", oldSnapID);
+        bindInt(permSnapDel, ":snapshotID", oldSnapID);
+
+        if ((res = stepReset(permSnapRefBundles)) == SQLITE_OK &&
+            (res = stepReset(permSnapDelProps)) == SQLITE_OK &&
+            (res = stepReset(permSnapDel)) == SQLITE_OK)
+            res = SQLITE_DONE;
+    }
+
+    if (res != SQLITE_DONE)
+    {
+        log(kErr, "Failed to delete old snapshot %s of instance %d: %s\n",
+            name, instanceID, sqlite3_errmsg(connPersistent));
+        return -EIO;
+    }
+
+    /**
+     * Step 2: Add the Snapshots entry. No row is added if the instance does
+     * not exist.
+     */
+    bindInt(permSnapNew, ":instanceID", instanceID);
+    sqlite3_bind_text(permSnapNew,
+                      sqlite3_bind_parameter_index(permSnapNew, ":name"),
+                      name, -1, SQLITE_STATIC);
+    res = stepReset(permSnapNew);
+    sqlite3_clear_bindings(permSnapNew);
+
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to add snapshot %s of instance %d: %s\n", name,
+            instanceID, sqlite3_errmsg(connPersistent));
+        return -EIO;
+    }
+    else if (!sqlite3_changes(connPersistent))
+        return -ENOENT;
+
+    snapID = sqlite3_last_insert_rowid(connPersistent);
+
+    /**
+     * Step 3: Copy the composed view into it, and take a reference on every
+     * bundle it now refers to.
+     */
+    bindInt(permSnapCopy, ":instanceID", instanceID);
+    bindInt(permSnapCopy, ":snapshotID", snapID);
+    bindInt(permSnapRefBundles, ":delta", 1);
+    bindInt(permSnapRefBundles, ":snapshotID", snapID);
+
+    if ((res = stepReset(permSnapCopy)) != SQLITE_OK ||
+        (res = stepReset(permSnapRefBundles)) != SQLITE_OK)
+    {
+        log(kErr, "Failed to copy properties into snapshot %s of instance %d: "
+            "%s\n",
+            name, instanceID, sqlite3_errmsg(connPersistent));
+        return -EIO;
+    }
+
+    return snapID;
+}
+
 int Backend::persistentInstanceSnapshotCreate(int instanceID, const char *name)
 {
-    int res = sqlite3_bind_int(permNstCurProps, 1, instanceID);
+    int snapID;
+    int res = persistentInstancesSnapshotCreate(&instanceID, 1, name, &snapID);
 
+    return res < 0 ? res : snapID;
+}
+
+int Backend::persistentInstancesSnapshotCreate(const int *instanceIDs,
+                                               int nInstances, const char *name,
+                                               int *snapshotIDs)
+{
+    int res;
+
+    if (readOnly)
+        return -EROFS;
+
+    res = sqlite3_exec(connPersistent, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
     if (res != SQLITE_OK)
-        die("Failed to bind composed property lookup statement: %s\n",
+    {
+        log(kErr, "Failed to begin transaction: %s\n",
             sqlite3_errmsg(connPersistent));
+        return -EIO;
+    }
+
+    for (int i = 0; i < nInstances; i++)
+    {
+        int snapID = snapshotCreate(instanceIDs[i], name);
+
+        if (snapID == -EIO)
+        {
+            sqlite3_exec(connPersistent, "ROLLBACK;", NULL, NULL, NULL);
+            return -EIO;
+        }
+        else if (snapshotIDs)
+            snapshotIDs[i] = snapID;
+    }
+
+    res = sqlite3_exec(connPersistent, "COMMIT;", NULL, NULL, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to commit snapshots: %s\n",
+            sqlite3_errmsg(connPersistent));
+        sqlite3_exec(connPersistent, "ROLLBACK;", NULL, NULL, NULL);
+        return -EIO;
+    }
+
+    return 0;
+}
+
+int Backend::persistentDependenciesLoad(int instanceID,
+                                        std::vector<ObjectDecl> &decls)
+{
+    /* indices into decls of each instance, and of each service's instances */
+    std::unordered_map<int, size_t> byNst;
+    std::unordered_map<int, std::vector<size_t>> bySvc;
+    int res;
 
-    while ((res = sqlite3_step(permNstCurProps)) != SQLITE_DONE)
+    bindInt(permDepsNsts, ":instanceID", instanceID);
+    while ((res = sqlite3_step(permDepsNsts)) == SQLITE_ROW)
     {
-        if (res == SQLITE_ROW)
+        ObjectDecl decl;
+        const char *type = (const char *)sqlite3_column_text(permDepsNsts, 2);
+
+        decl.instanceID = sqlite3_column_int(permDepsNsts, 0);
+        decl.name = *type ? std::string(type) + "$" : "";
+        decl.name += (const char *)sqlite3_column_text(permDepsNsts, 3);
+        decl.name += ":";
+        decl.name += (const char *)sqlite3_column_text(permDepsNsts, 4);
+
+        byNst[decl.instanceID] = decls.size();
+        bySvc[sqlite3_column_int(permDepsNsts, 1)].push_back(decls.size());
+        decls.push_back(std::move(decl));
+    }
+    sqlite3_reset(permDepsNsts);
+
+    if (res != SQLITE_DONE)
+        goto fail;
+
+    bindInt(permDeps, ":instanceID", instanceID);
+    while ((res = sqlite3_step(permDeps)) == SQLITE_ROW)
+    {
+        int svcID = sqlite3_column_int(permDeps, 0);
+        int nstID = sqlite3_column_int(permDeps, 1);
+        std::string key = (const char *)sqlite3_column_text(permDeps, 2);
+        const char *target = (const char *)sqlite3_column_text(permDeps, 3);
+        const char *type = (const char *)sqlite3_column_text(permDeps, 4);
+        std::vector<size_t> one;
+        std::vector<size_t> *declarers = &one;
+
+        if (!target || !type)
+            continue;
+
+        /* a service's dependencies are those of each of its instances */
+        if (nstID)
         {
-            int rowID = sqlite3_column_int(permNstCurProps, 0);
-            printf("Row: %d\n", rowID);
+            auto it = byNst.find(nstID);
+            if (it != byNst.end())
+                one.push_back(it->second);
         }
+        else
+            declarers = &bySvc[svcID];
+
+        for (size_t idx : *declarers)
+            if (decls[idx].depAdd(key, target, type) == -1)
+                log(kWarn, "%s: unknown kind of dependency %s\n",
+                    decls[idx].name.c_str(), key.c_str());
     }
+    sqlite3_reset(permDeps);
 
+    if (res != SQLITE_DONE)
+        goto fail;
+
+    return 0;
+
+fail:
+    log(kErr, "Failed to load dependencies: %s\n",
+        sqlite3_errmsg(connPersistent));
+    decls.clear();
+    return -EIO;
+}
+
+int Backend::persistentInstancePropertiesLoad(
+    int instanceID, std::map<std::string, std::string> &props)
+{
+    int res;
+
+    bindInt(permNstCurProps, ":instanceID", instanceID);
+    while ((res = sqlite3_step(permNstCurProps)) == SQLITE_ROW)
+    {
+        bindInt(permPropString, ":propertyID",
+                sqlite3_column_int(permNstCurProps, 0));
+        if (sqlite3_step(permPropString) == SQLITE_ROW &&
+            sqlite3_column_text(permPropString, 1))
+            props[(const char *)sqlite3_column_text(permPropString, 0)] =
+                (const char *)sqlite3_column_text(permPropString, 1);
+        sqlite3_reset(permPropString);
+    }
     sqlite3_reset(permNstCurProps);
 
+    if (res != SQLITE_DONE)
+    {
+        log(kErr, "Failed to load properties of instance %d: %s\n",
+            instanceID, sqlite3_errmsg(connPersistent));
+        props.clear();
+        return -EIO;
+    }
+
     return 0;
 }
 
-int Backend::repositoryInit(sqlite3 *conn, const char *schema)
+int Backend::volatileLiveInstancesWrite(
+    const std::vector<LiveInstanceRecord> &records)
+{
+    sqlite3_stmt *stmts[] = {volLiveUpdate, volLiveInsert};
+    bool began;
+    int res;
+
+    res = sqlite3_exec(connVolatile, "BEGIN IMMEDIATE;", NULL, NULL, NULL);
+    began = res == SQLITE_OK;
+
+    for (size_t r = 0; r < records.size() && res == SQLITE_OK; r++)
+        for (int i = 0; i < 2; i++)
+        {
+            const LiveInstanceRecord &rec = records[r];
+            sqlite3_stmt *stmt = stmts[i];
+
+            bindText(stmt, ":name", rec.name.c_str());
+            bindText(stmt, ":state", rec.state);
+            bindInt64(stmt, ":since", rec.since);
+            bindInt64(stmt, ":generation", rec.generation);
+            bindInt(stmt, ":mainPID", rec.mainPID);
+            bindInt(stmt, ":instanceID", rec.instanceID);
+
+            res = stepReset(stmt);
+            sqlite3_clear_bindings(stmt);
+            /* an update which found the row leaves nothing to insert */
+            if (res != SQLITE_OK || sqlite3_changes(connVolatile))
+                break;
+        }
+
+    if (res == SQLITE_OK)
+        res = sqlite3_exec(connVolatile, "COMMIT;", NULL, NULL, NULL);
+
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to write live instances: %s\n",
+            sqlite3_errmsg(connVolatile));
+        if (began)
+            sqlite3_exec(connVolatile, "ROLLBACK;", NULL, NULL, NULL);
+    }
+
+    return res == SQLITE_OK ? 0 : -EIO;
+}
+
+int Backend::repositoryInit(sqlite3 *conn, const char *schema, int version)
 {
     int res = sqlite3_exec(conn, schema, NULL, NULL, NULL);
     if (res != SQLITE_OK)
         return res;
 
-    res = metadataInit(conn);
+    res = metadataInit(conn, version);
     return res;
 }
 
@@ -152,15 +1139,193 @@ void Backend::sqliteLog(void *userData, int errCode, const char *errMsg)
     ((Backend *)userData)->log(kWarn, "SQLite: %s\n", errMsg);
 }
 
+int Backend::volatilePersistBegin()
+{
+    int res;
+
+    log(kInfo, "writing out volatile repository to %s\n", pathVolatileDb);
+
+    if (unlink(pathVolatileDb) == -1 && errno != ENOENT)
+    {
+        loge(kErr, errno, "Failed to delete old volatile repository");
+        return -1;
+    }
+
+    res = sqlite3_open_v2(pathVolatileDb, &connVolatileDisk,
+                          SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                              SQLITE_OPEN_NOMUTEX,
+                          NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to create volatile repository: %s\n",
+            sqlite3_errmsg(connVolatileDisk));
+        goto fail;
+    }
+
+    volatileBackup =
+        sqlite3_backup_init(connVolatileDisk, "main", connVolatile, "main");
+    if (!volatileBackup)
+    {
+        log(kErr, "Failed to begin copying volatile repository: %s\n",
+            sqlite3_errmsg(connVolatileDisk));
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    volatilePersistAbort();
+    return -1;
+}
+
+bool Backend::volatilePersistStep()
+{
+    int res;
+
+    if (!volatileBackup)
+        return false; /* abandoned meanwhile */
+
+    res = sqlite3_backup_step(volatileBackup, kVolatileBackupPages);
+
+    if (res == SQLITE_OK || res == SQLITE_BUSY || res == SQLITE_LOCKED)
+        return true;
+    else if (res != SQLITE_DONE)
+    {
+        log(kErr, "Failed to copy volatile repository: %s\n",
+            sqlite3_errstr(res));
+        volatilePersistAbort();
+        return false;
+    }
+
+    sqlite3_backup_finish(volatileBackup);
+    volatileBackup = NULL;
+
+    /* the on-disk copy is complete and from now on is the real thing */
+    volatileStatementsFinalize();
+    sqlite3_close(connVolatile);
+    connVolatile = connVolatileDisk;
+    connVolatileDisk = NULL;
+    volatileStatementsPrepare();
+
+    log(kInfo, "volatile repository now kept in %s\n", pathVolatileDb);
+    return false;
+}
+
+void Backend::volatilePersistSchedule()
+{
+    struct timespec ts = {0, kVolatileBackupIntervalNSecs};
+
+    timerVolatileBackup = loop->addTimer(this, &ts);
+    if (timerVolatileBackup < 0)
+    {
+        loge(kErr, -timerVolatileBackup,
+             "Failed to schedule copying of volatile repository");
+        timerVolatileBackup = -1;
+        /* no step is in flight, so the backup may be abandoned here */
+        volatilePersistAbort();
+    }
+}
+
+void Backend::volatilePersistAbort()
+{
+    if (volatileBackup)
+        sqlite3_backup_finish(volatileBackup);
+    volatileBackup = NULL;
+
+    if (connVolatileDisk)
+    {
+        sqlite3_close(connVolatileDisk);
+        unlink(pathVolatileDb);
+    }
+    connVolatileDisk = NULL;
+
+    log(kWarn, "volatile repository will be kept in-memory only\n");
+}
+
+void Backend::timerEvent(EventLoop *loop, int id)
+{
+    if (id == timerVolatileBackup)
+    {
+        timerVolatileBackup = -1;
+        submit(new VolatilePersistStepJob);
+    }
+}
+
+void Backend::ReadWriteJob::complete()
+{
+    if (res == -EALREADY)
+        bend->log(kInfo, "Already in read-write mode.\n");
+    else if (res < 0)
+        bend->loge(kErr, -res, "Failed to enter read-write mode");
+    else if (persisting)
+        bend->volatilePersistSchedule();
+}
+
+int Backend::setReadWrite()
+{
+    sqlite3 *conn;
+    int res;
+
+    if (!readOnly)
+        return -EALREADY;
+
+    log(kInfo, "reopening persistent repository %s as read-write\n",
+        pathPersistentDb);
+
+    res = sqlite3_open_v2(pathPersistentDb, &conn,
+                          SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to reopen persistent repository: %s\n",
+            sqlite3_errmsg(conn));
+        sqlite3_close(conn);
+        return -EIO;
+    }
+    else if (sqlite3_db_readonly(conn, "main") == 1)
+    {
+        log(kErr, "Persistent repository is still not writable.\n");
+        sqlite3_close(conn);
+        return -EROFS;
+    }
+
+    persistentStatementsFinalize();
+    sqlite3_close(connPersistent);
+    connPersistent = conn;
+    persistentStatementsPrepare();
+
+    readOnly = false;
+
+    /* if there's nowhere to write it out, it simply stays in-memory */
+    if (pathVolatileDb && backupIntervalSecs)
+    {
+        res = periodicBackup.start(connVolatile, pathVolatileDb,
+                                   backupIntervalSecs);
+        if (res < 0)
+            loge(kErr, -res, "Failed to start backing up volatile "
+                             "repository");
+    }
+    else if (pathVolatileDb)
+        volatilePersistBegin();
+
+    return 0;
+}
+
 void Backend::init(const char *aPathPersistentDb, const char *aPathVolatileDb,
                    bool startReadOnly, bool recreatePersistentDb,
-                   bool reattachVolatileRepository)
+                   bool reattachVolatileRepository,
+                   int aBackupIntervalSecs)
 {
     int res;
+    int volatileMutexFlag;
 
     pathPersistentDb = aPathPersistentDb;
     pathVolatileDb = aPathVolatileDb;
     readOnly = startReadOnly;
+    backupIntervalSecs = aBackupIntervalSecs;
+
+    /* the backup thread shares the in-memory volatile repository */
+    volatileMutexFlag =
+        backupIntervalSecs ? SQLITE_OPEN_FULLMUTEX : SQLITE_OPEN_NOMUTEX;
 
     sqlite3_config(SQLITE_CONFIG_LOG, sqliteLog, this);
 
@@ -181,7 +1346,8 @@ void Backend::init(const char *aPathPersistentDb, const char *aPathVolatileDb,
             die("Failed to create persistent repository: %s\n",
                 sqlite3_errmsg(connPersistent));
 
-        if (repositoryInit(connPersistent, krepositorySchema_sql) != SQLITE_OK)
+        if (repositoryInit(connPersistent, krepositorySchema_sql,
+                           ECI_BACKEND_SCHEMA_VERSION) != SQLITE_OK)
             die("Failed to initialise persistent repository: %s\n",
                 sqlite3_errmsg(connPersistent));
     }
@@ -203,12 +1369,55 @@ void Backend::init(const char *aPathPersistentDb, const char *aPathVolatileDb,
         res = metadataValidate(connPersistent);
         if (res == -1)
             die("Persistent repository has invalid metadata.\n");
-        else if (res != ECI_BACKEND_SCHEMA_VERSION)
-            die("Persistent repository has mismatched schema version.\n");
+        else if (res != ECI_BACKEND_SCHEMA_VERSION && readOnly)
+            die("Persistent repository has schema version %d and cannot be "
+                "upgraded to %d while read-only.\n",
+                res, ECI_BACKEND_SCHEMA_VERSION);
+        else if (migrate(connPersistent, persistentMigrations,
+                         ECI_BACKEND_SCHEMA_VERSION) == -1)
+            die("Failed to upgrade persistent repository.\n");
     }
 
     /* setup volatile repository */
-    if (reattachVolatileRepository) /* must also be in read-write mode */
+    if (reattachVolatileRepository && backupIntervalSecs)
+    {
+        sqlite3 *connBackup;
+        sqlite3_backup *backup;
+
+        log(kInfo, "reattaching to backup of volatile repository %s\n",
+            pathVolatileDb);
+
+        res = sqlite3_open_v2(":memory:", &connVolatile,
+                              SQLITE_OPEN_READWRITE | volatileMutexFlag, NULL);
+        if (res != SQLITE_OK)
+            die("Failed to create in-memory volatile repository: %s\n",
+                sqlite3_errmsg(connVolatile));
+
+        res = sqlite3_open_v2(pathVolatileDb, &connBackup,
+                              SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+        if (res != SQLITE_OK)
+            die("Failed to attach to volatile repository: %s\n",
+                sqlite3_errmsg(connBackup));
+
+        backup = sqlite3_backup_init(connVolatile, "main", connBackup,
+                                     "main");
+        if (!backup)
+            die("Failed to load volatile repository: %s\n",
+                sqlite3_errmsg(connVolatile));
+
+        res = sqlite3_backup_step(backup, -1);
+        sqlite3_backup_finish(backup);
+        sqlite3_close(connBackup);
+
+        if (res != SQLITE_DONE)
+            die("Failed to load volatile repository: %s\n",
+                sqlite3_errstr(res));
+
+        if (migrate(connVolatile, volatileMigrations,
+                    ECI_BACKEND_VOLATILE_SCHEMA_VERSION) == -1)
+            die("Failed to upgrade volatile repository.\n");
+    }
+    else if (reattachVolatileRepository) /* must also be in read-write mode */
     {
         log(kInfo, "reattaching to existing volatile repository %s\n",
             pathVolatileDb);
@@ -221,27 +1430,24 @@ void Backend::init(const char *aPathPersistentDb, const char *aPathVolatileDb,
             die("Failed to attach to volatile repository: %s\n",
                 sqlite3_errmsg(connVolatile));
 
-        res = metadataValidate(connVolatile);
-        if (res == -1)
-            die("Volatile repository has invalid metadata.\n");
-        else if (res != ECI_BACKEND_SCHEMA_VERSION)
-            die("Volatile repository has mismatched schema version.\n");
+        if (migrate(connVolatile, volatileMigrations,
+                    ECI_BACKEND_VOLATILE_SCHEMA_VERSION) == -1)
+            die("Failed to upgrade volatile repository.\n");
     }
-    else if (startReadOnly || !pathVolatileDb)
+    else if (startReadOnly || !pathVolatileDb || backupIntervalSecs)
     {
         /* checking if pathVolatileDb should've been set isn't our duty */
         log(kInfo, "creating in-memory volatile repository\n");
 
         res = sqlite3_open_v2(":memory:", &connVolatile,
-                              SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
-                              NULL);
+                              SQLITE_OPEN_READWRITE | volatileMutexFlag, NULL);
 
         if (res != SQLITE_OK)
             die("Failed to create in-memory volatile repository: %s\n",
                 sqlite3_errmsg(connVolatile));
 
-        if (repositoryInit(connVolatile, kvolatileRepositorySchema_sql) !=
-            SQLITE_OK)
+        if (repositoryInit(connVolatile, kvolatileRepositorySchema_sql,
+                           ECI_BACKEND_VOLATILE_SCHEMA_VERSION) != SQLITE_OK)
             die("Failed to initialise in-memory volatile repository: %s\n",
                 sqlite3_errmsg(connVolatile));
     }
@@ -261,24 +1467,46 @@ void Backend::init(const char *aPathPersistentDb, const char *aPathVolatileDb,
             die("Failed to create volatile repository: %s",
                 sqlite3_errmsg(connVolatile));
 
-        if (repositoryInit(connVolatile, kvolatileRepositorySchema_sql) !=
-            SQLITE_OK)
+        if (repositoryInit(connVolatile, kvolatileRepositorySchema_sql,
+                           ECI_BACKEND_VOLATILE_SCHEMA_VERSION) != SQLITE_OK)
             die("Failed to initialise volatile repository: %s\n",
                 sqlite3_errmsg(connVolatile));
     }
 
-    res = sqlite3_prepare_v2(connPersistent,
-                             kqueryGetInstancePropertiesComposed_sql, -1,
-                             &permNstCurProps, NULL);
-    if (res != SQLITE_OK)
-        die("Failed to ready prepared statements: %s",
-            sqlite3_errmsg(connPersistent));
+    if (backupIntervalSecs && pathVolatileDb && !readOnly &&
+        (res = periodicBackup.start(connVolatile, pathVolatileDb,
+                                    backupIntervalSecs)) < 0)
+        edie(-res, "Failed to start backing up volatile repository");
+
+    persistentStatementsPrepare();
+    volatileStatementsPrepare();
+
+    if ((res = worker.start()) < 0)
+        edie(-res, "Failed to start DB worker");
+}
+
+void Backend::submit(DBJob *job)
+{
+    worker.submit(job);
+}
 
-    printf("Stmt: %p.\n", permNstCurProps);
+void Backend::requestReadWrite()
+{
+    submit(new ReadWriteJob);
 }
 
 void Backend::shutdown()
 {
+    worker.stop();
+
+    if (timerVolatileBackup >= 0)
+        loop->delTimer(timerVolatileBackup);
+    timerVolatileBackup = -1;
+    if (volatileBackup)
+        volatilePersistAbort();
+    periodicBackup.stop(true);
+    persistentStatementsFinalize();
+    volatileStatementsFinalize();
     sqlite3_close(connVolatile);
     sqlite3_close(connPersistent);
 }
\ No newline at end of file
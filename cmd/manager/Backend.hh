@@ -18,18 +18,96 @@ included with this software
 #ifndef BACKEND_HH__
 #define BACKEND_HH__
 
+#include <map>
+#include <string>
+#include <vector>
+
+#include "PeriodicBackup.hh"
+#include "DBWorker.hh"
+#include "eci/Event.hh"
 #include "eci/Logger.hh"
 
 class Manager;
 class InstanceName;
+struct LiveInstanceRecord;
+struct ObjectDecl;
 struct sqlite3;
+struct sqlite3_backup;
 struct sqlite3_stmt;
 
-class Backend : public Logger
+/**
+ * A table to be rebuilt by online copy-and-swap as part of a Migration. This
+ * is how a column may be retyped, or a constraint changed, without holding the
+ * repository locked for the whole of the copy.
+ */
+struct MigrationCopy
+{
+    /** The table to be rebuilt. */
+    const char *table;
+    /**
+     * CREATE TABLE statement for the rebuilt table. A single %s stands in for
+     * the table name.
+     */
+    const char *ddl;
+    /**
+     * Comma-separated list of the columns of the rebuilt table which are
+     * copied into. Columns not listed take their default values.
+     */
+    const char *columns;
+    /**
+     * Comma-separated list of expressions over a row of \p table, giving in
+     * order the values of \p columns. If NULL, \p columns are carried over
+     * as they are.
+     */
+    const char *select;
+};
+
+/**
+ * A single step in upgrading a repository from one schema version to the
+ * next. Migrations are kept in arrays ordered by ascending target version and
+ * terminated by an entry with a toVersion of 0.
+ */
+struct Migration
+{
+    /** The schema version the repository is at once this is applied. */
+    int toVersion;
+    /** Human-readable description for the log. */
+    const char *desc;
+    /**
+     * If non-NULL, the tables to be rebuilt by online copy-and-swap before
+     * \p sql is run, terminated by an entry with a NULL table.
+     */
+    const MigrationCopy *copies;
+    /**
+     * SQL run as the copies are set up, before the rebuilt tables are
+     * created. It may create what their \p select expressions rely on, and
+     * BEFORE triggers on the tables being copied to keep that up to date
+     * while they are; such triggers go when the old tables are dropped.
+     */
+    const char *copyPrepare;
+    /**
+     * SQL run in the transaction that completes the migration. May be NULL.
+     * For a copy-and-swap, this is run after the swap, and so must recreate
+     * any indices of the rebuilt tables.
+     */
+    const char *sql;
+};
+
+/**
+ * The repository backend. Besides init() and shutdown(), its repository
+ * methods must be called only on the DB worker thread, i.e. from a DBJob
+ * submitted with submit().
+ */
+class Backend : public Logger, public Handler
 {
     friend class Manager;
 
+    class ReadWriteJob;
+    class VolatilePersistStepJob;
+
     Manager *mgr;
+    EventLoop *loop;
+    DBWorker worker;
 
     sqlite3 *connPersistent;
     sqlite3 *connVolatile;
@@ -43,6 +121,51 @@ class Backend : public Logger
      */
     sqlite3_stmt *permNstCurProps;
 
+    /**
+     * Prepared statements used in creating snapshots; see
+     * snapshotCreate(). Parameters are bound by name: :instanceID, :name,
+     * :snapshotID, and :delta.
+     */
+    /** Look up the SnapshotID of the snapshot :name of :instanceID. */
+    sqlite3_stmt *permSnapLookup;
+    /** Add :delta to the RefCount of each bundle :snapshotID refers to. */
+    sqlite3_stmt *permSnapRefBundles;
+    /** Delete the SnapshotProperty rows of :snapshotID. */
+    sqlite3_stmt *permSnapDelProps;
+    /** Delete the Snapshots row of :snapshotID. */
+    sqlite3_stmt *permSnapDel;
+    /** Add a Snapshots row :name for :instanceID, if that instance exists. */
+    sqlite3_stmt *permSnapNew;
+    /**
+     * Copy the composed view of :instanceID, and recursively the contents of
+     * its property groups, into SnapshotProperty rows for :snapshotID.
+     */
+    sqlite3_stmt *permSnapCopy;
+
+    /**
+     * Prepared statements used in loading dependencies; see
+     * persistentDependenciesLoad(). :instanceID is 0 to load all.
+     */
+    /** Select the ID, service ID, and the parts of the name of :instanceID. */
+    sqlite3_stmt *permDepsNsts;
+    /**
+     * Select the dependency_* property groups of :instanceID and its service:
+     * their parent service or instance ID, key, target, and type.
+     */
+    sqlite3_stmt *permDeps;
+
+    /**
+     * Select the key and value of :propertyID if it is a string property; see
+     * persistentInstancePropertiesLoad().
+     */
+    sqlite3_stmt *permPropString;
+
+    /**
+     * Update the state of the live instance :name, or insert it; see
+     * volatileLiveInstancesWrite().
+     */
+    sqlite3_stmt *volLiveUpdate = NULL, *volLiveInsert = NULL;
+
     /**
      * Path to the persistent repository - we need it so that, should we
      * transition from or to read-only mode, we can reopen the repository
@@ -59,12 +182,62 @@ class Backend : public Logger
 
     bool readOnly = false;
 
+    /**
+     * While the in-memory volatile repository is being written out to
+     * pathVolatileDb, the connection to the latter and the backup copying
+     * into it. The copy proceeds a few pages at a time, each step a job
+     * submitted on a timer event, so as not to hold up other jobs.
+     */
+    sqlite3 *connVolatileDisk = NULL;
+    sqlite3_backup *volatileBackup = NULL;
+    /**
+     * ID of the timer which drives the next step of the backup. Belongs to
+     * the event loop thread.
+     */
+    int timerVolatileBackup = -1;
+
+    /**
+     * Interval in seconds between full backups of the volatile repository, or
+     * 0 if it is not backed up. If it is, it is kept in-memory and written
+     * out to pathVolatileDb by periodicBackup in the background, rather than
+     * kept on-disk.
+     */
+    int backupIntervalSecs = 0;
+    PeriodicBackup periodicBackup;
+
     /** Initialises the metadata table. The table must be empty. -1 on fail. */
-    int metadataInit(sqlite3 *conn);
+    int metadataInit(sqlite3 *conn, int version);
     /** Validates the Metadata table, returning the version. -1 on fail. */
     int metadataValidate(sqlite3 *conn);
     /** Set the schema version in the Metadata table. -1 on fail. */
-    int metadataSetVersion(sqlite3 *conn);
+    int metadataSetVersion(sqlite3 *conn, int version);
+
+    /**
+     * Upgrade the repository on \p conn in place to schema version \p
+     * toVersion, applying in order each of \p migrations which targets a
+     * version newer than the repository's. Each migration commits separately,
+     * so an interrupted upgrade resumes from the last one completed.
+     *
+     * @returns 0 if the repository is now at \p toVersion
+     * @returns -1 if the repository is newer than \p toVersion, if there is no
+     * migration path, or if a migration failed (it is then rolled back.)
+     */
+    int migrate(sqlite3 *conn, const Migration *migrations, int toVersion);
+    /** Apply a migration in a single transaction. -1 on fail. */
+    int migrationApply(sqlite3 *conn, const Migration *migration);
+    /**
+     * Apply a migration which rebuilds tables by online copy-and-swap: a
+     * shadow of each table is created, kept in step with the old one by
+     * triggers, and filled in batches, each in its own short transaction; the
+     * old tables are only locked for the swap itself. How far each copy has
+     * got is recorded with each batch, so an interrupted copy resumes where it
+     * left off. -1 on fail.
+     */
+    int migrationCopySwap(sqlite3 *conn, const Migration *migration);
+    /** Set up the copies of a migration, unless already set up. -1 on fail. */
+    int migrationCopyBegin(sqlite3 *conn, const Migration *migration);
+    /** Copy the rows of \p copy not yet copied. -1 on fail. */
+    int migrationCopyRows(sqlite3 *conn, const MigrationCopy *copy);
 
     /**
      * Find the given instance in the persistent database.
@@ -76,6 +249,65 @@ class Backend : public Logger
      */
     int persistentInstanceLookup(InstanceName &name);
 
+    /** Prepare the statements used against the persistent repository. */
+    void persistentStatementsPrepare();
+    /** Finalise the statements used against the persistent repository. */
+    void persistentStatementsFinalize();
+    /** Prepare the statements used against the volatile repository. */
+    void volatileStatementsPrepare();
+    /** Finalise the statements used against the volatile repository. */
+    void volatileStatementsFinalize();
+
+    /**
+     * Make a snapshot as persistentInstanceSnapshotCreate() does, but within
+     * the caller's transaction.
+     */
+    int snapshotCreate(int instanceID, const char *name);
+
+    /**
+     * Begin writing out the in-memory volatile repository to pathVolatileDb.
+     * -1 on fail.
+     */
+    int volatilePersistBegin();
+    /**
+     * Copy the next few pages of the volatile repository to disk. Once all
+     * are copied, the on-disk copy becomes the volatile repository.
+     *
+     * @returns true if there are more pages to copy.
+     */
+    bool volatilePersistStep();
+    /** Schedule the next step of writing out the volatile repository. */
+    void volatilePersistSchedule();
+    /** Abandon writing out the volatile repository. */
+    void volatilePersistAbort();
+
+    /**
+     * Leave read-only mode, once the filesystem holding the repositories is
+     * writable. The persistent repository is reopened read-write; and, if the
+     * volatile repository has been kept in-memory only for want of a writable
+     * pathVolatileDb, it is begun to be written out there, after which it is
+     * kept on-disk.
+     *
+     * @returns 0 if successful
+     * @returns -EALREADY if not in read-only mode
+     * @returns -EROFS if the persistent repository is still not writable
+     * @returns -EIO if the persistent repository could not be reopened
+     */
+    int setReadWrite();
+
+    /**
+     * Initialise a new repository with the given schema, which is at schema
+     * version \p version. -1 on fail.
+     */
+    int repositoryInit(sqlite3 *conn, const char *schema, int version);
+
+    /* Print an SQLite error. */
+    static void sqliteLog(void *userData, int errCode, const char *errMsg);
+
+    /* event handlers */
+    void timerEvent(EventLoop *loop, int id);
+
+  public:
     /**
      * Make a snapshot of the given instance's current composed view of
      * properties.
@@ -89,17 +321,63 @@ class Backend : public Logger
      *
      * @returns snapshot ID (>0) if successful
      * @returns -ENOENT if instance does not exist
+     * @returns -EROFS if the repository is read-only
+     * @returns -EIO if the repository could not be updated
      */
     int persistentInstanceSnapshotCreate(int instanceID, const char *name);
 
-    /** Initialise a new repository with the given schema. -1 on fail. */
-    int repositoryInit(sqlite3 *conn, const char *schema);
+    /**
+     * Make a snapshot named \p name of each of the \p nInstances instances
+     * in \p instanceIDs, all in a single transaction.
+     *
+     * @param snapshotIDs Nullable. If given, it receives for each instance
+     * either its new snapshot ID, or -ENOENT if that instance does not exist;
+     * the others are snapshotted regardless.
+     *
+     * @returns 0 if successful
+     * @returns -EROFS if the repository is read-only
+     * @returns -EIO if the repository could not be updated; no snapshots are
+     * then made.
+     */
+    int persistentInstancesSnapshotCreate(const int *instanceIDs,
+                                          int nInstances, const char *name,
+                                          int *snapshotIDs);
 
-    /* Print an SQLite error. */
-    static void sqliteLog(void *userData, int errCode, const char *errMsg);
+    /**
+     * Load the dependencies declared for an instance, or for every instance
+     * if \p instanceID is 0, appending a declaration for each to \p decls.
+     * The dependencies of every layer are loaded alike, as they add to rather
+     * than override one another.
+     *
+     * @returns 0 if successful; if \p instanceID does not exist, nothing is
+     * appended.
+     * @returns -EIO if the repository could not be read.
+     */
+    int persistentDependenciesLoad(int instanceID,
+                                   std::vector<ObjectDecl> &decls);
 
-  public:
-    Backend(Manager *mgr);
+    /**
+     * Load the string properties in the composed view of an instance: those
+     * set directly on the instance or its service, the instance's and those of
+     * higher layers taking precedence.
+     *
+     * @returns 0 if successful.
+     * @returns -EIO if the repository could not be read.
+     */
+    int persistentInstancePropertiesLoad(
+        int instanceID, std::map<std::string, std::string> &props);
+
+    /**
+     * Write the state of live instances to the volatile repository, in one
+     * transaction, adding a row for each not yet there.
+     *
+     * @returns 0 if successful.
+     * @returns -EIO if the repository could not be written.
+     */
+    int volatileLiveInstancesWrite(
+        const std::vector<LiveInstanceRecord> &records);
+
+    Backend(Manager *mgr, EventLoop *loop);
 
     /**
      * Initialise the database backend.
@@ -116,10 +394,25 @@ class Backend : public Logger
      * @param startReadOnly Whether to start in read-only mode.
      * @param reattachVolatileRepository Whether to reattach to an existing
      * volatile repository.
+     * @param aBackupIntervalSecs If non-zero, keep the volatile repository
+     * in-memory, and back all of it up to \p aPathVolatileDb at this
+     * interval. A reattachment then loads the latest backup.
      */
     void init(const char *aPathPersistentDb, const char *aPathVolatileDb,
               bool startReadOnly, bool recreatePersistentDb,
-              bool reattachVolatileRepository);
+              bool reattachVolatileRepository, int aBackupIntervalSecs);
+
+    /**
+     * Submit a job to the DB worker, which takes ownership of it. Must be
+     * called on the event loop thread.
+     */
+    void submit(DBJob *job);
+
+    /**
+     * Leave read-only mode, as setReadWrite() does, on the DB worker. The
+     * outcome is logged.
+     */
+    void requestReadWrite();
 
     /** Shut down the database backend. */
     void shutdown();
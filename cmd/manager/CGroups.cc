@@ -0,0 +1,336 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "CGroups.hh"
+
+#ifdef ECI_PLAT_LINUX
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#endif
+
+#ifndef CGROUP2_SUPER_MAGIC
+#define CGROUP2_SUPER_MAGIC 0x63677270
+#endif
+
+static int fileWrite(const std::string &path, const char *str)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    int r = 0;
+
+    if (fd == -1)
+        return -errno;
+    if (write(fd, str, strlen(str)) == -1)
+        r = -errno;
+    close(fd);
+    return r;
+}
+
+static int fileRead(const std::string &path, std::string &out)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    char buf[4096];
+    ssize_t n;
+
+    if (fd == -1)
+        return -errno;
+
+    out.clear();
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        out.append(buf, n);
+    if (n == -1)
+        n = -errno;
+    close(fd);
+    return n;
+}
+
+/** Find the value of \p key in the "key value" lines of \p text. */
+static bool keyFind(const std::string &text, const char *key, uint64_t &val)
+{
+    size_t keyLen = strlen(key);
+
+    for (size_t pos = 0; pos < text.size();)
+    {
+        size_t end = text.find('\n', pos);
+
+        if (end == std::string::npos)
+            end = text.size();
+        if (text.compare(pos, keyLen, key) == 0 && text[pos + keyLen] == ' ')
+        {
+            val = strtoull(text.c_str() + pos + keyLen + 1, NULL, 10);
+            return true;
+        }
+        pos = end + 1;
+    }
+
+    return false;
+}
+
+/** Read the single number in the file at \p path. */
+static bool numberRead(const std::string &path, uint64_t &val)
+{
+    std::string text;
+
+    if (fileRead(path, text) < 0 || text.empty())
+        return false;
+    val = strtoull(text.c_str(), NULL, 10);
+    return true;
+}
+
+/** A name for an object's group; a '/' cannot be in a directory's name. */
+static std::string groupName(const std::string &name)
+{
+    std::string escaped;
+
+    for (char c : name)
+        if (c == '/')
+            escaped += "\\x2f";
+        else
+            escaped += c;
+    return escaped;
+}
+
+int CGroups::init(const char *root)
+{
+#ifdef ECI_PLAT_LINUX
+    static const char *controllers[] = {"+cpu", "+memory", "+pids"};
+    std::string path, self;
+    struct statfs sfs;
+    int r;
+
+    if (root)
+        path = root;
+    else
+    {
+        size_t line;
+
+        /* ours in the unified hierarchy is the "0::<path>" line */
+        if (fileRead("/proc/self/cgroup", self) < 0)
+            return -ENOTSUP;
+        if (self.compare(0, 3, "0::") == 0)
+            line = 0;
+        else if ((line = self.find("\n0::")) != std::string::npos)
+            line++;
+        else
+            return -ENOTSUP;
+
+        self = self.substr(line + 3, self.find('\n', line) - line - 3);
+        if (self == "/")
+            self.clear();
+
+        /* a hybrid hierarchy has the unified one mounted beneath */
+        path = "/sys/fs/cgroup" + self;
+        if (statfs(path.c_str(), &sfs) == 0 &&
+            sfs.f_type != CGROUP2_SUPER_MAGIC)
+            path = "/sys/fs/cgroup/unified" + self;
+    }
+
+    if (statfs(path.c_str(), &sfs) == -1)
+        return errno == ENOENT ? -ENOTSUP : -errno;
+    if (sfs.f_type != CGROUP2_SUPER_MAGIC)
+        return -ENOTSUP;
+
+    if (mkdir((path + "/sys.manager").c_str(), 0755) == -1 && errno != EEXIST)
+        return -errno;
+    if ((r = fileWrite(path + "/sys.manager/cgroup.procs", "0")) != 0)
+        return r;
+
+    /* the counters for usage() come with these; cpu.stat is always there */
+    for (const char *controller : controllers)
+        if ((r = fileWrite(path + "/cgroup.subtree_control", controller)) != 0)
+            loge(kWarn, -r, "Failed to enable controller %s in %s",
+                 controller + 1, path.c_str());
+
+    inotifyFD = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFD == -1)
+        return -errno;
+
+    r = loop->addFD(this, inotifyFD, POLLIN);
+    if (r != 0)
+    {
+        close(inotifyFD);
+        inotifyFD = -1;
+        return r;
+    }
+
+    this->root = path;
+    log(kInfo, "Tracking instances in cgroups under %s\n", path.c_str());
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+bool CGroups::populatedRead(Group &group)
+{
+    std::string events;
+    uint64_t populated;
+
+    if (fileRead(group.path + "/cgroup.events", events) < 0 ||
+        !keyFind(events, "populated", populated))
+        return group.populated;
+
+    group.populated = populated != 0;
+    return group.populated;
+}
+
+void CGroups::fdEvent(EventLoop *loop, int fd, int revents)
+{
+#ifdef ECI_PLAT_LINUX
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t n;
+
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        for (char *pos = buf; pos < buf + n;)
+        {
+            struct inotify_event *ev = (struct inotify_event *)pos;
+            auto watch = watches.find(ev->wd);
+
+            pos += sizeof(struct inotify_event) + ev->len;
+            if (watch == watches.end())
+                continue;
+
+            ObjectIdx obj = watch->second;
+            Group &group = groups[obj];
+            bool wasPopulated = group.populated;
+
+            if (ev->mask & IN_IGNORED)
+            {
+                /* the group was removed from under us */
+                watches.erase(watch);
+                group.wd = -1;
+            }
+            else if (!populatedRead(group) && wasPopulated)
+                delegate->cgroupEmptied(obj);
+        }
+#endif
+}
+
+int CGroups::procsPath(ObjectIdx obj, std::string &path)
+{
+#ifdef ECI_PLAT_LINUX
+    auto it = groups.find(obj);
+
+    if (!enabled())
+        return -ENOTSUP;
+
+    if (it == groups.end())
+    {
+        Group group;
+        int r;
+
+        group.path = root + "/" + groupName(graph->object(obj).name);
+        if (mkdir(group.path.c_str(), 0755) == -1 && errno != EEXIST)
+            return -errno;
+
+        group.wd = inotify_add_watch(
+            inotifyFD, (group.path + "/cgroup.events").c_str(), IN_MODIFY);
+        if (group.wd == -1)
+        {
+            r = -errno;
+            rmdir(group.path.c_str());
+            return r;
+        }
+
+        it = groups.emplace(obj, group).first;
+        watches[group.wd] = obj;
+    }
+
+    populatedRead(it->second);
+    path = it->second.path + "/cgroup.procs";
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+bool CGroups::populated(ObjectIdx obj)
+{
+    auto it = groups.find(obj);
+
+    return it != groups.end() && populatedRead(it->second);
+}
+
+int CGroups::kill(ObjectIdx obj)
+{
+    auto it = groups.find(obj);
+    std::string procs;
+    int r;
+
+    if (it == groups.end())
+        return 0;
+
+    /* cgroup.kill, if the kernel has it, races with no fork */
+    r = fileWrite(it->second.path + "/cgroup.kill", "1");
+    if (r != -ENOENT)
+        return r;
+
+    /* otherwise freeze the group, so none can fork while we kill the rest */
+    fileWrite(it->second.path + "/cgroup.freeze", "1");
+    if ((r = fileRead(it->second.path + "/cgroup.procs", procs)) >= 0)
+    {
+        r = 0;
+        for (const char *pos = procs.c_str(); *pos;)
+        {
+            char *end;
+            pid_t pid = strtol(pos, &end, 10);
+
+            if (end == pos)
+                break;
+            if (::kill(pid, SIGKILL) == -1 && errno != ESRCH)
+                r = -errno;
+            pos = end + strspn(end, "\n");
+        }
+    }
+    fileWrite(it->second.path + "/cgroup.freeze", "0");
+
+    return r;
+}
+
+const CGroupUsage *CGroups::usage(ObjectIdx obj)
+{
+    auto it = groups.find(obj);
+    std::string cpuStat;
+
+    if (it == groups.end())
+        return NULL;
+
+    Group &group = it->second;
+
+    if (group.usageTick == tick)
+        return &group.usage;
+
+    if (fileRead(group.path + "/cpu.stat", cpuStat) < 0 ||
+        !keyFind(cpuStat, "usage_usec", group.usage.cpuUsec))
+        return NULL;
+    /* absent without their controllers enabled */
+    if (!numberRead(group.path + "/memory.current", group.usage.memoryBytes))
+        group.usage.memoryBytes = 0;
+    if (!numberRead(group.path + "/pids.current", group.usage.nProcesses))
+        group.usage.nProcesses = 0;
+
+    group.usageTick = tick;
+    return &group.usage;
+}
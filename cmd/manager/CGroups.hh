@@ -0,0 +1,146 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef CGROUPS_HH__
+#define CGROUPS_HH__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+#include "Graph.hh"
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+
+struct CGroupsDelegate
+{
+    /** The last process in the cgroup of \p obj has exited. */
+    virtual void cgroupEmptied(ObjectIdx obj) = 0;
+};
+
+/** What an instance's processes have used, as its cgroup accounts it. */
+struct CGroupUsage
+{
+    /** CPU time, user and system, in microseconds. */
+    uint64_t cpuUsec;
+    /** Memory in use, in bytes, or 0 if not accounted. */
+    uint64_t memoryBytes;
+    /** Processes, or 0 if not accounted. */
+    uint64_t nProcesses;
+};
+
+/**
+ * Tracks the processes of each instance by placing them in a cgroup (v2) of
+ * the instance's own, a leaf of the subtree delegated to us, so that every
+ * process an instance forks is known to belong to it, however it forks.
+ *
+ * We watch each group's cgroup.events with inotify, on the event loop, and
+ * tell the delegate when a group empties; no signal need be relied on to
+ * learn that the last of an instance's processes has gone.
+ *
+ * A group outlives its processes, so its counters run on across restarts.
+ * They are read when asked for, at most once each tick, which the manager
+ * advances each event loop iteration.
+ *
+ * Only supported on Linux.
+ */
+class CGroups : public Handler, public Logger
+{
+    struct Group
+    {
+        std::string path;
+        /** Watch on its cgroup.events, or -1. */
+        int wd = -1;
+        bool populated = false;
+        /** Tick at which usage was last read, or 0 if never. */
+        uint64_t usageTick = 0;
+        CGroupUsage usage;
+    };
+
+    CGroupsDelegate *delegate;
+    EventLoop *loop;
+    const Graph *graph;
+
+    /** The delegated subtree, or empty if not enabled. */
+    std::string root;
+    int inotifyFD = -1;
+    std::unordered_map<ObjectIdx, Group> groups;
+    /** Objects by the watch descriptors of their groups. */
+    std::unordered_map<int, ObjectIdx> watches;
+    uint64_t tick = 1;
+
+    /** Read whether \p group has any processes in it. */
+    bool populatedRead(Group &group);
+
+    /* event handlers */
+    void fdEvent(EventLoop *loop, int fd, int revents);
+
+  public:
+    CGroups(Logger *parent, CGroupsDelegate *delegate, EventLoop *loop,
+            const Graph *graph)
+        : Logger("cgroups", parent), delegate(delegate), loop(loop),
+          graph(graph){};
+
+    /**
+     * Take over the subtree \p root, or if NULL, the cgroup we were started
+     * in. We move ourselves into a leaf of it, as a group with processes of
+     * its own may not share out controllers among children, and so this must
+     * be done before the fork server is started.
+     *
+     * @returns 0 if successful.
+     * @returns -ENOTSUP if not supported on this platform, or there is no
+     * cgroup2 hierarchy.
+     * @returns -errno if the subtree could not be taken over.
+     */
+    int init(const char *root);
+
+    bool enabled() const
+    {
+        return !root.empty();
+    }
+    /** Advance the tick, so usage is read afresh. */
+    void tickNext()
+    {
+        tick++;
+    }
+
+    /**
+     * Get the path to the cgroup.procs of the group of \p obj, creating and
+     * watching the group if need be.
+     *
+     * @returns 0 if successful.
+     * @returns -errno if the group could not be created.
+     */
+    int procsPath(ObjectIdx obj, std::string &path);
+    /** @returns whether any processes are in the group of \p obj. */
+    bool populated(ObjectIdx obj);
+    /**
+     * SIGKILL every process in the group of \p obj. The delegate is told once
+     * the group has emptied.
+     *
+     * @returns 0 if successful.
+     * @returns -errno if not all could be killed.
+     */
+    int kill(ObjectIdx obj);
+    /**
+     * @returns the usage of the group of \p obj, read at most once each tick.
+     * @returns NULL if \p obj has no group, or it could not be read.
+     */
+    const CGroupUsage *usage(ObjectIdx obj);
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <cerrno>
+#include <fcntl.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "DBWorker.hh"
+
+DBJobQueue::DBJobQueue() : head(&stub), tail(&stub)
+{
+    stub.next.store(NULL, std::memory_order_relaxed);
+}
+
+void DBJobQueue::push(DBJob *job)
+{
+    DBJob *prev;
+
+    job->next.store(NULL, std::memory_order_relaxed);
+    prev = head.exchange(job, std::memory_order_acq_rel);
+    /* until this store, the job is unreachable from the tail */
+    prev->next.store(job, std::memory_order_release);
+}
+
+DBJob *DBJobQueue::pop()
+{
+    DBJob *job = tail;
+    DBJob *next = job->next.load(std::memory_order_acquire);
+
+    if (job == &stub)
+    {
+        if (!next)
+            return NULL;
+        tail = next;
+        job = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next)
+    {
+        tail = next;
+        return job;
+    }
+
+    if (job != head.load(std::memory_order_acquire))
+        return NULL; /* a push is in progress */
+
+    /* job is the last one; put the stub behind it so it can be unlinked */
+    push(&stub);
+
+    next = job->next.load(std::memory_order_acquire);
+    if (next)
+    {
+        tail = next;
+        return job;
+    }
+
+    return NULL;
+}
+
+/* Write a byte to a wakeup pipe. A full pipe is already a wakeup. */
+static void wake(int fd)
+{
+    while (write(fd, ".", 1) == -1 && errno == EINTR)
+        ;
+}
+
+/* Make a non-blocking (on the write side, at least) close-on-exec pipe. */
+static int makePipe(int fds[2], bool nonBlockRead)
+{
+    if (pipe(fds) == -1)
+        return -errno;
+
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(fds[i], F_SETFD, fcntl(fds[i], F_GETFD) | FD_CLOEXEC);
+        if (i == 1 || nonBlockRead)
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    return 0;
+}
+
+DBWorker::DBWorker(Logger *parent, Backend *bend, EventLoop *loop)
+    : Logger("dbworker", parent), bend(bend), loop(loop), shouldRun(false)
+{
+}
+
+void DBWorker::run()
+{
+    while (true)
+    {
+        DBJob *job;
+        char buf[64];
+
+        while ((job = jobs.pop()))
+        {
+            job->run(bend);
+            completions.push(job);
+            wake(pipeCompletions[1]);
+        }
+
+        if (!shouldRun.load())
+            break;
+
+        if (read(pipeJobs[0], buf, sizeof(buf)) == -1 && errno != EINTR)
+        {
+            loge(kErr, errno, "Failed to read from job pipe");
+            break;
+        }
+    }
+}
+
+void DBWorker::deliverCompletions()
+{
+    DBJob *job;
+
+    while ((job = completions.pop()))
+    {
+        job->complete();
+        delete job;
+    }
+}
+
+void DBWorker::fdEvent(EventLoop *loop, int fd, int revents)
+{
+    char buf[64];
+
+    while (read(pipeCompletions[0], buf, sizeof(buf)) > 0)
+        ;
+
+    deliverCompletions();
+}
+
+int DBWorker::start()
+{
+    int r;
+
+    if ((r = makePipe(pipeJobs, false)) < 0 ||
+        (r = makePipe(pipeCompletions, true)) < 0)
+        return r;
+
+    r = loop->addFD(this, pipeCompletions[0], POLLIN);
+    if (r < 0)
+        return r;
+
+    shouldRun.store(true);
+
+    try
+    {
+        thread = std::thread(&DBWorker::run, this);
+    }
+    catch (std::system_error &e)
+    {
+        shouldRun.store(false);
+        loop->delFD(pipeCompletions[0]);
+        return -e.code().value();
+    }
+
+    return 0;
+}
+
+void DBWorker::stop()
+{
+    if (!thread.joinable())
+        return;
+
+    shouldRun.store(false);
+    wake(pipeJobs[1]);
+    thread.join();
+
+    deliverCompletions();
+
+    loop->delFD(pipeCompletions[0]);
+    for (int i = 0; i < 2; i++)
+    {
+        close(pipeJobs[i]);
+        close(pipeCompletions[i]);
+        pipeJobs[i] = pipeCompletions[i] = -1;
+    }
+}
+
+void DBWorker::submit(DBJob *job)
+{
+    if (!thread.joinable())
+    {
+        job->run(bend);
+        job->complete();
+        delete job;
+        return;
+    }
+
+    jobs.push(job);
+    wake(pipeJobs[1]);
+}
@@ -0,0 +1,128 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef DBWORKER_HH__
+#define DBWORKER_HH__
+
+#include <atomic>
+#include <thread>
+
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+
+class Backend;
+
+/**
+ * A unit of work against the repositories. It is run on the DB worker thread,
+ * then completed back on the event loop thread, after which it is deleted.
+ */
+class DBJob
+{
+    friend class DBJobQueue;
+    std::atomic<DBJob *> next;
+
+  public:
+    virtual ~DBJob() = default;
+
+    /** Carry out the job. Called on the DB worker thread. */
+    virtual void run(Backend *bend) = 0;
+    /** Deliver the job's results. Called on the event loop thread. */
+    virtual void complete(){};
+};
+
+/**
+ * Lock-free intrusive queue of DB jobs. Any number of threads may push, but
+ * only one may pop.
+ */
+class DBJobQueue
+{
+    /** Most recently pushed job. */
+    std::atomic<DBJob *> head;
+    /** Next job to pop. Belongs to the consumer. */
+    DBJob *tail;
+    /** Placeholder, so that the queue is never truly empty. */
+    struct Stub : public DBJob
+    {
+        void run(Backend *bend){};
+    } stub;
+
+  public:
+    DBJobQueue();
+
+    void push(DBJob *job);
+    /**
+     * Pop the oldest job. NULL is returned if there is none, but also if a
+     * push is in progress; the pusher then wakes the consumer to try again.
+     */
+    DBJob *pop();
+};
+
+/**
+ * The DB worker. All SQLite access is carried out on its thread, so that a
+ * long query or import does not hold up the event loop. Jobs are submitted
+ * from the event loop thread, and once run they are posted back to it as
+ * completions, which are delivered when the event loop notices a byte on the
+ * completion pipe.
+ */
+class DBWorker : public Logger, public Handler
+{
+    Backend *bend;
+    EventLoop *loop;
+
+    std::thread thread;
+    std::atomic<bool> shouldRun;
+
+    DBJobQueue jobs;
+    DBJobQueue completions;
+
+    /* Pipes by which the worker and event loop respectively are woken. */
+    int pipeJobs[2] = {-1, -1};
+    int pipeCompletions[2] = {-1, -1};
+
+    /** The worker thread. */
+    void run();
+    /** Deliver all posted completions. */
+    void deliverCompletions();
+
+    /* event handlers */
+    void fdEvent(EventLoop *loop, int fd, int revents);
+
+  public:
+    DBWorker(Logger *parent, Backend *bend, EventLoop *loop);
+
+    /**
+     * Start the worker thread.
+     *
+     * @returns 0 if successful.
+     * @returns -errno if unsuccessful.
+     */
+    int start();
+
+    /**
+     * Stop the worker thread once it has run every job submitted so far, then
+     * deliver their completions.
+     */
+    void stop();
+
+    /**
+     * Submit a job, of which the worker takes ownership. If the worker is not
+     * running, the job is run and completed at once.
+     */
+    void submit(DBJob *job);
+};
+
+#endif
@@ -0,0 +1,490 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "ForkServer.hh"
+#include "eci/Core.h"
+
+/* room for the most FDs that are sent in a message either way */
+union FDControl
+{
+    char buf[CMSG_SPACE(sizeof(int) * ForkServer::kMaxBatchFDs)];
+    struct cmsghdr align;
+};
+
+static void append(std::vector<char> &msg, const void *data, size_t len)
+{
+    msg.insert(msg.end(), (const char *)data, (const char *)data + len);
+}
+
+/* Send a message, with any FDs. */
+static ssize_t msgSend(int fd, const std::vector<char> &data,
+                       const std::vector<int> &fds)
+{
+    struct iovec iov = {(void *)data.data(), data.size()};
+    struct msghdr msg;
+    FDControl ctl;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (!fds.empty())
+    {
+        struct cmsghdr *cmsg;
+
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+    }
+
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+/* Receive a message into \p data, resized to fit, and any FDs with it. */
+static ssize_t msgRecv(int fd, std::vector<char> &data, std::vector<int> &fds)
+{
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    FDControl ctl;
+    ssize_t len;
+
+    data.resize(ForkServer::kMaxBatchBytes);
+    iov = {data.data(), data.size()};
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    len = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    if (len == -1)
+        return -1;
+
+    data.resize(len);
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int *received = (const int *)CMSG_DATA(cmsg);
+
+            fds.insert(fds.end(), received, received + n);
+        }
+
+    return len;
+}
+
+/*
+ * Point \p vec at each of the NUL-terminated strings in the \p len bytes at
+ * \p strs, and terminate it with NULL. -1 if the strings are malformed.
+ */
+static int strsSplit(char *strs, size_t len, std::vector<char *> &vec)
+{
+    char *end = strs + len;
+
+    if (len && end[-1] != '\0')
+        return -1;
+    for (; strs < end; strs += strlen(strs) + 1)
+        vec.push_back(strs);
+    vec.push_back(NULL);
+
+    return 0;
+}
+
+void ForkServer::serve(int fd)
+{
+    std::vector<char> msg;
+    std::vector<char> reply;
+    std::vector<int> fds;
+    std::vector<int> pidFDs;
+    int sig;
+
+    /* we inherit the manager's handlers; and a ^C is for the manager alone */
+    for (sig = 1; sig < NSIG; sig++)
+        signal(sig, SIG_DFL);
+    signal(SIGINT, SIG_IGN);
+
+    for (;;)
+    {
+        size_t off = sizeof(uint32_t), nextFD = 0;
+        uint32_t nReqs, nResults = 0;
+        ssize_t len;
+
+        fds.clear();
+        len = msgRecv(fd, msg, fds);
+        if (len == -1 && errno == EINTR)
+            continue;
+        /* the manager has closed its end, or gone */
+        else if (len <= 0 || (size_t)len < sizeof(nReqs))
+            break;
+
+        memcpy(&nReqs, msg.data(), sizeof(nReqs));
+        /* the count of results, filled in once they are all appended */
+        reply.resize(sizeof(nResults));
+
+        for (uint32_t i = 0; i < nReqs; i++)
+        {
+            Request req;
+            Result res = {0, 0, EINVAL, 0};
+            std::vector<char *> argv, envp;
+            std::vector<ECISpawnFDAction> actions;
+            ECISpawnAttr attr;
+            pid_t child = 0;
+            char *strs, *cgroup, *pidEnv;
+            int r;
+
+            /* a request cut short has no cookie to answer it by */
+            if (off + sizeof(req) > msg.size())
+                break;
+            memcpy(&req, msg.data() + off, sizeof(req));
+            off += sizeof(req);
+            strs = msg.data() + off;
+            off += req.argvLen + req.envpLen + req.cgroupLen + req.pidEnvLen +
+                   sizeof(int32_t) * req.nFDs;
+            res.cookie = req.cookie;
+            cgroup = strs + req.argvLen + req.envpLen;
+            pidEnv = cgroup + req.cgroupLen;
+
+            if (off > msg.size() || nextFD + req.nFDs > fds.size() ||
+                strsSplit(strs, req.argvLen, argv) == -1 || !argv[0] ||
+                strsSplit(strs + req.argvLen, req.envpLen, envp) == -1 ||
+                (req.cgroupLen && cgroup[req.cgroupLen - 1] != '\0') ||
+                (req.pidEnvLen && pidEnv[req.pidEnvLen - 1] != '\0'))
+            {
+                /* the FDs sent for it are not for the requests after it */
+                for (size_t end = std::min(nextFD + req.nFDs, fds.size());
+                     nextFD < end; nextFD++)
+                {
+                    close(fds[nextFD]);
+                    fds[nextFD] = -1;
+                }
+                goto answer;
+            }
+
+            for (uint32_t j = 0; j < req.nFDs; j++)
+            {
+                int32_t newFD;
+
+                memcpy(&newFD, pidEnv + req.pidEnvLen + sizeof(int32_t) * j,
+                       sizeof(newFD));
+                actions.push_back({ECISpawnFDAction::kECISpawnDup,
+                                   fds[nextFD++], newFD, NULL, 0, 0});
+            }
+
+            memset(&attr, 0, sizeof(attr));
+            attr.argv = argv.data();
+            attr.envp = req.envpLen ? envp.data() : NULL;
+            attr.fdActions = actions.data();
+            attr.nFDActions = actions.size();
+            attr.newSession = 1;
+            attr.forParent = 1;
+            attr.cgroupProcs = req.cgroupLen ? cgroup : NULL;
+            attr.pidEnv = req.pidEnvLen ? pidEnv : NULL;
+
+            r = eciSpawn(&attr, &child);
+            res.pid = child;
+            res.err = -r;
+
+#ifdef SYS_pidfd_open
+            if (r == 0)
+            {
+                int pidFD = syscall(SYS_pidfd_open, child, 0);
+
+                if (pidFD != -1)
+                {
+                    pidFDs.push_back(pidFD);
+                    res.hasPidFD = 1;
+                }
+            }
+#endif
+
+        answer:
+            append(reply, &res, sizeof(res));
+            nResults++;
+        }
+        memcpy(reply.data(), &nResults, sizeof(nResults));
+
+        for (int received : fds)
+            if (received != -1)
+                close(received);
+
+        while (msgSend(fd, reply, pidFDs) == -1 && errno == EINTR)
+            ;
+        for (int pidFD : pidFDs)
+            close(pidFD);
+        pidFDs.clear();
+    }
+}
+
+int ForkServer::start()
+{
+#ifdef ECI_PLAT_LINUX
+    int sv[2];
+    int r;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1)
+        return -errno;
+
+    pid = fork();
+    if (pid == -1)
+    {
+        r = -errno;
+        close(sv[0]);
+        close(sv[1]);
+        pid = 0;
+        return r;
+    }
+    else if (pid == 0)
+    {
+        close(sv[0]);
+        serve(sv[1]);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(sv[1]);
+    fd = sv[0];
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    r = loop->addFD(this, fd, POLLIN | POLLHUP);
+    if (r != 0)
+    {
+        /* the server exits once it sees its socket closed */
+        close(fd);
+        fd = -1;
+        return r;
+    }
+
+    log(kInfo, "Fork server started as PID %d\n", (int)pid);
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+void ForkServer::failAll(int err)
+{
+    std::vector<uint32_t> failed;
+
+    for (auto &cookies : inFlight)
+        failed.insert(failed.end(), cookies.begin(), cookies.end());
+    inFlight.clear();
+    for (auto &batch : batches)
+    {
+        failed.insert(failed.end(), batch.cookies.begin(), batch.cookies.end());
+        for (int dup : batch.fds)
+            close(dup);
+    }
+    batches.clear();
+
+    for (uint32_t cookie : failed)
+        delegate->processSpawned(cookie, 0, -1, err);
+}
+
+void ForkServer::disconnect()
+{
+    if (fd == -1)
+        return;
+
+    loop->delFD(fd);
+    close(fd);
+    fd = -1;
+    failAll(EPIPE);
+}
+
+void ForkServer::serverExited()
+{
+    log(kErr, "Fork server exited; spawning directly henceforth\n");
+    pid = 0;
+    disconnect();
+}
+
+int ForkServer::spawn(uint32_t cookie, char *const argv[], char *const envp[],
+                      const std::vector<std::pair<int, int>> &fds,
+                      const char *cgroupProcs, const char *pidEnv)
+{
+    Request req = {cookie, 0, 0, 0, 0, (uint32_t)fds.size()};
+    std::vector<int> dups;
+    size_t len;
+    Batch *batch;
+
+    if (!running())
+        return -EPIPE;
+
+    for (char *const *arg = argv; *arg; arg++)
+        req.argvLen += strlen(*arg) + 1;
+    for (char *const *env = envp; env && *env; env++)
+        req.envpLen += strlen(*env) + 1;
+    if (cgroupProcs)
+        req.cgroupLen = strlen(cgroupProcs) + 1;
+    if (pidEnv)
+        req.pidEnvLen = strlen(pidEnv) + 1;
+    len = sizeof(req) + req.argvLen + req.envpLen + req.cgroupLen +
+          req.pidEnvLen + sizeof(int32_t) * fds.size();
+
+    if (sizeof(uint32_t) + len > kMaxBatchBytes || fds.size() > kMaxBatchFDs)
+        return -E2BIG;
+
+    for (auto &fdPair : fds)
+    {
+        int dup = fcntl(fdPair.first, F_DUPFD_CLOEXEC, 0);
+
+        if (dup == -1)
+        {
+            int err = -errno;
+
+            for (int d : dups)
+                close(d);
+            return err;
+        }
+        dups.push_back(dup);
+    }
+
+    if (batches.empty() || batches.back().cookies.size() == kMaxBatch ||
+        batches.back().msg.size() + len > kMaxBatchBytes ||
+        batches.back().fds.size() + fds.size() > kMaxBatchFDs)
+    {
+        batches.emplace_back();
+        /* the count of requests, filled in when sent */
+        batches.back().msg.resize(sizeof(uint32_t));
+    }
+    batch = &batches.back();
+
+    append(batch->msg, &req, sizeof(req));
+    for (char *const *arg = argv; *arg; arg++)
+        append(batch->msg, *arg, strlen(*arg) + 1);
+    for (char *const *env = envp; env && *env; env++)
+        append(batch->msg, *env, strlen(*env) + 1);
+    if (cgroupProcs)
+        append(batch->msg, cgroupProcs, req.cgroupLen);
+    if (pidEnv)
+        append(batch->msg, pidEnv, req.pidEnvLen);
+    for (auto &fdPair : fds)
+    {
+        int32_t newFD = fdPair.second;
+
+        append(batch->msg, &newFD, sizeof(newFD));
+    }
+    batch->fds.insert(batch->fds.end(), dups.begin(), dups.end());
+    batch->cookies.push_back(cookie);
+
+    return 0;
+}
+
+void ForkServer::flush()
+{
+    while (running() && !batches.empty())
+    {
+        Batch &batch = batches.front();
+        uint32_t nReqs = batch.cookies.size();
+
+        memcpy(batch.msg.data(), &nReqs, sizeof(nReqs));
+        if (msgSend(fd, batch.msg, batch.fds) == -1)
+        {
+            /* the rest go once the server has caught up */
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            loge(kErr, errno, "Failed to send spawn requests");
+            disconnect();
+            return;
+        }
+
+        for (int dup : batch.fds)
+            close(dup);
+        inFlight.push_back(std::move(batch.cookies));
+        batches.pop_front();
+    }
+}
+
+void ForkServer::fdEvent(EventLoop *loop, int fd, int revents)
+{
+    std::vector<char> msg;
+    std::vector<int> pidFDs;
+    std::vector<uint32_t> cookies;
+    size_t nextFD = 0;
+    uint32_t nResults;
+    ssize_t len;
+
+    len = msgRecv(fd, msg, pidFDs);
+    if (len == -1 &&
+        (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    else if (len < (ssize_t)sizeof(nResults))
+    {
+        if (len == -1)
+            loge(kErr, errno, "Failed to receive spawn results");
+        disconnect();
+        return;
+    }
+
+    /* it answers the oldest message sent */
+    if (!inFlight.empty())
+    {
+        cookies.swap(inFlight.front());
+        inFlight.pop_front();
+    }
+
+    memcpy(&nResults, msg.data(), sizeof(nResults));
+    for (uint32_t i = 0; i < nResults; i++)
+    {
+        Result res;
+        std::vector<uint32_t>::iterator it;
+        int pidFD = -1;
+
+        if (sizeof(nResults) + (i + 1) * sizeof(res) > msg.size())
+            break;
+        memcpy(&res, msg.data() + sizeof(nResults) + i * sizeof(res),
+               sizeof(res));
+        if (res.hasPidFD && nextFD < pidFDs.size())
+            pidFD = pidFDs[nextFD++];
+
+        it = std::find(cookies.begin(), cookies.end(), res.cookie);
+        if (it == cookies.end())
+        {
+            log(kErr, "Fork server answered unknown request %u\n",
+                res.cookie);
+            if (pidFD != -1)
+                close(pidFD);
+            continue;
+        }
+        cookies.erase(it);
+        delegate->processSpawned(res.cookie, res.pid, pidFD, res.err);
+    }
+
+    /* descriptors no result claims */
+    for (; nextFD < pidFDs.size(); nextFD++)
+        close(pidFDs[nextFD]);
+    /* and requests no result answers, which the server could not parse */
+    for (uint32_t cookie : cookies)
+        delegate->processSpawned(cookie, 0, -1, EPROTO);
+
+    /* room was made for more requests */
+    flush();
+}
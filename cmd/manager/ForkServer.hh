@@ -0,0 +1,172 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef FORKSERVER_HH__
+#define FORKSERVER_HH__
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+
+struct ForkServerDelegate
+{
+    /**
+     * A spawn requested with ForkServer::spawn() has been carried out. \p pid
+     * is the process, which is our child; \p pidFD is a process descriptor for
+     * it, or -1 if the platform has none, and is ours to close.
+     *
+     * If \p err is nonzero, the process could not be spawned; \p pid is then
+     * a child which exited without exec'ing, still to be reaped, or 0.
+     */
+    virtual void processSpawned(uint32_t cookie, pid_t pid, int pidFD,
+                                int err) = 0;
+};
+
+/**
+ * A helper process, forked early while the manager is still small, which
+ * spawns processes on the manager's behalf so that the manager need never
+ * fork itself. The processes it spawns are made the manager's children rather
+ * than its own, so the manager waits on them as on any other child.
+ *
+ * Requests are batched. Those made with spawn() are sent together by flush(),
+ * which the manager calls once each event loop iteration, in one message over
+ * a socketpair; the results come back together in one message, along with a
+ * process descriptor for each process.
+ *
+ * Only supported on Linux, which alone can make a child its parent's.
+ */
+class ForkServer : public Handler, public Logger
+{
+    /**
+     * A message: the number of requests, then for each a Request, its argv
+     * and envp as consecutive NUL-terminated strings, the path of the
+     * cgroup.procs file it is to enter (if cgroupLen is nonzero), the name of
+     * the variable to set to its PID (if pidEnvLen is nonzero), and the
+     * descriptor numbers the FDs sent with the message are to have in the
+     * child. Results come back likewise, as a count and then a Result for
+     * each request.
+     */
+    struct Request
+    {
+        uint32_t cookie;
+        uint32_t argvLen;
+        uint32_t envpLen;
+        uint32_t cgroupLen;
+        uint32_t pidEnvLen;
+        uint32_t nFDs;
+    };
+
+    struct Result
+    {
+        uint32_t cookie;
+        int32_t pid;
+        int32_t err;
+        /** Whether a process descriptor for it is among those sent. */
+        int32_t hasPidFD;
+    };
+
+    struct Batch
+    {
+        std::vector<char> msg;
+        /** Duplicates of the FDs to send, closed once sent. */
+        std::vector<int> fds;
+        std::vector<uint32_t> cookies;
+    };
+
+    ForkServerDelegate *delegate;
+    EventLoop *loop;
+    pid_t pid = 0;
+    int fd = -1;
+
+    /** Batches to send, the last being added to. */
+    std::deque<Batch> batches;
+    /**
+     * Cookies of the requests sent and not yet answered, a vector for each
+     * message, in the order sent; the server answers them in that order.
+     */
+    std::deque<std::vector<uint32_t>> inFlight;
+
+    /** Serve requests on \p fd until the manager closes its end. */
+    static void serve(int fd);
+    /** Fail every request sent or batched, as the server is gone. */
+    void failAll(int err);
+    /** The server has gone; stop talking to it. */
+    void disconnect();
+
+    /* event handlers */
+    void fdEvent(EventLoop *loop, int fd, int revents);
+
+  public:
+    static const size_t kMaxBatchBytes = 65536;
+    /** Most requests, and so most FDs each way, in a message. */
+    static const size_t kMaxBatch = 64;
+    /** Most FDs sent in a message; Linux allows 253. */
+    static const size_t kMaxBatchFDs = 240;
+
+    ForkServer(Logger *parent, ForkServerDelegate *delegate, EventLoop *loop)
+        : Logger("forksrv", parent), delegate(delegate), loop(loop){};
+
+    /**
+     * Fork the server. This must be done before any thread is started, and
+     * after the event loop is initialised.
+     *
+     * @returns 0 if successful.
+     * @returns -ENOTSUP if not supported on this platform.
+     * @returns -errno if the server could not be started.
+     */
+    int start();
+
+    bool running() const
+    {
+        return fd != -1;
+    }
+    pid_t serverPID() const
+    {
+        return pid;
+    }
+    /** The server has exited, and been reaped. */
+    void serverExited();
+
+    /**
+     * Request a process be spawned, running \p argv with \p envp (NULL for
+     * the server's environment, which is the manager's as it was when the
+     * server was started.) The process begins a new session. \p fds are pairs
+     * of an FD of ours and the descriptor number it is to have in the child;
+     * they are duplicated, and so may be closed once this returns. If
+     * \p cgroupProcs is not NULL, the process enters that cgroup before exec;
+     * if \p pidEnv is not NULL, that variable is set to the process's PID.
+     *
+     * @returns 0 if the request was queued; the delegate is told the result.
+     * @returns -EPIPE if the server is not running.
+     * @returns -E2BIG if the request is too large to send.
+     * @returns -errno if an FD could not be duplicated.
+     */
+    int spawn(uint32_t cookie, char *const argv[], char *const envp[],
+              const std::vector<std::pair<int, int>> &fds,
+              const char *cgroupProcs, const char *pidEnv);
+
+    /** Send what requests are batched, so far as the socket allows. */
+    void flush();
+};
+
+#endif
@@ -0,0 +1,286 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include "Graph.hh"
+
+int ObjectDecl::depAdd(const std::string &key, const std::string &target,
+                       const std::string &type)
+{
+    static const char kPrefix[] = "dependency_";
+    static const struct
+    {
+        const char *name;
+        Edge::Kind kind;
+        bool reverse;
+    } kinds[] = {
+        {"requires", Edge::kRequires, false},
+        {"checks", Edge::kChecks, false},
+        {"conflicts", Edge::kConflicts, false},
+        {"after", Edge::kAfter, false},
+        {"before", Edge::kAfter, true},
+    };
+    size_t prefixLen = sizeof(kPrefix) - 1;
+    std::string kind;
+
+    /* the key is the prefix, the kind, and then the target's name */
+    if (key.compare(0, prefixLen, kPrefix) ||
+        key.size() < prefixLen + target.size() ||
+        key.compare(key.size() - target.size(), target.size(), target))
+        return -1;
+    kind = key.substr(prefixLen, key.size() - prefixLen - target.size());
+
+    for (auto &k : kinds)
+        if (kind == k.name)
+        {
+            /* a dependent's dependency runs the other way */
+            deps.push_back({k.kind, k.reverse != (type == "dependent"),
+                            target});
+            return 0;
+        }
+
+    return -1;
+}
+
+void Graph::marksReset()
+{
+    /* on wrapping around, old marks might be mistaken for new */
+    if (++generation == 0)
+    {
+        std::fill(marks.begin(), marks.end(), 0);
+        generation = 1;
+    }
+}
+
+void Graph::edgeAdd(Edge::Kind kind, ObjectIdx from, ObjectIdx to,
+                    ObjectIdx owner)
+{
+    int idx;
+
+    if (freeEdges != -1)
+    {
+        idx = freeEdges;
+        freeEdges = edges[idx].nextOut;
+    }
+    else
+    {
+        idx = edges.size();
+        edges.emplace_back();
+    }
+
+    edges[idx] = {kind, from, to, owner, objects[from].firstOut,
+                  objects[to].firstIn};
+    objects[from].firstOut = idx;
+    objects[to].firstIn = idx;
+}
+
+void Graph::edgesDeclaredDel(ObjectIdx obj)
+{
+    std::vector<int> doomed;
+
+    for (int e = objects[obj].firstOut; e != -1; e = edges[e].nextOut)
+        if (edges[e].owner == obj)
+            doomed.push_back(e);
+    /* an edge from obj to itself is on both lists */
+    for (int e = objects[obj].firstIn; e != -1; e = edges[e].nextIn)
+        if (edges[e].owner == obj && edges[e].from != obj)
+            doomed.push_back(e);
+
+    for (int e : doomed)
+    {
+        int *link;
+
+        for (link = &objects[edges[e].from].firstOut; *link != e;
+             link = &edges[*link].nextOut)
+            ;
+        *link = edges[e].nextOut;
+
+        for (link = &objects[edges[e].to].firstIn; *link != e;
+             link = &edges[*link].nextIn)
+            ;
+        *link = edges[e].nextIn;
+
+        edges[e].owner = -1;
+        edges[e].nextOut = freeEdges;
+        freeEdges = e;
+    }
+}
+
+ObjectIdx Graph::objectLookup(const std::string &name) const
+{
+    auto it = byName.find(name);
+    return it == byName.end() ? -1 : it->second;
+}
+
+ObjectIdx Graph::objectGetOrCreate(const std::string &name)
+{
+    auto it = byName.find(name);
+    ObjectIdx obj;
+
+    if (it != byName.end())
+        return it->second;
+
+    obj = objects.size();
+    objects.push_back({name, 0, -1, -1});
+    marks.push_back(0);
+    byName[name] = obj;
+    return obj;
+}
+
+ObjectIdx Graph::objectDeclare(const ObjectDecl &decl)
+{
+    ObjectIdx obj = objectGetOrCreate(decl.name);
+    int oldID = objects[obj].instanceID;
+
+    if (oldID != decl.instanceID)
+    {
+        if (oldID)
+            byInstanceID.erase(oldID);
+        byInstanceID[decl.instanceID] = obj;
+        objects[obj].instanceID = decl.instanceID;
+    }
+
+    edgesDeclaredDel(obj);
+    for (auto &dep : decl.deps)
+    {
+        ObjectIdx target = objectGetOrCreate(dep.target);
+
+        if (dep.reverse)
+            edgeAdd(dep.kind, target, obj, obj);
+        else
+            edgeAdd(dep.kind, obj, target, obj);
+    }
+
+    return obj;
+}
+
+void Graph::instanceForget(int instanceID)
+{
+    auto it = byInstanceID.find(instanceID);
+    ObjectIdx obj;
+
+    if (it == byInstanceID.end())
+        return;
+
+    obj = it->second;
+    byInstanceID.erase(it);
+    objects[obj].instanceID = 0;
+    edgesDeclaredDel(obj);
+}
+
+void Graph::closure(ObjectIdx obj, unsigned kindMask,
+                    std::vector<ObjectIdx> &out)
+{
+    std::vector<ObjectIdx> stack{obj};
+
+    marksReset();
+    while (!stack.empty())
+    {
+        ObjectIdx cur = stack.back();
+
+        stack.pop_back();
+        for (int e = objects[cur].firstOut; e != -1; e = edges[e].nextOut)
+        {
+            ObjectIdx to = edges[e].to;
+
+            if (!(kindMask & (1u << edges[e].kind)) || marks[to] == generation)
+                continue;
+
+            marks[to] = generation;
+            out.push_back(to);
+            stack.push_back(to);
+        }
+    }
+}
+
+void Graph::cycles(unsigned kindMask, std::vector<std::vector<ObjectIdx>> &out)
+{
+    /* Tarjan's algorithm, with an explicit stack in place of recursion */
+    size_t n = objects.size();
+    std::vector<int> index(n, -1);
+    std::vector<int> low(n);
+    std::vector<bool> onStack(n);
+    std::vector<ObjectIdx> stack;
+    /* the path being searched: each object, and the next edge to follow */
+    std::vector<std::pair<ObjectIdx, int>> path;
+    int next = 0;
+
+    for (ObjectIdx root = 0; root < (ObjectIdx)n; root++)
+    {
+        if (index[root] != -1)
+            continue;
+
+        index[root] = low[root] = next++;
+        stack.push_back(root);
+        onStack[root] = true;
+        path.emplace_back(root, objects[root].firstOut);
+
+        while (!path.empty())
+        {
+            ObjectIdx cur = path.back().first;
+            int e = path.back().second;
+            std::vector<ObjectIdx> scc;
+            bool selfLoop = false;
+            ObjectIdx member;
+
+            if (e != -1)
+            {
+                ObjectIdx to = edges[e].to;
+
+                path.back().second = edges[e].nextOut;
+                if (!(kindMask & (1u << edges[e].kind)))
+                    continue;
+
+                if (index[to] == -1)
+                {
+                    index[to] = low[to] = next++;
+                    stack.push_back(to);
+                    onStack[to] = true;
+                    path.emplace_back(to, objects[to].firstOut);
+                }
+                else if (onStack[to])
+                    low[cur] = std::min(low[cur], index[to]);
+                continue;
+            }
+
+            /* every edge of cur has been followed */
+            path.pop_back();
+            if (!path.empty())
+                low[path.back().first] =
+                    std::min(low[path.back().first], low[cur]);
+            if (low[cur] != index[cur])
+                continue;
+
+            do
+            {
+                member = stack.back();
+                stack.pop_back();
+                onStack[member] = false;
+                scc.push_back(member);
+            } while (member != cur);
+
+            for (e = objects[cur].firstOut; e != -1; e = edges[e].nextOut)
+                if (edges[e].to == cur && (kindMask & (1u << edges[e].kind)))
+                    selfLoop = true;
+
+            if (scc.size() > 1 || selfLoop)
+                out.push_back(std::move(scc));
+        }
+    }
+}
@@ -0,0 +1,207 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef GRAPH_HH__
+#define GRAPH_HH__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/** Index of an object in its graph. */
+typedef int ObjectIdx;
+
+/**
+ * A dependency of one object on another. Edges run from the dependent object
+ * to the object depended upon, whichever of the two declared it.
+ */
+struct Edge
+{
+    enum Kind
+    {
+        /** Starting the source object enqueues a start of the target. */
+        kRequires,
+        /** Verifying the source enqueues a verification of the target. */
+        kChecks,
+        /** Starting the source object enqueues a stop of the target. */
+        kConflicts,
+        /**
+         * The source object is started after, and stopped before, the
+         * target. A "before" dependency is an "after" edge the other way.
+         */
+        kAfter,
+        kMax,
+    };
+
+    Kind kind;
+    ObjectIdx from;
+    ObjectIdx to;
+    /**
+     * The object which declared the edge, be it \p from or \p to. When an
+     * object is redeclared, the edges it declared before are replaced.
+     */
+    ObjectIdx owner;
+    /**
+     * Next edge in \p from's list of outgoing edges and \p to's list of
+     * incoming edges, or -1. Free edges are chained through nextOut.
+     */
+    int nextOut;
+    int nextIn;
+};
+
+/** Make a mask of edge kinds for the traversals below. */
+#define EdgeMask(kind) (1u << Edge::kind)
+
+/**
+ * A node of the dependency graph: an instance, or a name some dependency
+ * refers to which is not (or is no longer) an instance in the repository.
+ */
+struct Object
+{
+    /**
+     * If B sets a propagation flag for its dependency on A, then the
+     * following happens: If B
+     */
+    enum PropagationFlags
+    {
+        /* If something bad happens (error in running a method, for
+         * example) then
+         */
+        kPropagateBad = 0x1,
+        kPropagateAny
+    };
+
+    /** Full name, type$service:instance; the type$ may be absent. */
+    std::string name;
+    /** ID of the instance in the persistent repository; 0 if none. */
+    int instanceID;
+    /** Heads of the lists of outgoing and incoming edges, or -1. */
+    int firstOut;
+    int firstIn;
+};
+
+/**
+ * An instance and the dependencies its bundle declares, as loaded from the
+ * repository. The declarations of the instance's service apply to it too.
+ */
+struct ObjectDecl
+{
+    struct Dep
+    {
+        Edge::Kind kind;
+        /** Whether the edge runs from the target to the declarer. */
+        bool reverse;
+        std::string target;
+    };
+
+    int instanceID;
+    std::string name;
+    std::vector<Dep> deps;
+
+    /**
+     * Add a dependency from a dependency_* property group. \p key is the
+     * group's key, "dependency_<kind><target>"; \p type, "dependency" or
+     * "dependent", is whether it was listed under depends or dependents.
+     *
+     * @returns 0 if successful.
+     * @returns -1 if the kind of dependency is not known.
+     */
+    int depAdd(const std::string &key, const std::string &target,
+               const std::string &type);
+};
+
+/**
+ * The dependency graph over objects. Objects and edges are held in flat
+ * arrays and refer to one another by index, each object heading intrusive
+ * lists of its outgoing and incoming edges; so the graph is compact, cheap to
+ * traverse, and may be updated an object at a time as bundles change.
+ *
+ * Belongs to the event loop thread.
+ */
+class Graph
+{
+    std::vector<Object> objects;
+    std::vector<Edge> edges;
+    /** Head of the list of free edges, or -1. */
+    int freeEdges = -1;
+    std::unordered_map<std::string, ObjectIdx> byName;
+    std::unordered_map<int, ObjectIdx> byInstanceID;
+
+    /**
+     * Scratch space for traversals, one entry per object. An object is
+     * marked by setting its entry to the traversal's generation, so that the
+     * marks need not be cleared between traversals.
+     */
+    std::vector<unsigned> marks;
+    unsigned generation = 0;
+
+    /** Begin a traversal, with every object unmarked. */
+    void marksReset();
+    void edgeAdd(Edge::Kind kind, ObjectIdx from, ObjectIdx to,
+                 ObjectIdx owner);
+    /** Remove every edge which \p obj declared. */
+    void edgesDeclaredDel(ObjectIdx obj);
+
+  public:
+    size_t size() const
+    {
+        return objects.size();
+    }
+    const Object &object(ObjectIdx obj) const
+    {
+        return objects[obj];
+    }
+    const Edge &edge(int edge) const
+    {
+        return edges[edge];
+    }
+
+    /** @returns the object of the given name, or -1. */
+    ObjectIdx objectLookup(const std::string &name) const;
+    /** @returns the object of the given name, created if need be. */
+    ObjectIdx objectGetOrCreate(const std::string &name);
+
+    /**
+     * Bring an object into line with its declaration, replacing the edges it
+     * declared before with those it declares now.
+     */
+    ObjectIdx objectDeclare(const ObjectDecl &decl);
+    /**
+     * Forget that an instance is in the repository, and remove the edges it
+     * declared. Its object remains, for the sake of any other object which
+     * still names it.
+     */
+    void instanceForget(int instanceID);
+
+    /**
+     * Find every object reachable from \p obj by edges of the kinds in \p
+     * kindMask, i.e. the transitive closure of those dependencies from \p obj.
+     * \p obj itself is included only if it is on a cycle.
+     */
+    void closure(ObjectIdx obj, unsigned kindMask,
+                 std::vector<ObjectIdx> &out);
+
+    /**
+     * Find the cycles among edges of the kinds in \p kindMask: each set of
+     * objects which all depend on one another, directly or not (a strongly
+     * connected component of more than one object, or of one which depends on
+     * itself.)
+     */
+    void cycles(unsigned kindMask, std::vector<std::vector<ObjectIdx>> &out);
+};
+
+#endif
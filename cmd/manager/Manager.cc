@@ -16,17 +16,130 @@ included with this software
 ********************************************************************/
 
 #include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/un.h>
+#include <sys/wait.h>
+#include <cerrno>
 #include <csignal>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <unistd.h>
 
 #include "Backend.hh"
 #include "Manager.hh"
+#include "eci/Core.h"
 #include "eci/Event.hh"
 
+extern char **environ;
+
 Manager gMgr;
 
+/**
+ * Loads the "listen" properties of instances, then binds the sockets they
+ * declare.
+ */
+class ListenLoadJob : public DBJob
+{
+    /** Names and IDs of the instances, and their sockets once loaded. */
+    std::vector<std::pair<std::string, int>> instances;
+    std::vector<std::pair<std::string, std::string>> listens;
+
+  public:
+    ListenLoadJob(const std::vector<ObjectDecl> &decls)
+    {
+        for (auto &decl : decls)
+            if (decl.instanceID)
+                instances.push_back({decl.name, decl.instanceID});
+    }
+
+    void run(Backend *bend)
+    {
+        for (auto &instance : instances)
+        {
+            std::map<std::string, std::string> props;
+
+            if (bend->persistentInstancePropertiesLoad(instance.second,
+                                                       props) == 0 &&
+                props.count("listen"))
+                listens.push_back({instance.first, props["listen"]});
+        }
+    }
+
+    void complete()
+    {
+        for (auto &listen : listens)
+        {
+            ObjectIdx obj = gMgr.graph.objectLookup(listen.first);
+
+            if (obj != -1)
+                gMgr.sockets.declare(obj, listen.second);
+        }
+    }
+};
+
+/** Loads dependencies from the repository into the manager's graph. */
+class DepsLoadJob : public DBJob
+{
+    int instanceID;
+    int res;
+    std::vector<ObjectDecl> decls;
+
+  public:
+    DepsLoadJob(int instanceID) : instanceID(instanceID){};
+
+    void run(Backend *bend)
+    {
+        res = bend->persistentDependenciesLoad(instanceID, decls);
+    }
+
+    void complete()
+    {
+        if (res != 0)
+            return;
+
+        /* an instance which is gone takes its declarations with it */
+        if (instanceID && decls.empty())
+            gMgr.graph.instanceForget(instanceID);
+        for (auto &decl : decls)
+            gMgr.graph.objectDeclare(decl);
+
+        gMgr.depsCyclesReport();
+        if (!decls.empty())
+            gMgr.bend.submit(new ListenLoadJob(decls));
+    }
+};
+
+/** Loads the properties of a task's instance, then starts its method. */
+class MethodLoadJob : public DBJob
+{
+    Transaction *tx;
+    int task;
+    int instanceID;
+    int res;
+    std::map<std::string, std::string> props;
+
+  public:
+    MethodLoadJob(Transaction *tx, int task, int instanceID)
+        : tx(tx), task(task), instanceID(instanceID){};
+
+    void run(Backend *bend)
+    {
+        res = bend->persistentInstancePropertiesLoad(instanceID, props);
+    }
+
+    void complete()
+    {
+        if (res != 0)
+        {
+            gMgr.states.stateSet(tx->tasks[task].obj, StateStore::kFailed);
+            gMgr.pendingDone(tx->tasks[task].obj, false);
+        }
+        else
+            gMgr.methodStart(tx, task, props);
+    }
+};
+
 void Manager::init(int argc, char *argv[])
 {
     int r = 0;
@@ -38,8 +151,13 @@ void Manager::init(int argc, char *argv[])
     const char *pathVolatileDb = NULL;
     const char *pathSocket;
     bool recreatePersistentDb = false;
+    bool forkServerEnabled = true;
+    bool cgroupsEnabled = true;
+    const char *cgroupRoot = NULL;
+    const char *pathNotify = NULL;
     bool readOnly = false;
     bool systemMode = false;
+    int backupIntervalSecs = 0;
 
 #define SetIf(condition)                                                       \
     if (condition == -1)                                                       \
@@ -49,6 +167,7 @@ void Manager::init(int argc, char *argv[])
 
     SetIf(loop.addSignal(this, SIGINT));
     SetIf(loop.addSignal(this, SIGUSR1));
+    SetIf(loop.addSignal(this, SIGCHLD));
 
     if (r == -1)
         die("Failed to initialise runloop.\n");
@@ -57,9 +176,20 @@ void Manager::init(int argc, char *argv[])
      * -c: delete any existing database at the given persistent DB path, and
      * create a new one instead. Do not try to start any targets. Used to create
      * a seed repository.
+     * -F: spawn processes directly, rather than through a fork server
+     * -G: do not place instances in cgroups
+     * -g <path>: the delegated cgroup (v2) subtree to place instances in;
+     * by default, the cgroup we were started in
+     * -j <class>=<n>: run at most <n> tasks at once on objects of type <class>
+     * (objects of no type are of class "default"); may be repeated
+     * -k <secs>: keep the volatile repository in-memory, and write a full
+     * backup of it to the volatile db path in the background every <secs>
+     * seconds; requires -q
+     * -N <path>: path at which to receive instances' sd_notify(3) notifications
      * -o: start ready, only try to go into read-write mode if later requested
      * -p <path>: permanent db path
      * -q <path>: volatile db path
+     * -R <n>: restart at most <n> instances a second in all (default 10)
      * -r: try reattachment (if not, any volatile DB at given path is deleted
      * and recreated)
      * -s: system mode (start readonly - try to open read-write later. UNLESS
@@ -67,18 +197,49 @@ void Manager::init(int argc, char *argv[])
      * -t <path>: path at which to create the listener socket
      */
 
-    while ((c = getopt(argc, argv, "cp:q:rst:")) != -1)
+    while ((c = getopt(argc, argv, "cFGg:j:k:N:p:q:R:rst:")) != -1)
         switch (c)
         {
         case 'c':
             recreatePersistentDb = true;
             break;
+        case 'F':
+            forkServerEnabled = false;
+            break;
+        case 'G':
+            cgroupsEnabled = false;
+            break;
+        case 'g':
+            cgroupRoot = optarg;
+            break;
+        case 'j':
+        {
+            const char *eq = strchr(optarg, '=');
+
+            if (!eq || eq == optarg || atoi(eq + 1) <= 0)
+                die("Invalid concurrency cap: %s\n", optarg);
+            sched.classCapSet(std::string(optarg, eq - optarg), atoi(eq + 1));
+            break;
+        }
+        case 'k':
+            backupIntervalSecs = atoi(optarg);
+            if (backupIntervalSecs <= 0)
+                die("Invalid backup interval: %s\n", optarg);
+            break;
+        case 'N':
+            pathNotify = optarg;
+            break;
         case 'p':
             pathPersistentDb = optarg;
             break;
         case 'q':
             pathVolatileDb = optarg;
             break;
+        case 'R':
+            if (atof(optarg) <= 0)
+                die("Invalid restart rate: %s\n", optarg);
+            restarter.sharedRateSet(atof(optarg));
+            break;
         case 'r':
             reattaching = true;
             break;
@@ -109,10 +270,25 @@ void Manager::init(int argc, char *argv[])
         die("Asked to reattach, but no path given for volatile repository.\n");
     if (!pathVolatileDb && !readOnly)
         die("No path given for volatile repository.\n");
+    if (!pathVolatileDb && backupIntervalSecs)
+        die("Asked to back up the volatile repository, but no path given "
+            "for it.\n");
 
     if (systemMode)
         readOnly = true;
 
+    /* the fork server must be born in our leaf of the subtree */
+    if (cgroupsEnabled && (r = cgroups.init(cgroupRoot)) != 0 &&
+        r != -ENOTSUP)
+        loge(kWarn, -r, "Failed to set up cgroups; not tracking instances");
+
+    /* while we are small, and before the backend starts its thread */
+    if (forkServerEnabled && (r = forkServer.start()) != 0 && r != -ENOTSUP)
+        loge(kWarn, -r, "Failed to start fork server; spawning directly");
+
+    if (pathNotify && (r = notifier.listen(pathNotify)) != 0)
+        loge(kWarn, -r, "Failed to set up notification socket %s", pathNotify);
+
     /* delete any old ECID socket */
     unlink(pathSocket);
 
@@ -142,7 +318,583 @@ void Manager::init(int argc, char *argv[])
     listener.addService({this, io_eComCloud_eci_IManagerVTable::handleReq});
 
     bend.init(pathPersistentDb, pathVolatileDb, readOnly, recreatePersistentDb,
-              reattaching);
+              reattaching, backupIntervalSecs);
+
+    depsRefresh(0);
+}
+
+void Manager::depsRefresh(int instanceID)
+{
+    bend.submit(new DepsLoadJob(instanceID));
+}
+
+int Manager::transactionSubmit(Task::Kind kind, const std::string &name,
+                               bool forgive)
+{
+    ObjectIdx obj = graph.objectLookup(name);
+    Transaction *tx;
+    int nTasks;
+
+    if (obj == -1 || !graph.object(obj).instanceID)
+        return -ENOENT;
+
+    tx = new Transaction;
+    if (kind == Task::kStart)
+        tx->objectStart(sched, graph, obj);
+    else
+        tx->objectStop(sched, graph, obj);
+
+    if (tx->order(graph, this) == -1)
+    {
+        delete tx;
+        return -ELOOP;
+    }
+
+    /* lest the start stall on a dependency given up on */
+    if (forgive)
+        for (auto &task : tx->tasks)
+            if (task.kind == Task::kStart)
+                restarter.reset(task.obj);
+
+    log(kInfo, "%s %s: transaction of %zu tasks\n",
+        kind == Task::kStart ? "starting" : "stopping", name.c_str(),
+        tx->tasks.size());
+
+    /* the transaction may finish, and be deleted, within submit() */
+    nTasks = tx->tasks.size();
+    transactions.push_back(tx);
+    sched.submit(tx);
+    return nTasks;
+}
+
+void Manager::taskRun(Transaction *tx, int task)
+{
+    Task &t = tx->tasks[task];
+
+    const Object &obj = graph.object(t.obj);
+    /* the transaction may finish, and be deleted, within taskDone() */
+    ObjectIdx idx = t.obj;
+    Task::Kind kind = t.kind;
+    auto pending = pendingTasks.find(idx);
+    pid_t main;
+
+    log(kDebug, "%s %s\n", kind == Task::kStart ? "start" : "stop",
+        obj.name.c_str());
+
+    /* another transaction is already starting or stopping it */
+    if (pending != pendingTasks.end())
+    {
+        const auto &other = pending->second;
+
+        if (other.first->tasks[other.second].kind == kind)
+        {
+            joinedTasks[idx].push_back({tx, task});
+            return;
+        }
+        /* a start has spawned it, and waits only on its readiness */
+        else if (kind == Task::kStop && readyAwaited.count(idx))
+        {
+            readyDone(idx, false);
+            /* those queued behind the start may have run meanwhile */
+            taskRun(tx, task);
+        }
+        else
+            queuedTasks[idx].push_back({tx, task});
+        return;
+    }
+
+    main = states.mainPID(idx);
+
+    if (kind == Task::kStart)
+    {
+        /* an object which is no instance, or is online, has nothing to do */
+        if (!obj.instanceID || states.state(idx) == StateStore::kOnline)
+            sched.taskDone(tx, task, true);
+        /*
+         * nor has one activated by its sockets, until they see activity; one
+         * already listening has them watched again, should they have been
+         * left unwatched when it failed to start on activity
+         */
+        else if (sockets.has(idx) && !activated.count(idx))
+        {
+            socketsListen(idx);
+            sched.taskDone(tx, task, true);
+        }
+        else
+        {
+            activated.erase(idx);
+            states.stateSet(idx, StateStore::kStarting);
+            pendingTasks[idx] = {tx, task};
+            bend.submit(new MethodLoadJob(tx, task, obj.instanceID));
+        }
+        return;
+    }
+
+    restarter.cancel(idx);
+    sockets.unwatch(idx);
+
+    if (!main)
+    {
+        states.stateSet(idx, StateStore::kOffline);
+        sched.taskDone(tx, task, true);
+    }
+    else
+    {
+        states.stateSet(idx, StateStore::kStopping);
+        pendingTasks[idx] = {tx, task};
+        processSignal(main, SIGTERM);
+    }
+}
+
+void Manager::methodStart(Transaction *tx, int task,
+                          const std::map<std::string, std::string> &props)
+{
+    ObjectIdx obj = tx->tasks[task].obj;
+    auto exec = props.find("exec");
+    auto notify = props.find("notify");
+    int r;
+
+    if (exec == props.end())
+    {
+        states.stateSet(obj, StateStore::kOnline);
+        pendingDone(obj, true);
+        return;
+    }
+
+    restarter.processStarted(
+        obj, RestartPolicy(props, graph.object(obj).name, this));
+
+    /* it is online only once it says it is ready */
+    if (notify != props.end() && notify->second == "true")
+    {
+        if (!notifier.socketPath().empty())
+            readyAwaited.insert(obj);
+        else
+            log(kWarn, "%s: awaits notification, but none can be received; "
+                       "taking it as ready once spawned\n",
+                graph.object(obj).name.c_str());
+    }
+
+    r = processSpawn(obj, exec->second);
+    if (r != 0)
+    {
+        loge(kErr, -r, "%s: failed to spawn", graph.object(obj).name.c_str());
+        readyAwaited.erase(obj);
+        states.stateSet(obj, StateStore::kFailed);
+        pendingDone(obj, false);
+    }
+}
+
+int Manager::processSpawn(ObjectIdx obj, const std::string &cmd)
+{
+    char **argv = eciArgvBuild(cmd.c_str());
+    ECISpawnAttr attr;
+    std::string procs;
+    const char *cgroupProcs = NULL;
+    std::vector<std::pair<int, int>> fds;
+    std::vector<ECISpawnFDAction> actions;
+    std::vector<std::string> env;
+    std::vector<char *> envp;
+    pid_t pid;
+    int r;
+
+    if (!argv)
+        return -ENOMEM;
+    else if (!argv[0])
+    {
+        free(argv);
+        return -EINVAL;
+    }
+
+    if (cgroups.enabled())
+    {
+        r = cgroups.procsPath(obj, procs);
+        if (r == 0)
+            cgroupProcs = procs.c_str();
+        else
+            loge(kWarn, -r, "%s: failed to create cgroup",
+                 graph.object(obj).name.c_str());
+    }
+
+    /* socket-activated, it is given its sockets, and told of them */
+    sockets.spawnArgs(obj, fds, env);
+    if (!notifier.socketPath().empty())
+        env.push_back("NOTIFY_SOCKET=" + notifier.socketPath());
+    if (!env.empty())
+    {
+        /* those we were given are not for it */
+        for (char **var = environ; *var; var++)
+            if (strncmp(*var, "LISTEN_", 7) != 0 &&
+                strncmp(*var, "NOTIFY_SOCKET=", 14) != 0)
+                envp.push_back(*var);
+        for (auto &var : env)
+            envp.push_back(&var[0]);
+        envp.push_back(NULL);
+    }
+
+    if (forkServer.running())
+        r = forkServer.spawn(obj, argv, envp.empty() ? NULL : envp.data(),
+                             fds, cgroupProcs,
+                             fds.empty() ? NULL : "LISTEN_PID");
+    else
+    {
+        for (auto &fdPair : fds)
+            actions.push_back({ECISpawnFDAction::kECISpawnDup, fdPair.first,
+                               fdPair.second, NULL, 0, 0});
+
+        memset(&attr, 0, sizeof(attr));
+        attr.argv = argv;
+        attr.envp = envp.empty() ? NULL : envp.data();
+        attr.fdActions = actions.data();
+        attr.nFDActions = actions.size();
+        attr.newSession = 1;
+        attr.cgroupProcs = cgroupProcs;
+        attr.pidEnv = fds.empty() ? NULL : "LISTEN_PID";
+        r = eciSpawn(&attr, &pid);
+        if (r == 0)
+            processSpawned(obj, pid, -1, 0);
+    }
+
+    free(argv);
+    return r;
+}
+
+void Manager::processSpawned(uint32_t cookie, pid_t pid, int pidFD, int err)
+{
+    ObjectIdx obj = cookie;
+    auto pending = pendingTasks.find(obj);
+    auto unclaimed = exitsUnclaimed.find(pid);
+    std::pair<Transaction *, int> task(NULL, -1);
+
+    if (pending != pendingTasks.end() &&
+        pending->second.first->tasks[pending->second.second].kind ==
+            Task::kStart)
+        task = pending->second;
+
+    if (err)
+    {
+        loge(kErr, err, "%s: failed to spawn", graph.object(obj).name.c_str());
+        states.stateSet(obj, StateStore::kFailed);
+        readyAwaited.erase(obj);
+        /* a child which failed to exec is ours to reap, and may have been */
+        if (unclaimed != exitsUnclaimed.end())
+            exitsUnclaimed.erase(unclaimed);
+        else if (pid > 0)
+            spawnsFailed.insert(pid);
+    }
+    else
+    {
+        log(kInfo, "%s: started as PID %d\n", graph.object(obj).name.c_str(),
+            (int)pid);
+        processes[pid] = {obj, pidFD};
+        states.mainPIDSet(obj, pid);
+        if (!readyAwaited.count(obj))
+            states.stateSet(obj, StateStore::kOnline);
+    }
+
+    if (task.first && !err)
+        sched.taskForked(task.first, task.second);
+
+    /*
+     * one which is to notify us holds its task till it is ready, unless a
+     * stop for it came meanwhile
+     */
+    if (task.first && !err && readyAwaited.count(obj))
+    {
+        if (readyUnclaimed.erase(pid))
+        {
+            log(kInfo, "%s: ready\n", graph.object(obj).name.c_str());
+            states.stateSet(obj, StateStore::kOnline);
+            readyDone(obj, true);
+        }
+        else if (queuedTasks.count(obj))
+            readyDone(obj, false);
+    }
+    else if (task.first)
+        pendingDone(obj, !err);
+
+    /* it may have exited, and been reaped, before we were told of it */
+    if (!err && unclaimed != exitsUnclaimed.end())
+    {
+        int wstat = unclaimed->second;
+
+        exitsUnclaimed.erase(unclaimed);
+        processExited(pid, wstat);
+    }
+}
+
+void Manager::processSignal(pid_t pid, int signum)
+{
+    auto it = processes.find(pid);
+
+#ifdef SYS_pidfd_send_signal
+    if (it != processes.end() && it->second.pidFD != -1 &&
+        syscall(SYS_pidfd_send_signal, it->second.pidFD, signum, NULL, 0) ==
+            0)
+        return;
+#endif
+    if (kill(pid, signum) == -1)
+        loge(kWarn, errno, "Failed to signal PID %d", (int)pid);
+}
+
+void Manager::processesReap()
+{
+    pid_t pid;
+    int wstat;
+
+    while ((pid = waitpid(-1, &wstat, WNOHANG)) > 0)
+        if (pid == forkServer.serverPID())
+            forkServer.serverExited();
+        else if (processes.count(pid))
+            processExited(pid, wstat);
+        else if (!spawnsFailed.erase(pid))
+            exitsUnclaimed[pid] = wstat;
+}
+
+void Manager::processExited(pid_t pid, int wstat)
+{
+    auto it = processes.find(pid);
+    ObjectIdx obj = it->second.obj;
+    bool wasMain = states.mainPID(obj) == pid;
+    bool lingering = false;
+    bool unready = wasMain && readyAwaited.count(obj);
+    int r;
+
+    if (it->second.pidFD != -1)
+        close(it->second.pidFD);
+    processes.erase(it);
+    if (wasMain)
+        states.mainPIDSet(obj, 0);
+
+    auto pending = pendingTasks.find(obj);
+
+    if (WIFSIGNALED(wstat))
+        log(eciExitWasAbnormal(wstat) ? kWarn : kInfo,
+            "%s: PID %d killed by signal %d\n", graph.object(obj).name.c_str(),
+            (int)pid, WTERMSIG(wstat));
+    else
+        log(eciExitWasAbnormal(wstat) ? kWarn : kInfo,
+            "%s: PID %d exited with status %d\n",
+            graph.object(obj).name.c_str(), (int)pid, WEXITSTATUS(wstat));
+
+    /* what it leaves behind in its cgroup goes with it */
+    if (wasMain && cgroups.populated(obj))
+    {
+        log(kInfo, "%s: killing processes left in its cgroup\n",
+            graph.object(obj).name.c_str());
+        if ((r = cgroups.kill(obj)) != 0)
+            loge(kWarn, -r, "%s: failed to kill processes left in its cgroup",
+                 graph.object(obj).name.c_str());
+        else
+            lingering = true;
+    }
+
+    if (pending != pendingTasks.end() &&
+        pending->second.first->tasks[pending->second.second].kind ==
+            Task::kStop)
+    {
+        /* if any linger, cgroupEmptied() finishes it once they are gone */
+        if (!lingering)
+            stopDone(obj);
+    }
+    else if (wasMain)
+    {
+        states.stateSet(obj, eciExitWasAbnormal(wstat) ? StateStore::kFailed
+                                                       : StateStore::kOffline);
+        restarter.processExited(obj, wstat);
+        /* one which failed listens again only if it is restarted */
+        if (states.state(obj) == StateStore::kOffline && sockets.has(obj))
+            socketsListen(obj);
+    }
+
+    /* last, as a stop queued behind its start runs now */
+    if (unready)
+    {
+        log(kWarn, "%s: exited before it was ready\n",
+            graph.object(obj).name.c_str());
+        readyDone(obj, false);
+    }
+}
+
+void Manager::pendingDone(ObjectIdx obj, bool ok)
+{
+    auto pending = pendingTasks.find(obj);
+    auto joined = joinedTasks.find(obj);
+    auto queued = queuedTasks.find(obj);
+    std::vector<std::pair<Transaction *, int>> done(1, pending->second);
+    std::vector<std::pair<Transaction *, int>> next;
+
+    pendingTasks.erase(pending);
+    if (joined != joinedTasks.end())
+    {
+        done.insert(done.end(), joined->second.begin(), joined->second.end());
+        joinedTasks.erase(joined);
+    }
+    if (queued != queuedTasks.end())
+    {
+        next.swap(queued->second);
+        queuedTasks.erase(queued);
+    }
+
+    /* finishing these may run others for it, which those queued follow */
+    for (auto &task : done)
+        sched.taskDone(task.first, task.second, ok);
+    for (auto &task : next)
+        taskRun(task.first, task.second);
+}
+
+void Manager::stopDone(ObjectIdx obj)
+{
+    states.stateSet(obj, StateStore::kOffline);
+    pendingDone(obj, true);
+}
+
+void Manager::readyDone(ObjectIdx obj, bool ok)
+{
+    readyAwaited.erase(obj);
+    /* with none awaited, any still unclaimed were never ours */
+    if (readyAwaited.empty())
+        readyUnclaimed.clear();
+    pendingDone(obj, ok);
+}
+
+void Manager::notifyReceived(SDNotifyMsg &msg)
+{
+    auto it = processes.find(msg.pid);
+    ObjectIdx obj;
+    const char *name;
+
+    if (it == processes.end())
+    {
+        /* it may be ready before we are told it was spawned */
+        if (msg.ready && !readyAwaited.empty())
+            readyUnclaimed.insert(msg.pid);
+        else
+            log(kDebug, "Ignoring notification from PID %d, not ours\n",
+                (int)msg.pid);
+        return;
+    }
+    obj = it->second.obj;
+    name = graph.object(obj).name.c_str();
+
+    /* we can track only our own children */
+    if (msg.mainPID && msg.mainPID != msg.pid)
+        log(kWarn, "%s: ignoring main PID %d, not our child\n", name,
+            (int)msg.mainPID);
+    if (msg.status)
+        log(kInfo, "%s: status: %s\n", name, msg.status);
+    if (msg.errnum)
+        log(kInfo, "%s: reports error: %s\n", name, strerror(msg.errnum));
+    if (msg.reloading)
+        log(kInfo, "%s: reloading\n", name);
+    if (msg.stopping)
+        log(kInfo, "%s: stopping\n", name);
+    /* FDs are not yet stored for it; they are closed once we return */
+    if (msg.fdStore && msg.nFDs)
+        log(kWarn, "%s: cannot store %zu FDs; closing them\n", name,
+            msg.nFDs);
+
+    if (msg.ready && readyAwaited.count(obj) && states.mainPID(obj) == msg.pid)
+    {
+        log(kInfo, "%s: ready\n", name);
+        states.stateSet(obj, StateStore::kOnline);
+        readyDone(obj, true);
+    }
+}
+
+void Manager::socketsListen(ObjectIdx obj)
+{
+    states.stateSet(obj, StateStore::kListening);
+    sockets.watch(obj);
+}
+
+void Manager::socketActivity(ObjectIdx obj)
+{
+    int r;
+
+    /* it may have been started, or stopped, meanwhile */
+    if (states.state(obj) != StateStore::kListening)
+        return;
+
+    log(kInfo, "%s: activated by its sockets\n",
+        graph.object(obj).name.c_str());
+    activated.insert(obj);
+    r = transactionSubmit(Task::kStart, graph.object(obj).name);
+    if (r < 0)
+    {
+        /*
+         * its sockets are left unwatched until it is next started, lest the
+         * activity still waiting on them wake us again at once
+         */
+        loge(kErr, -r, "%s: failed to start on activation",
+             graph.object(obj).name.c_str());
+        activated.erase(obj);
+    }
+}
+
+void Manager::cgroupEmptied(ObjectIdx obj)
+{
+    auto pending = pendingTasks.find(obj);
+
+    /* a stop waits on its main process's exit too, which we may yet reap */
+    if (pending != pendingTasks.end() &&
+        pending->second.first->tasks[pending->second.second].kind ==
+            Task::kStop &&
+        !states.mainPID(obj))
+        stopDone(obj);
+}
+
+void Manager::restartDue(ObjectIdx obj)
+{
+    int r;
+
+    /* it may have been started, or be starting or stopping, meanwhile */
+    if (states.state(obj) != StateStore::kFailed &&
+        states.state(obj) != StateStore::kOffline)
+        return;
+
+    r = transactionSubmit(Task::kStart, graph.object(obj).name);
+    if (r < 0)
+        loge(kErr, -r, "%s: failed to restart", graph.object(obj).name.c_str());
+}
+
+void Manager::transactionDone(Transaction *tx)
+{
+    size_t nFailed = 0;
+
+    for (auto &task : tx->tasks)
+        if (task.state == Task::kFailed)
+        {
+            log(kErr, "%s %s failed\n",
+                task.kind == Task::kStart ? "start" : "stop",
+                graph.object(task.obj).name.c_str());
+            nFailed++;
+        }
+
+    log(kInfo, "transaction finished: %zu of %zu tasks failed\n", nFailed,
+        tx->tasks.size());
+
+    if (timeline.transactionRecord(graph, sched, *tx) == -1)
+        log(kDebug, "timeline is full; transaction not recorded\n");
+
+    transactions.remove(tx);
+    delete tx;
+}
+
+void Manager::depsCyclesReport()
+{
+    std::vector<std::vector<ObjectIdx>> cycles;
+
+    graph.cycles(EdgeMask(kAfter), cycles);
+    for (auto &cycle : cycles)
+    {
+        std::string names;
+
+        for (ObjectIdx obj : cycle)
+            names += (names.empty() ? "" : ", ") + graph.object(obj).name;
+        log(kWarn, "Ordering dependencies form a cycle among: %s\n",
+            names.c_str());
+    }
 }
 
 void Manager::run()
@@ -150,8 +902,17 @@ void Manager::run()
     while (shouldRun)
     {
         loop.loop(NULL);
+        /* usage read from cgroups is good until the next iteration */
+        cgroups.tickNext();
+        /* send together the spawns of all that was done this iteration */
+        forkServer.flush();
     }
 
+    /*
+     * the backend runs what jobs are outstanding before shutting down, the
+     * write of the last states behind any write still in flight
+     */
+    states.flush(true);
     bend.shutdown();
 }
 
@@ -168,6 +929,10 @@ void Manager::signalEvent(EventLoop *loop, int signum)
         log(kInfo, "Shutting down in response to SIGINT.\n");
         shouldRun = false;
     }
+    else if (signum == SIGUSR1)
+        bend.requestReadWrite();
+    else if (signum == SIGCHLD)
+        processesReap();
     else
         printf("Got signal %d\n", signum);
 }
@@ -187,6 +952,11 @@ void Manager::clientDisconnected(WSRPCTransport *xprt)
         loge(kErr, -r,
              "Failed to delete event source for disconnected client FD %d\n",
              xprt->fd);
+
+    /* replies to their outstanding requests now have nowhere to go */
+    for (auto job : rpcJobs)
+        if (job->xprt == xprt)
+            job->xprt = NULL;
 }
 
 int main(int argc, char *argv[])
@@ -19,80 +19,71 @@ included with this software
 #define ECI_MANAGER_HH
 
 #include <list>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "Backend.hh"
+#include "CGroups.hh"
+#include "ForkServer.hh"
+#include "Graph.hh"
+#include "Restarter.hh"
+#include "Scheduler.hh"
+#include "Sockets.hh"
+#include "StateStore.hh"
+#include "Timeline.hh"
 #include "eci/Event.hh"
+#include "eci/SDNotify.hh"
 #include "eci/WSRPC.hh"
 #include "io.eComCloud.eci.IManager.hh"
 
-class Object
+/**
+ * A repository job carried out on behalf of an RPC request. The reply to the
+ * request is deferred until the job is complete, and is then sent, if the
+ * client is still connected.
+ */
+class RPCJob : public DBJob
 {
-    /**
-     * If B sets a propagation flag for its dependency on A, then the
-     * following happens: If B
-     */
-    enum PropagationFlags
-    {
-        /* If something bad happens (error in running a method, for
-         * example) then
-         */
-        kPropagateBad = 0x1,
-        kPropagateAny
-    };
+    friend class Manager;
 
-    /**
-     * These are the enqueuers. They simply cause an appropriate job to be
-     * enqueued.
-     */
-    std::list<Object *> start;
-    std::list<Object *> verifyOnline;
-    std::list<Object *> stop;
+  protected:
+    /** Transport to reply on. Set to NULL if the client disconnects. */
+    WSRPCTransport *xprt;
+    int reqID;
 
-    /* These are the ordering directives. */
-    std::list<Object *> after;
-    std::list<Object *> before;
+  public:
+    RPCJob(WSRPCReq *req);
 
-    /* These are the event subscriptions. When the cited object emits the
-     * given event, then this object will carry out the given action. */
+    /** Make the result to reply with. Called on the event loop thread. */
+    virtual ucl_object_t *result() = 0;
+    void complete();
 };
 
-struct Task
+class Manager : public Handler,
+                public Logger,
+                io_eComCloud_eci_IManagerVTable,
+                WSRPCListenerDelegate,
+                SchedulerDelegate,
+                ForkServerDelegate,
+                RestarterDelegate,
+                CGroupsDelegate,
+                SocketsDelegate,
+                SDNotifyDelegate
 {
-    enum State
-    {
-        /** Action not yet dispatched, likely waiting for a dependent
-           action. */
-        kWaiting,
-        /** Action is currently running. */
-        kRunning,
-        /** Action successfully completed. */
-        kComplete,
-        /** Action failed. */
-        kFailed
-    };
+    friend class RPCJob;
+    friend class DepsLoadJob;
+    friend class MethodLoadJob;
+    friend class ListenLoadJob;
 
-    enum Kind
+    /** A process of an object's, spawned by us and not yet reaped. */
+    struct Process
     {
-        kStart,
-        /* Halt this */
-        kStop,
+        ObjectIdx obj;
+        /** Process descriptor, or -1. */
+        int pidFD;
     };
 
-    /** The object of this transaction */
-    Object *obj;
-    /** State of the transaction */
-    State state;
-};
-
-struct Transaction
-{
-};
-
-class Manager : public Handler,
-                public Logger,
-                io_eComCloud_eci_IManagerVTable,
-                WSRPCListenerDelegate
-{
     EventLoop loop;
     Backend bend;
     WSRPCListener listener;
@@ -120,14 +111,144 @@ class Manager : public Handler,
      *
      * - only after runlevel$early-init has come up do we then target
      * runlevel$default.
+     *
+     * The backend is told to enter read-write mode by SIGUSR1, which the
+     * early-init services should send once the root filesystem is writable.
      */
     bool systemMode = false;
 
+    /** RPC jobs submitted to the backend and yet to complete. */
+    std::list<RPCJob *> rpcJobs;
+
+    /** Dependencies between instances, as declared in the repository. */
+    Graph graph;
+    Scheduler sched;
+    /** Transactions submitted to the scheduler and yet to finish. */
+    std::list<Transaction *> transactions;
+    /** When the tasks of finished transactions ran, chiefly those of boot. */
+    Timeline timeline;
+
+    ForkServer forkServer;
+    std::unordered_map<pid_t, Process> processes;
+    /** The state and main process of each object. */
+    StateStore states;
+    /**
+     * The task of each object which is starting or stopping it: a start from
+     * when its method is loaded until its process has been spawned (and, if
+     * it is to notify us, is ready), or a stop until its process exits.
+     */
+    std::unordered_map<ObjectIdx, std::pair<Transaction *, int>> pendingTasks;
+    /**
+     * Tasks which came for an object while another was pending for it. Those
+     * of the same kind finish along with it; those of the other kind are run
+     * once it has finished.
+     */
+    std::unordered_map<ObjectIdx, std::vector<std::pair<Transaction *, int>>>
+        joinedTasks, queuedTasks;
+    /**
+     * Wait statuses of children reaped before the fork server told us of
+     * them, by PID.
+     */
+    std::unordered_map<pid_t, int> exitsUnclaimed;
+    /** Children whose spawns failed, to be reaped without being claimed. */
+    std::unordered_set<pid_t> spawnsFailed;
+    /** Restarts instances whose main processes exit unbidden. */
+    Restarter restarter;
+    /**
+     * The cgroup of each instance, if enabled. A stop then waits on its
+     * instance's cgroup emptying, not only on its main process exiting.
+     */
+    CGroups cgroups;
+    /** The listening sockets of socket-activated instances. */
+    Sockets sockets;
+    /**
+     * Socket-activated instances which saw activity, to be started in earnest
+     * rather than left listening.
+     */
+    std::unordered_set<ObjectIdx> activated;
+    /** Receives the sd_notify(3) notifications of instances, if enabled. */
+    SDNotifyServer notifier;
+    /**
+     * Instances with the "notify" property whose main processes have been
+     * spawned but have yet to send READY=1. Their start tasks stay pending
+     * until they do, or exit.
+     */
+    std::unordered_set<ObjectIdx> readyAwaited;
+    /** PIDs which sent READY=1 before the fork server told us of them. */
+    std::unordered_set<pid_t> readyUnclaimed;
+
     /** Initialise the backend. */
     void backendInit();
 
+    /** Submit an RPC job to the backend. */
+    void rpcJobSubmit(RPCJob *job);
+
+    /**
+     * Reload from the repository the dependencies an instance declares, or
+     * those of every instance if \p instanceID is 0, and update the graph.
+     * Cycles among ordering dependencies are reported once it is updated.
+     */
+    void depsRefresh(int instanceID);
+    /** Log each cycle among the graph's ordering dependencies. */
+    void depsCyclesReport();
+
+    /**
+     * Start or stop the instance \p name in a new transaction, along with
+     * whatever its dependencies require. If \p forgive, as when asked to
+     * start it explicitly, it and every object the transaction starts with it
+     * are forgiven whatever restarts they used up.
+     *
+     * @returns the number of tasks in the transaction.
+     * @returns -ENOENT if there is no such instance.
+     * @returns -ELOOP if the tasks' ordering is cyclic.
+     */
+    int transactionSubmit(Task::Kind kind, const std::string &name,
+                          bool forgive = false);
+
+    /**
+     * Start the main process of a task's object, running the command given by
+     * its "exec" property. The task is done once the process has been spawned,
+     * or at once if there is no such property.
+     */
+    void methodStart(Transaction *tx, int task,
+                     const std::map<std::string, std::string> &props);
+    /**
+     * Spawn a process for \p obj running \p cmd, through the fork server if
+     * it is running. processSpawned() is called with the result, unless this
+     * fails.
+     *
+     * @returns 0 if successful.
+     * @returns -errno if the process could not be spawned.
+     */
+    int processSpawn(ObjectIdx obj, const std::string &cmd);
+    /** Send a signal to a process of ours, by its descriptor if it has one. */
+    void processSignal(pid_t pid, int signum);
+    /** Reap every child which has exited. */
+    void processesReap();
+    /** A process of ours has exited, with the wait status \p wstat. */
+    void processExited(pid_t pid, int wstat);
+    /**
+     * Mark the pending task of \p obj done with \p ok, along with those
+     * joined to it, then run those queued behind it.
+     */
+    void pendingDone(ObjectIdx obj, bool ok);
+    /** Mark the pending stop task of \p obj done, as it is now offline. */
+    void stopDone(ObjectIdx obj);
+    /** Leave \p obj listening on its sockets, to be started on activity. */
+    void socketsListen(ObjectIdx obj);
+    /**
+     * Stop awaiting the readiness of \p obj, marking its pending start task
+     * done with \p ok. Its state is left to the caller.
+     */
+    void readyDone(ObjectIdx obj, bool ok);
+
   public:
-    Manager() : Logger("mgr"), bend(this), listener(this){};
+    Manager()
+        : Logger("mgr"), bend(this, &loop), listener(this), sched(this, this),
+          forkServer(this, this, &loop), states(this, &bend, &loop, &graph),
+          restarter(this, this, &loop, &graph),
+          cgroups(this, this, &loop, &graph),
+          sockets(this, this, &loop, &graph), notifier(this, this, &loop){};
 
     void init(int argc, char *argv[]);
     void run();
@@ -137,6 +258,10 @@ class Manager : public Handler,
     bool subscribe_v1(WSRPCReq *req, std::string *rval, int hello);
     bool snapshot_v1(WSRPCReq *req, int *rval, int instanceID,
                      std::string name);
+    bool start_v1(WSRPCReq *req, int *rval, std::string name);
+    bool stop_v1(WSRPCReq *req, int *rval, std::string name);
+    bool profile_v1(WSRPCReq *req, std::string *rval, int format);
+    bool usage_v1(WSRPCReq *req, InstanceUsage *rval, std::string name);
 
     /* event handlers */
     void fdEvent(EventLoop *loop, int fd, int revents);
@@ -145,6 +270,25 @@ class Manager : public Handler,
     /* WSRPC delegate methods */
     void clientConnected(WSRPCTransport *xprt);
     void clientDisconnected(WSRPCTransport *xprt);
+
+    /* scheduler delegate methods */
+    void taskRun(Transaction *tx, int task);
+    void transactionDone(Transaction *tx);
+
+    /* fork server delegate methods */
+    void processSpawned(uint32_t cookie, pid_t pid, int pidFD, int err);
+
+    /* restarter delegate methods */
+    void restartDue(ObjectIdx obj);
+
+    /* cgroups delegate methods */
+    void cgroupEmptied(ObjectIdx obj);
+
+    /* sockets delegate methods */
+    void socketActivity(ObjectIdx obj);
+
+    /* notification delegate methods */
+    void notifyReceived(SDNotifyMsg &msg);
 };
 
 extern Manager gMgr;
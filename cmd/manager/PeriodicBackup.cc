@@ -0,0 +1,173 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <system_error>
+#include <unistd.h>
+
+#include "PeriodicBackup.hh"
+#include "sqlite3.h"
+
+/**
+ * Pages copied per backup step. The source database is locked for each step,
+ * so this bounds how long the DB worker might wait on the backup thread.
+ */
+static const int kBackupPages = 32;
+
+int PeriodicBackup::backUp()
+{
+    sqlite3 *connDst = NULL;
+    sqlite3_backup *backup;
+    int changes = sqlite3_total_changes(connSrc);
+    int res;
+
+    if (changes == lastChanges)
+        return 0;
+
+    if (unlink(pathTemp.c_str()) == -1 && errno != ENOENT)
+    {
+        loge(kErr, errno, "Failed to delete stale backup %s",
+             pathTemp.c_str());
+        return -1;
+    }
+
+    res = sqlite3_open_v2(pathTemp.c_str(), &connDst,
+                          SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                              SQLITE_OPEN_FULLMUTEX,
+                          NULL);
+    if (res != SQLITE_OK)
+    {
+        log(kErr, "Failed to create backup %s: %s\n", pathTemp.c_str(),
+            sqlite3_errmsg(connDst));
+        goto fail;
+    }
+
+    backup = sqlite3_backup_init(connDst, "main", connSrc, "main");
+    if (!backup)
+    {
+        log(kErr, "Failed to begin backup: %s\n", sqlite3_errmsg(connDst));
+        goto fail;
+    }
+
+    do
+    {
+        res = sqlite3_backup_step(backup, kBackupPages);
+        /* let the DB worker at the database between steps */
+        if (res == SQLITE_BUSY || res == SQLITE_LOCKED)
+            sqlite3_sleep(5);
+        else
+            std::this_thread::yield();
+    } while (res == SQLITE_OK || res == SQLITE_BUSY || res == SQLITE_LOCKED);
+
+    sqlite3_backup_finish(backup);
+
+    if (res != SQLITE_DONE)
+    {
+        log(kErr, "Failed to write backup: %s\n", sqlite3_errstr(res));
+        goto fail;
+    }
+
+    sqlite3_close(connDst);
+    connDst = NULL;
+
+    if (rename(pathTemp.c_str(), path.c_str()) == -1)
+    {
+        loge(kErr, errno, "Failed to rename backup into place at %s",
+             path.c_str());
+        goto fail;
+    }
+
+    lastChanges = changes;
+    return 0;
+
+fail:
+    sqlite3_close(connDst);
+    unlink(pathTemp.c_str());
+    return -1;
+}
+
+void PeriodicBackup::run()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+
+    while (shouldRun)
+    {
+        cond.wait_for(lock, std::chrono::seconds(intervalSecs),
+                      [this] { return !shouldRun || requested; });
+
+        if (!shouldRun)
+            break;
+
+        requested = false;
+
+        lock.unlock();
+        backUp();
+        lock.lock();
+    }
+}
+
+int PeriodicBackup::start(sqlite3 *conn, const char *aPath, int aIntervalSecs)
+{
+    connSrc = conn;
+    path = aPath;
+    pathTemp = path + ".backup";
+    intervalSecs = aIntervalSecs;
+    lastChanges = -1;
+    shouldRun = true;
+
+    try
+    {
+        thread = std::thread(&PeriodicBackup::run, this);
+    }
+    catch (std::system_error &e)
+    {
+        shouldRun = false;
+        log(kErr, "Failed to start backup thread: %s\n", e.what());
+        return -e.code().value();
+    }
+
+    log(kInfo, "backing up volatile repository to %s every %d seconds\n",
+        aPath, aIntervalSecs);
+
+    return 0;
+}
+
+void PeriodicBackup::request()
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    requested = true;
+    cond.notify_one();
+}
+
+void PeriodicBackup::stop(bool final)
+{
+    if (!running())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        shouldRun = false;
+        cond.notify_one();
+    }
+
+    thread.join();
+
+    if (final && backUp() == 0)
+        log(kInfo, "wrote final backup of volatile repository\n");
+}
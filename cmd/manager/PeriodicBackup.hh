@@ -0,0 +1,108 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef PERIODICBACKUP_HH__
+#define PERIODICBACKUP_HH__
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "eci/Logger.hh"
+
+struct sqlite3;
+
+/**
+ * Periodic full backup of an in-memory database, namely the volatile
+ * repository. At a fixed interval, and if the database has changed since the
+ * last backup, a thread copies the whole of it to a file with the SQLite
+ * online backup API. This is not incremental: each backup writes every page,
+ * so its cost grows with the size of the database, not with how much of it
+ * changed. The copy is made a few pages at a time, so that the database is
+ * never locked against the DB worker for long. It is written beside the
+ * target path and renamed over it once complete, so that the file at the
+ * target path is always a consistent backup, ready for reattachment after a
+ * crash.
+ *
+ * The source connection must have been opened with SQLITE_OPEN_FULLMUTEX, as
+ * it will be used from both the backup thread and the DB worker.
+ */
+class PeriodicBackup : public Logger
+{
+    sqlite3 *connSrc = NULL;
+    std::string path;
+    std::string pathTemp;
+    int intervalSecs;
+
+    std::thread thread;
+    std::mutex mtx;
+    std::condition_variable cond;
+    /** Whether the thread should carry on. Protected by mtx. */
+    bool shouldRun = false;
+    /** Whether a backup was requested ahead of time. Protected by mtx. */
+    bool requested = false;
+
+    /**
+     * sqlite3_total_changes() of the source connection as of the last
+     * backup. All writes to the volatile repository go through that one
+     * connection, so if it is unchanged, so is the database.
+     */
+    int lastChanges = -1;
+
+    /** The backup thread. */
+    void run();
+
+  public:
+    PeriodicBackup(Logger *parent) : Logger("backup", parent){};
+
+    /** Whether the backup thread is running. */
+    bool running() const
+    {
+        return thread.joinable();
+    }
+
+    /**
+     * Write out the source database to the target path, if it has changed
+     * since the last backup. Called on the backup thread, but safe
+     * to call elsewhere if the thread is not running.
+     *
+     * @returns 0 if successful or if there was nothing to do.
+     * @returns -1 if the backup failed. The last backup is left
+     * intact.
+     */
+    int backUp();
+
+    /**
+     * Start backing up \p conn to \p aPath every \p aIntervalSecs seconds.
+     *
+     * @returns 0 if successful.
+     * @returns -errno if the thread could not be started.
+     */
+    int start(sqlite3 *conn, const char *aPath, int aIntervalSecs);
+
+    /** Have a backup taken as soon as possible. */
+    void request();
+
+    /**
+     * Stop the backup thread, first taking a final backup if \p
+     * final is set.
+     */
+    void stop(bool final);
+};
+
+#endif
@@ -17,6 +17,47 @@ included with this software
 
 #include "Manager.hh"
 
+/** Makes a snapshot of an instance. */
+class SnapshotJob : public RPCJob
+{
+    int instanceID;
+    std::string name;
+    int snapshotID;
+
+  public:
+    SnapshotJob(WSRPCReq *req, int instanceID, std::string name)
+        : RPCJob(req), instanceID(instanceID), name(name){};
+
+    void run(Backend *bend)
+    {
+        snapshotID =
+            bend->persistentInstanceSnapshotCreate(instanceID, name.c_str());
+    }
+
+    ucl_object_t *result()
+    {
+        return ucl_object_fromint(snapshotID);
+    }
+};
+
+RPCJob::RPCJob(WSRPCReq *req) : xprt(req->xprt), reqID(req->id)
+{
+    req->deferred = true;
+}
+
+void RPCJob::complete()
+{
+    gMgr.rpcJobs.remove(this);
+    if (xprt && reqID)
+        xprt->sendReply(reqID, result());
+}
+
+void Manager::rpcJobSubmit(RPCJob *job)
+{
+    rpcJobs.push_back(job);
+    bend.submit(job);
+}
+
 bool Manager::subscribe_v1(WSRPCReq *req, std::string *rval, int hello)
 {
     printf("Subscribe request: %d\n", hello);
@@ -27,6 +68,64 @@ bool Manager::subscribe_v1(WSRPCReq *req, std::string *rval, int hello)
 bool Manager::snapshot_v1(WSRPCReq *req, int *rval, int instanceID,
                           std::string name)
 {
-    bend.persistentInstanceSnapshotCreate(instanceID, name.c_str());
+    rpcJobSubmit(new SnapshotJob(req, instanceID, name));
+    *rval = 0;
+    return true;
+}
+
+bool Manager::start_v1(WSRPCReq *req, int *rval, std::string name)
+{
+    *rval = transactionSubmit(Task::kStart, name, true);
     return true;
-}
\ No newline at end of file
+}
+
+bool Manager::stop_v1(WSRPCReq *req, int *rval, std::string name)
+{
+    *rval = transactionSubmit(Task::kStop, name);
+    return true;
+}
+
+bool Manager::profile_v1(WSRPCReq *req, std::string *rval, int format)
+{
+    switch (format)
+    {
+    case Timeline::kTraceEvents:
+        *rval = timeline.traceEvents();
+        return true;
+
+    case Timeline::kCriticalPath:
+        *rval = timeline.criticalPath();
+        return true;
+
+    default:
+        req->err.errcode = WSRPCError::kInvalidParameters;
+        req->err.errmsg = "Unknown profile format.";
+        return false;
+    }
+}
+
+bool Manager::usage_v1(WSRPCReq *req, InstanceUsage *rval, std::string name)
+{
+    ObjectIdx obj = graph.objectLookup(name);
+    const CGroupUsage *usage;
+
+    if (obj == -1 || !graph.object(obj).instanceID)
+    {
+        req->err.errcode = WSRPCError::kInvalidParameters;
+        req->err.errmsg = "No such instance.";
+        return false;
+    }
+
+    usage = cgroups.usage(obj);
+    if (!usage)
+    {
+        req->err.errcode = WSRPCError::kError;
+        req->err.errmsg = "Instance is not tracked by cgroup.";
+        return false;
+    }
+
+    rval->cpuUsec = usage->cpuUsec;
+    rval->memoryBytes = usage->memoryBytes;
+    rval->nProcesses = usage->nProcesses;
+    return true;
+}
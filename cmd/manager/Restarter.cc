@@ -0,0 +1,273 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <sys/wait.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "Restarter.hh"
+#include "Scheduler.hh"
+#include "eci/Core.h"
+
+static const uint64_t kMaxMs = 24 * 60 * 60 * 1000;
+
+static bool propertyNumber(const std::map<std::string, std::string> &props,
+                           const char *key, uint64_t min, uint64_t &val,
+                           const std::string &name, Logger *logger)
+{
+    auto it = props.find(key);
+    unsigned long long num;
+    char *end;
+
+    if (it == props.end())
+        return false;
+
+    errno = 0;
+    num = strtoull(it->second.c_str(), &end, 10);
+    if (errno || end == it->second.c_str() || *end || num < min)
+    {
+        logger->log(Logger::kWarn,
+                    "%s: invalid %s \"%s\"; using the default\n",
+                    name.c_str(), key, it->second.c_str());
+        return false;
+    }
+
+    val = num;
+    return true;
+}
+
+RestartPolicy::RestartPolicy(const std::map<std::string, std::string> &props,
+                             const std::string &name, Logger *logger)
+{
+    auto mode = props.find("restart");
+    uint64_t burst;
+
+    if (mode == props.end() || mode->second == "on-failure")
+        this->mode = kOnFailure;
+    else if (mode->second == "always")
+        this->mode = kAlways;
+    else if (mode->second == "no")
+        this->mode = kNever;
+    else
+        logger->log(Logger::kWarn,
+                    "%s: invalid restart \"%s\"; using the default\n",
+                    name.c_str(), mode->second.c_str());
+
+    if (propertyNumber(props, "restart_burst", 1, burst, name, logger))
+        this->burst = std::min(burst, (uint64_t)1000000);
+    propertyNumber(props, "restart_interval_ms", 1, intervalMs, name, logger);
+    propertyNumber(props, "restart_delay_ms", 0, delayMs, name, logger);
+    propertyNumber(props, "restart_delay_max_ms", 0, delayMaxMs, name, logger);
+
+    /* no more than a day, lest the delays in microseconds overflow */
+    intervalMs = std::min(intervalMs, kMaxMs);
+    delayMs = std::min(delayMs, kMaxMs);
+    delayMaxMs = std::min(std::max(delayMs, delayMaxMs), kMaxMs);
+}
+
+Restarter::Restarter(Logger *parent, RestarterDelegate *delegate,
+                     EventLoop *loop, const Graph *graph)
+    : Logger("restarter", parent), delegate(delegate), loop(loop), graph(graph),
+      sharedTokens(kSharedBurst), sharedRefilled(Scheduler::now()),
+      rng(getpid() ^ Scheduler::now())
+{
+}
+
+void Restarter::refill(double &tokens, uint64_t &refilled, double max,
+                       double perUsec, uint64_t now)
+{
+    tokens = std::min(max, tokens + (now - refilled) * perUsec);
+    refilled = now;
+}
+
+void Restarter::unschedule(ObjectIdx obj)
+{
+    Instance &inst = instances[obj];
+    auto range = schedule.equal_range(inst.due);
+
+    for (auto it = range.first; it != range.second; it++)
+        if (it->second == obj)
+        {
+            schedule.erase(it);
+            break;
+        }
+    inst.due = 0;
+}
+
+void Restarter::timerArm()
+{
+    uint64_t now = Scheduler::now(), at;
+    struct timespec ts;
+
+    if (schedule.empty())
+        return;
+
+    at = schedule.begin()->first;
+    /* none may be made till the shared bucket has a token again */
+    refill(sharedTokens, sharedRefilled, kSharedBurst, sharedRate / 1000000,
+           now);
+    if (sharedTokens < 1)
+        at = std::max(at, now + (uint64_t)((1 - sharedTokens) * 1000000 /
+                                           sharedRate));
+
+    if (timer != -1)
+    {
+        if (timerDue <= at)
+            return;
+        loop->delTimer(timer);
+        timer = -1;
+    }
+
+    /* a timer of zero would be disarmed, never to go off */
+    at = std::max(at, now + 1);
+    ts.tv_sec = (at - now) / 1000000;
+    ts.tv_nsec = (at - now) % 1000000 * 1000;
+
+    timer = loop->addTimer(this, &ts);
+    if (timer < 0)
+    {
+        loge(kErr, -timer, "Failed to add restart timer");
+        timer = -1;
+        return;
+    }
+    timerDue = at;
+}
+
+void Restarter::timerEvent(EventLoop *loop, int id)
+{
+    uint64_t now = Scheduler::now();
+
+    timer = -1;
+    refill(sharedTokens, sharedRefilled, kSharedBurst, sharedRate / 1000000,
+           now);
+
+    while (!schedule.empty() && schedule.begin()->first <= now &&
+           sharedTokens >= 1)
+    {
+        ObjectIdx obj = schedule.begin()->second;
+
+        schedule.erase(schedule.begin());
+        instances[obj].due = 0;
+        sharedTokens--;
+        delegate->restartDue(obj);
+    }
+
+    timerArm();
+}
+
+void Restarter::sharedRateSet(double perSec)
+{
+    sharedRate = perSec;
+}
+
+void Restarter::processStarted(ObjectIdx obj, const RestartPolicy &policy)
+{
+    auto it = instances.find(obj);
+    uint64_t now = Scheduler::now();
+
+    if (it == instances.end())
+    {
+        it = instances.emplace(obj, Instance()).first;
+        it->second.tokens = policy.burst;
+        it->second.refilled = now;
+    }
+    else if (it->second.due)
+        unschedule(obj);
+
+    it->second.policy = policy;
+    it->second.tokens = std::min(it->second.tokens, (double)policy.burst);
+    it->second.started = now;
+}
+
+bool Restarter::processExited(ObjectIdx obj, int wstat)
+{
+    auto it = instances.find(obj);
+    uint64_t now = Scheduler::now(), delay;
+    std::uniform_int_distribution<uint64_t> jitter;
+
+    if (it == instances.end() || it->second.due)
+        return false;
+
+    Instance &inst = it->second;
+    const RestartPolicy &policy = inst.policy;
+    const char *name = graph->object(obj).name.c_str();
+
+    if (policy.mode == RestartPolicy::kNever || inst.gaveUp ||
+        (policy.mode == RestartPolicy::kOnFailure &&
+         !eciExitWasAbnormal(wstat)))
+        return false;
+
+    refill(inst.tokens, inst.refilled, policy.burst,
+           (double)policy.burst / (policy.intervalMs * 1000), now);
+    if (inst.tokens < 1)
+    {
+        log(kErr,
+            "%s: restarting too often (limit %d in %llu ms); giving up "
+            "until it is started explicitly\n",
+            name, policy.burst, (unsigned long long)policy.intervalMs);
+        inst.gaveUp = true;
+        return false;
+    }
+    inst.tokens--;
+
+    /* a process which ran as long as the longest delay was not looping */
+    if (now - inst.started >= policy.delayMaxMs * 1000)
+        inst.nFailures = 0;
+
+    delay = policy.delayMs * 1000;
+    for (unsigned i = 0; i < inst.nFailures && delay < policy.delayMaxMs * 1000;
+         i++)
+        delay *= 2;
+    delay = std::min(delay, policy.delayMaxMs * 1000);
+    inst.nFailures++;
+
+    /* "equal jitter": somewhere between half the delay and all of it */
+    jitter = std::uniform_int_distribution<uint64_t>(0, delay / 2);
+    delay = delay - delay / 2 + jitter(rng);
+
+    log(kInfo, "%s: restarting in %llu ms\n", name,
+        (unsigned long long)delay / 1000);
+    inst.due = now + delay;
+    schedule.emplace(inst.due, obj);
+    timerArm();
+    return true;
+}
+
+void Restarter::cancel(ObjectIdx obj)
+{
+    auto it = instances.find(obj);
+
+    if (it != instances.end() && it->second.due)
+        unschedule(obj);
+}
+
+void Restarter::reset(ObjectIdx obj)
+{
+    auto it = instances.find(obj);
+
+    if (it == instances.end())
+        return;
+
+    if (it->second.due)
+        unschedule(obj);
+    it->second.tokens = it->second.policy.burst;
+    it->second.refilled = Scheduler::now();
+    it->second.nFailures = 0;
+    it->second.gaveUp = false;
+}
@@ -0,0 +1,169 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef RESTARTER_HH__
+#define RESTARTER_HH__
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "Graph.hh"
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+
+/**
+ * When, and how often, an instance is to be restarted after its main process
+ * exits of its own accord. Read from the instance's properties:
+ *
+ * - restart: "no", "on-failure" (the default), or "always"
+ * - restart_burst: most restarts in a row before giving up (default 5)
+ * - restart_interval_ms: time over which as many restarts as restart_burst
+ * are earned back, one at a time (default 60000)
+ * - restart_delay_ms: delay before the first restart (default 100); it is
+ * doubled with each restart after, to restart_delay_max_ms (default 30000)
+ */
+struct RestartPolicy
+{
+    enum Mode
+    {
+        kNever,
+        kOnFailure,
+        kAlways,
+    };
+
+    Mode mode = kOnFailure;
+    int burst = 5;
+    uint64_t intervalMs = 60000;
+    uint64_t delayMs = 100;
+    uint64_t delayMaxMs = 30000;
+
+    RestartPolicy() = default;
+    /**
+     * Read the policy of instance \p name from its properties \p props,
+     * logging any invalid to \p logger.
+     */
+    RestartPolicy(const std::map<std::string, std::string> &props,
+                  const std::string &name, Logger *logger);
+};
+
+struct RestarterDelegate
+{
+    /** The delay before restarting \p obj has passed; start it again. */
+    virtual void restartDue(ObjectIdx obj) = 0;
+};
+
+/**
+ * Decides whether, and when, to restart instances whose processes exited, and
+ * tells its delegate when they are due.
+ *
+ * Each instance has a token bucket of restart_burst tokens, refilled over
+ * restart_interval_ms. A restart takes a token; with none left, the instance
+ * is given up on until started explicitly. Restarts are delayed by an
+ * exponential backoff with jitter, reset once a process runs for longer than
+ * the longest delay, so that instances failing together do not restart in
+ * lockstep.
+ *
+ * Restarts of all instances together are also limited, by a bucket shared
+ * among them, so that a mass of failing instances cannot crowd out the
+ * starting of healthy ones. Restarts held back by it are made in the order
+ * they fell due.
+ *
+ * One event loop timer, set for the earliest restart due, serves for all.
+ */
+class Restarter : public Handler, public Logger
+{
+    struct Instance
+    {
+        RestartPolicy policy;
+        double tokens;
+        /** When tokens was last refilled. */
+        uint64_t refilled;
+        /** Restarts since a process last ran for long enough. */
+        unsigned nFailures = 0;
+        /** When its process was last started. */
+        uint64_t started = 0;
+        /** When it is to be restarted, or 0 if it is not. */
+        uint64_t due = 0;
+        /** Whether it restarted too often, and so is no longer restarted. */
+        bool gaveUp = false;
+    };
+
+    RestarterDelegate *delegate;
+    EventLoop *loop;
+    const Graph *graph;
+    std::unordered_map<ObjectIdx, Instance> instances;
+    /** Instances to be restarted, by when. */
+    std::multimap<uint64_t, ObjectIdx> schedule;
+
+    /** The bucket shared by all, holding at most kSharedBurst tokens. */
+    double sharedTokens;
+    uint64_t sharedRefilled;
+    /** Restarts a second earned back into the shared bucket. */
+    double sharedRate = 10;
+
+    int timer = -1;
+    /** When the timer goes off. */
+    uint64_t timerDue = 0;
+
+    std::minstd_rand rng;
+
+    /** Earn back the tokens of the time passed since last refilled. */
+    static void refill(double &tokens, uint64_t &refilled, double max,
+                       double perUsec, uint64_t now);
+    /** Remove \p obj from the schedule, if it is there. */
+    void unschedule(ObjectIdx obj);
+    /** Set the timer for the earliest restart which may be made. */
+    void timerArm();
+
+    /* event handlers */
+    void timerEvent(EventLoop *loop, int id);
+
+  public:
+    static const int kSharedBurst = 20;
+
+    Restarter(Logger *parent, RestarterDelegate *delegate, EventLoop *loop,
+              const Graph *graph);
+
+    /** Set the rate at which restarts may be made in all. */
+    void sharedRateSet(double perSec);
+
+    /**
+     * The main process of \p obj was started with \p policy. Its policy stays
+     * the same until the next start, even should its properties change.
+     */
+    void processStarted(ObjectIdx obj, const RestartPolicy &policy);
+    /**
+     * The main process of \p obj exited of its own accord, with the wait
+     * status \p wstat. Schedules a restart as its policy directs.
+     *
+     * @returns whether it is to be restarted.
+     */
+    bool processExited(ObjectIdx obj, int wstat);
+    /** \p obj is being stopped; do not restart it. */
+    void cancel(ObjectIdx obj);
+    /**
+     * \p obj is being started explicitly, or by a transaction started so;
+     * forgive it its past failures, and restart it again if it was given up
+     * on.
+     */
+    void reset(ObjectIdx obj);
+};
+
+#endif
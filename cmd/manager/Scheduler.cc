@@ -0,0 +1,342 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <time.h>
+
+#include "Scheduler.hh"
+
+int Transaction::taskLookup(Task::Kind kind, ObjectIdx obj) const
+{
+    auto it = byObject.find(std::make_pair(kind, obj));
+    return it == byObject.end() ? -1 : it->second;
+}
+
+int Transaction::taskGetOrCreate(Scheduler &sched, Graph &graph,
+                                 Task::Kind kind, ObjectIdx obj)
+{
+    int task = taskLookup(kind, obj);
+
+    if (task != -1)
+        return task;
+
+    task = tasks.size();
+    tasks.push_back({kind, obj, Task::kWaiting, sched.classOf(graph, obj), 0,
+                     -1, {}, -1});
+    byObject[std::make_pair(kind, obj)] = task;
+    nPending++;
+    return task;
+}
+
+void Transaction::waitAdd(int waiter, int task, bool requires)
+{
+    waits.push_back({waiter, requires, tasks[task].firstWaiter});
+    tasks[task].firstWaiter = waits.size() - 1;
+    tasks[waiter].nBlockers++;
+}
+
+void Transaction::objectStart(Scheduler &sched, Graph &graph, ObjectIdx obj)
+{
+    std::vector<ObjectIdx> todo;
+
+    if (taskLookup(Task::kStart, obj) != -1)
+        return;
+
+    taskGetOrCreate(sched, graph, Task::kStart, obj);
+    todo.push_back(obj);
+
+    while (!todo.empty())
+    {
+        ObjectIdx cur = todo.back();
+
+        todo.pop_back();
+        for (int e = graph.object(cur).firstOut; e != -1;
+             e = graph.edge(e).nextOut)
+        {
+            const Edge &edge = graph.edge(e);
+
+            if (edge.kind == Edge::kConflicts)
+                objectStop(sched, graph, edge.to);
+            else if (edge.kind == Edge::kRequires &&
+                     taskLookup(Task::kStart, edge.to) == -1)
+            {
+                taskGetOrCreate(sched, graph, Task::kStart, edge.to);
+                todo.push_back(edge.to);
+            }
+        }
+    }
+}
+
+void Transaction::objectStop(Scheduler &sched, Graph &graph, ObjectIdx obj)
+{
+    std::vector<ObjectIdx> todo;
+
+    if (taskLookup(Task::kStop, obj) != -1)
+        return;
+
+    taskGetOrCreate(sched, graph, Task::kStop, obj);
+    todo.push_back(obj);
+
+    while (!todo.empty())
+    {
+        ObjectIdx cur = todo.back();
+
+        todo.pop_back();
+        for (int e = graph.object(cur).firstIn; e != -1;
+             e = graph.edge(e).nextIn)
+        {
+            const Edge &edge = graph.edge(e);
+
+            if (edge.kind == Edge::kRequires &&
+                taskLookup(Task::kStop, edge.from) == -1)
+            {
+                taskGetOrCreate(sched, graph, Task::kStop, edge.from);
+                todo.push_back(edge.from);
+            }
+        }
+    }
+}
+
+int Transaction::order(Graph &graph, Logger *logger)
+{
+    std::vector<bool> done(graph.size());
+    std::vector<int> nBlockers;
+    std::vector<int> ready;
+    size_t nOrdered = 0;
+
+    for (auto &task : tasks)
+    {
+        ObjectIdx obj = task.obj;
+        int start = taskLookup(Task::kStart, obj);
+        int stop = taskLookup(Task::kStop, obj);
+
+        /* an object may have both a start and a stop */
+        if (done[obj])
+            continue;
+        done[obj] = true;
+
+        /* one both stopped and started is stopped first, so left running */
+        if (start != -1 && stop != -1)
+            waitAdd(start, stop, false);
+
+        for (int e = graph.object(obj).firstOut; e != -1;
+             e = graph.edge(e).nextOut)
+        {
+            const Edge &edge = graph.edge(e);
+            int otherStart, otherStop;
+            bool requires = false;
+
+            if (edge.kind != Edge::kAfter)
+                continue;
+
+            otherStart = taskLookup(Task::kStart, edge.to);
+            otherStop = taskLookup(Task::kStop, edge.to);
+
+            /* a start which must follow one it requires fails with it */
+            for (int r = graph.object(obj).firstOut; r != -1;
+                 r = graph.edge(r).nextOut)
+                if (graph.edge(r).kind == Edge::kRequires &&
+                    graph.edge(r).to == edge.to)
+                    requires = true;
+
+            if (start != -1 && otherStart != -1)
+                waitAdd(start, otherStart, requires);
+            if (stop != -1 && otherStop != -1)
+                waitAdd(otherStop, stop, false);
+            if (start != -1 && otherStop != -1)
+                waitAdd(start, otherStop, false);
+            if (stop != -1 && otherStart != -1)
+                waitAdd(otherStart, stop, false);
+        }
+    }
+
+    /* check by a topological sort that the tasks can all be run */
+    for (size_t i = 0; i < tasks.size(); i++)
+    {
+        nBlockers.push_back(tasks[i].nBlockers);
+        if (!tasks[i].nBlockers)
+            ready.push_back(i);
+    }
+
+    while (!ready.empty())
+    {
+        int task = ready.back();
+
+        ready.pop_back();
+        nOrdered++;
+        for (int w = tasks[task].firstWaiter; w != -1; w = waits[w].next)
+            if (!--nBlockers[waits[w].waiter])
+                ready.push_back(waits[w].waiter);
+    }
+
+    if (nOrdered != tasks.size())
+    {
+        std::string names;
+
+        for (size_t i = 0; i < tasks.size(); i++)
+            if (nBlockers[i])
+                names += (names.empty() ? "" : ", ") +
+                         std::string(tasks[i].kind == Task::kStart ? "start "
+                                                                   : "stop ") +
+                         graph.object(tasks[i].obj).name;
+        logger->log(Logger::kErr, "Transaction ordering is cyclic among: %s\n",
+                    names.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+int Scheduler::classGetOrCreate(const std::string &name)
+{
+    for (size_t i = 0; i < classes.size(); i++)
+        if (classes[i].name == name)
+            return i;
+
+    classes.push_back({name, 0, 0, {}});
+    return classes.size() - 1;
+}
+
+int Scheduler::classOf(const Graph &graph, ObjectIdx obj)
+{
+    const std::string &name = graph.object(obj).name;
+    size_t dollar = name.find('$');
+
+    if (dollar == std::string::npos)
+        return classGetOrCreate("default");
+    return classGetOrCreate(name.substr(0, dollar));
+}
+
+void Scheduler::classCapSet(const std::string &name, int cap)
+{
+    classes[classGetOrCreate(name)].cap = cap;
+    /* a raised cap may let more run */
+    dispatch();
+}
+
+uint64_t Scheduler::now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void Scheduler::taskReady(Transaction *tx, int task)
+{
+    tx->tasks[task].times[Task::kTimeEnqueued] = now();
+    classes[tx->tasks[task].resClass].ready.emplace_back(tx, task);
+}
+
+void Scheduler::taskFinish(Transaction *tx, int task, bool ok)
+{
+    std::vector<std::pair<int, bool>> finished{{task, ok}};
+    uint64_t t = now();
+
+    while (!finished.empty())
+    {
+        int curIdx = finished.back().first;
+        Task &cur = tx->tasks[curIdx];
+        bool curOK = finished.back().second;
+
+        finished.pop_back();
+        cur.state = curOK ? Task::kComplete : Task::kFailed;
+        cur.times[curOK ? Task::kTimeReady : Task::kTimeFailed] = t;
+        tx->nPending--;
+
+        for (int w = cur.firstWaiter; w != -1; w = tx->waits[w].next)
+        {
+            Task &waiter = tx->tasks[tx->waits[w].waiter];
+
+            /* a task whose requirement failed fails in turn, unrun */
+            if (!curOK && tx->waits[w].requires)
+                waiter.state = Task::kFailed;
+
+            if (--waiter.nBlockers)
+                continue;
+
+            waiter.gatedBy = curIdx;
+            if (waiter.state == Task::kFailed)
+                finished.emplace_back(tx->waits[w].waiter, false);
+            else
+                taskReady(tx, tx->waits[w].waiter);
+        }
+    }
+
+    if (tx->finished())
+        delegate->transactionDone(tx);
+}
+
+void Scheduler::dispatch()
+{
+    bool progress = true;
+
+    /* taskRun() may finish tasks, and so make more ready, within this */
+    if (dispatching)
+        return;
+    dispatching = true;
+
+    while (progress)
+    {
+        progress = false;
+
+        for (size_t i = 0; i < classes.size(); i++)
+            while (!classes[i].ready.empty() &&
+                   (!classes[i].cap || classes[i].nRunning < classes[i].cap))
+            {
+                Transaction *tx = classes[i].ready.front().first;
+                int task = classes[i].ready.front().second;
+
+                classes[i].ready.pop_front();
+                classes[i].nRunning++;
+                tx->tasks[task].state = Task::kRunning;
+                tx->tasks[task].times[Task::kTimeDispatched] = now();
+                progress = true;
+
+                delegate->taskRun(tx, task);
+            }
+    }
+
+    dispatching = false;
+}
+
+void Scheduler::submit(Transaction *tx)
+{
+    tx->submitted = now();
+    if (tx->finished())
+    {
+        delegate->transactionDone(tx);
+        return;
+    }
+
+    for (size_t i = 0; i < tx->tasks.size(); i++)
+        if (!tx->tasks[i].nBlockers)
+            taskReady(tx, i);
+
+    dispatch();
+}
+
+void Scheduler::taskForked(Transaction *tx, int task)
+{
+    tx->tasks[task].times[Task::kTimeForked] = now();
+}
+
+void Scheduler::taskDone(Transaction *tx, int task, bool ok)
+{
+    classes[tx->tasks[task].resClass].nRunning--;
+    taskFinish(tx, task, ok);
+    dispatch();
+}
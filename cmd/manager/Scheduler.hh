@@ -0,0 +1,240 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2015-2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef SCHEDULER_HH__
+#define SCHEDULER_HH__
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Graph.hh"
+#include "eci/Logger.hh"
+
+class Scheduler;
+
+struct Task
+{
+    enum State
+    {
+        /** Action not yet dispatched, likely waiting for a dependent
+           action. */
+        kWaiting,
+        /** Action is currently running. */
+        kRunning,
+        /** Action successfully completed. */
+        kComplete,
+        /** Action failed. */
+        kFailed
+    };
+
+    enum Kind
+    {
+        kStart,
+        /* Halt this */
+        kStop,
+    };
+
+    /** The events in a task's life whose times are recorded. */
+    enum Time
+    {
+        /** Ready to run, and queued on its resource class. */
+        kTimeEnqueued,
+        /** Dispatched to SchedulerDelegate::taskRun(). */
+        kTimeDispatched,
+        /** The method's process was forked. */
+        kTimeForked,
+        /** Completed successfully. */
+        kTimeReady,
+        /** Failed, whether it ran or not. */
+        kTimeFailed,
+        kTimeMax,
+    };
+
+    Kind kind;
+    /** The object of this transaction */
+    ObjectIdx obj;
+    /** State of the transaction */
+    State state;
+    /** Resource class, by which concurrency is capped; see Scheduler. */
+    int resClass;
+    /** How many of the tasks this waits on have yet to finish. */
+    int nBlockers;
+    /** Head of the list of tasks waiting on this, or -1. */
+    int firstWaiter;
+    /**
+     * When each event befell the task, in microseconds on the monotonic
+     * clock; 0 for those which have not.
+     */
+    uint64_t times[kTimeMax];
+    /**
+     * The task whose finishing let this become ready (the last of those it
+     * waited on to finish), or -1 if it waited on none. Following these back
+     * from the last task to finish gives the transaction's critical path.
+     */
+    int gatedBy;
+};
+
+/**
+ * A set of tasks to be carried out together, ordered in line with the
+ * dependencies between their objects. Tasks refer to one another by index.
+ */
+class Transaction
+{
+    friend class Scheduler;
+
+    /** That a task waits on another; a link in the latter's waiters list. */
+    struct Wait
+    {
+        int waiter;
+        /** Whether the waiter requires the other, and so fails if it does. */
+        bool requires;
+        int next;
+    };
+
+    std::vector<Wait> waits;
+    /** Tasks by kind and object, so that each is added but once. */
+    std::map<std::pair<Task::Kind, ObjectIdx>, int> byObject;
+    /** How many tasks have yet to finish. */
+    int nPending = 0;
+
+    /** @returns the task of that kind for \p obj, added if need be. */
+    int taskGetOrCreate(Scheduler &sched, Graph &graph, Task::Kind kind,
+                        ObjectIdx obj);
+    /** @returns the task of that kind for \p obj, or -1. */
+    int taskLookup(Task::Kind kind, ObjectIdx obj) const;
+    /** Make \p waiter wait until \p task has finished. */
+    void waitAdd(int waiter, int task, bool requires);
+
+  public:
+    /** The first task is that of the object the transaction was made for. */
+    std::vector<Task> tasks;
+    /** When the transaction was submitted, as in Task::times. */
+    uint64_t submitted = 0;
+
+    /**
+     * Add a start of \p obj, and of everything it requires, directly or not;
+     * and a stop of everything they conflict with.
+     */
+    void objectStart(Scheduler &sched, Graph &graph, ObjectIdx obj);
+    /** Add a stop of \p obj, and of everything requiring it. */
+    void objectStop(Scheduler &sched, Graph &graph, ObjectIdx obj);
+
+    /**
+     * Order the tasks added in line with the ordering dependencies between
+     * their objects. Starts follow the order given; stops go the other way;
+     * and a stop goes before a start it is ordered against either way, as
+     * does an object's own stop before its start, so that an object both
+     * stopped and started ends up running. To be called once all tasks have
+     * been added.
+     *
+     * @returns 0 if successful.
+     * @returns -1 if the ordering is cyclic. The tasks on the cycle are
+     * logged.
+     */
+    int order(Graph &graph, Logger *logger);
+
+    /** Whether every task has finished. */
+    bool finished() const
+    {
+        return !nPending;
+    }
+};
+
+struct SchedulerDelegate
+{
+    /**
+     * Carry out a task, calling Scheduler::taskDone() once it has finished.
+     * It may be called from within this.
+     */
+    virtual void taskRun(Transaction *tx, int task) = 0;
+    /** A transaction has finished; every task has completed or failed. */
+    virtual void transactionDone(Transaction *tx) = 0;
+};
+
+/**
+ * Runs the tasks of transactions as concurrently as their ordering allows.
+ * Each task has a count of the tasks it waits on; when that reaches zero, the
+ * task becomes ready, and is queued on the ready queue of its resource class.
+ * A ready task is dispatched at once unless its class is at its concurrency
+ * cap, in which case it is dispatched when another task of its class
+ * finishes.
+ *
+ * An object's resource class is its type, e.g. "mount" for mount$var:default;
+ * objects of no type are of the class "default". Unless capped, a class is
+ * not limited.
+ */
+class Scheduler : public Logger
+{
+    struct ResClass
+    {
+        std::string name;
+        /** Most tasks of the class which may run at once; 0 for no limit. */
+        int cap;
+        int nRunning;
+        /** Ready tasks, in the order they became ready. */
+        std::deque<std::pair<Transaction *, int>> ready;
+    };
+
+    SchedulerDelegate *delegate;
+    std::vector<ResClass> classes;
+    /** Whether dispatch() is running, and so need not be run again. */
+    bool dispatching = false;
+
+    /** A task is ready to run; queue it. */
+    void taskReady(Transaction *tx, int task);
+    /**
+     * A task has finished, or failed before it could run; release the tasks
+     * waiting on it.
+     */
+    void taskFinish(Transaction *tx, int task, bool ok);
+    /** Dispatch ready tasks for as long as their classes are under cap. */
+    void dispatch();
+
+  public:
+    Scheduler(Logger *parent, SchedulerDelegate *delegate)
+        : Logger("scheduler", parent), delegate(delegate){};
+
+    /** @returns the index of the resource class \p name, added if need be. */
+    int classGetOrCreate(const std::string &name);
+    /** @returns the index of the resource class of \p obj. */
+    int classOf(const Graph &graph, ObjectIdx obj);
+    /** Cap the number of tasks of a resource class which may run at once. */
+    void classCapSet(const std::string &name, int cap);
+    const std::string &className(int cls) const
+    {
+        return classes[cls].name;
+    }
+
+    /**
+     * Begin running a transaction, which must already be ordered. Every task
+     * which waits on nothing is dispatched at once, so far as caps allow.
+     */
+    void submit(Transaction *tx);
+
+    /** The process of a dispatched task's method has been forked. */
+    void taskForked(Transaction *tx, int task);
+    /** A task dispatched by SchedulerDelegate::taskRun() has finished. */
+    void taskDone(Transaction *tx, int task, bool ok);
+
+    /** @returns the time now, in microseconds on the monotonic clock. */
+    static uint64_t now();
+};
+
+#endif
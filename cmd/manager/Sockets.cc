@@ -0,0 +1,240 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+
+#include "Sockets.hh"
+
+/* Close \p fd, which failed to be set up, and return the error. */
+static int bindFail(int fd)
+{
+    int r = -errno;
+
+    close(fd);
+    return r;
+}
+
+int Sockets::bind(const std::string &addr)
+{
+    size_t colon = addr.find(':');
+    std::string kind, where;
+    int type, fd, one = 1;
+
+    if (colon == std::string::npos)
+        return -EINVAL;
+    kind = addr.substr(0, colon);
+    where = addr.substr(colon + 1);
+
+    if (kind == "unix" || kind == "unix-dgram")
+    {
+        struct sockaddr_un sun;
+        struct stat sb;
+
+        type = kind == "unix" ? SOCK_STREAM : SOCK_DGRAM;
+        if (where.empty() || where.size() >= sizeof(sun.sun_path))
+            return -EINVAL;
+
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        strcpy(sun.sun_path, where.c_str());
+
+        /* one left by an earlier run is in the way; anything else is not */
+        if (lstat(sun.sun_path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+            unlink(sun.sun_path);
+
+        if ((fd = socket(AF_UNIX, type, 0)) == -1)
+            return -errno;
+        if (::bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+            return bindFail(fd);
+    }
+    else if (kind == "tcp" || kind == "udp")
+    {
+        struct addrinfo hints, *ai;
+        std::string host, port = where;
+        size_t sep = where.rfind(':');
+
+        type = kind == "tcp" ? SOCK_STREAM : SOCK_DGRAM;
+        if (sep != std::string::npos)
+        {
+            host = where.substr(0, sep);
+            port = where.substr(sep + 1);
+            if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+                host = host.substr(1, host.size() - 2);
+        }
+
+        /* names are not looked up; we may be binding before the network */
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+        hints.ai_socktype = type;
+        if (port.empty() || getaddrinfo(host.empty() ? NULL : host.c_str(),
+                                        port.c_str(), &hints, &ai) != 0)
+            return -EINVAL;
+
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd == -1)
+        {
+            freeaddrinfo(ai);
+            return -errno;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == -1)
+        {
+            freeaddrinfo(ai);
+            return bindFail(fd);
+        }
+        freeaddrinfo(ai);
+    }
+    else
+        return -EINVAL;
+
+    if (type == SOCK_STREAM && listen(fd, SOMAXCONN) == -1)
+        return bindFail(fd);
+
+    /* only the instance's processes are to have it, as they are given it */
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+        return bindFail(fd);
+    return fd;
+}
+
+void Sockets::declare(ObjectIdx obj, const std::string &listen)
+{
+    const char *objName = graph->object(obj).name.c_str();
+    std::vector<size_t> indices;
+
+    if (objects.count(obj))
+        return;
+
+    for (size_t pos = 0; pos < listen.size();)
+    {
+        size_t end = listen.find(' ', pos), eq;
+        std::string addr, name = "listen";
+        int fd;
+
+        if (end == std::string::npos)
+            end = listen.size();
+        addr = listen.substr(pos, end - pos);
+        pos = end + 1;
+        if (addr.empty())
+            continue;
+
+        eq = addr.find('=');
+        if (eq != std::string::npos && eq < addr.find(':'))
+        {
+            name = addr.substr(0, eq);
+            addr = addr.substr(eq + 1);
+            /* the names are passed separated by colons */
+            if (name.empty() || name.find(':') != std::string::npos)
+            {
+                log(kWarn, "%s: invalid socket name \"%s\"; using \"listen\"\n",
+                    objName, name.c_str());
+                name = "listen";
+            }
+        }
+
+        fd = bind(addr);
+        if (fd < 0)
+        {
+            loge(kErr, -fd, "%s: failed to bind socket %s", objName,
+                 addr.c_str());
+            continue;
+        }
+
+        log(kDebug, "%s: bound socket %s as FD %d\n", objName, addr.c_str(),
+            fd);
+        indices.push_back(sockets.size());
+        sockets.push_back({obj, name, fd});
+    }
+
+    if (!indices.empty())
+        objects[obj] = std::move(indices);
+}
+
+void Sockets::watch(ObjectIdx obj)
+{
+    auto it = objects.find(obj);
+    int r;
+
+    if (it == objects.end())
+        return;
+
+    for (size_t idx : it->second)
+    {
+        int fd = sockets[idx].fd;
+
+        if (watched.count(fd))
+            continue;
+        if ((r = loop->addFD(this, fd, POLLIN)) != 0)
+            loge(kErr, -r, "%s: failed to watch socket FD %d",
+                 graph->object(obj).name.c_str(), fd);
+        else
+            watched[fd] = idx;
+    }
+}
+
+void Sockets::unwatch(ObjectIdx obj)
+{
+    auto it = objects.find(obj);
+
+    if (it == objects.end())
+        return;
+
+    for (size_t idx : it->second)
+        if (watched.erase(sockets[idx].fd))
+            loop->delFD(sockets[idx].fd);
+}
+
+void Sockets::fdEvent(EventLoop *loop, int fd, int revents)
+{
+    auto it = watched.find(fd);
+    ObjectIdx obj;
+
+    if (it == watched.end())
+        return;
+
+    obj = sockets[it->second].obj;
+    /* it is the instance's to accept from now */
+    unwatch(obj);
+    delegate->socketActivity(obj);
+}
+
+void Sockets::spawnArgs(ObjectIdx obj, std::vector<std::pair<int, int>> &fds,
+                        std::vector<std::string> &env) const
+{
+    auto it = objects.find(obj);
+    std::string names;
+
+    if (it == objects.end())
+        return;
+
+    for (size_t i = 0; i < it->second.size(); i++)
+    {
+        const Socket &sock = sockets[it->second[i]];
+
+        fds.push_back({sock.fd, kListenFDsStart + (int)i});
+        names += (i ? ":" : "") + sock.name;
+    }
+
+    env.push_back("LISTEN_FDS=" + std::to_string(it->second.size()));
+    env.push_back("LISTEN_FDNAMES=" + names);
+}
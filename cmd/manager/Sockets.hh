@@ -0,0 +1,127 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef SOCKETS_HH__
+#define SOCKETS_HH__
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Graph.hh"
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+
+struct SocketsDelegate
+{
+    /**
+     * A socket of \p obj's, which was being watched, has a connection or a
+     * datagram waiting; start it. Its sockets are no longer watched.
+     */
+    virtual void socketActivity(ObjectIdx obj) = 0;
+};
+
+/**
+ * The listening sockets of instances which are socket-activated, bound by us
+ * ahead of time so that clients may connect to an instance before it has
+ * started, while it starts, and while it restarts. Clients need then wait on
+ * no ordering dependency; their connections queue until it accepts them.
+ *
+ * An instance declares its sockets with the "listen" property, a list of
+ * addresses separated by spaces, each "[<name>=]<kind>:<address>":
+ *
+ * - unix:<path> or unix-dgram:<path>, a Unix-domain stream or datagram socket
+ * - tcp:[<host>:]<port> or udp:[<host>:]<port>, where the host is numeric,
+ * an IPv6 address being bracketed; with no host, the wildcard address
+ *
+ * The name, "listen" if not given, is passed in LISTEN_FDNAMES.
+ *
+ * The sockets are bound when the instance is first known, and are kept open
+ * for as long as we run. While the instance waits to be activated, they are
+ * watched on the event loop; at the first activity on any of them, the
+ * delegate is told. The instance's processes are given them from descriptor
+ * kListenFDsStart on, in the order declared, with the environment the
+ * sd_listen_fds(3) protocol expects.
+ */
+class Sockets : public Handler, public Logger
+{
+    struct Socket
+    {
+        ObjectIdx obj;
+        std::string name;
+        int fd;
+    };
+
+    SocketsDelegate *delegate;
+    EventLoop *loop;
+    const Graph *graph;
+
+    std::vector<Socket> sockets;
+    /** The sockets of each object, by index into sockets. */
+    std::unordered_map<ObjectIdx, std::vector<size_t>> objects;
+    /** Sockets being watched, by FD. */
+    std::unordered_map<int, size_t> watched;
+
+    /**
+     * Bind a socket to \p addr, of the form described above.
+     *
+     * @returns the socket's FD.
+     * @returns -EINVAL if \p addr is malformed.
+     * @returns -errno if it could not be bound.
+     */
+    static int bind(const std::string &addr);
+
+    /* event handlers */
+    void fdEvent(EventLoop *loop, int fd, int revents);
+
+  public:
+    /** SD_LISTEN_FDS_START, the first descriptor passed. */
+    static const int kListenFDsStart = 3;
+
+    Sockets(Logger *parent, SocketsDelegate *delegate, EventLoop *loop,
+            const Graph *graph)
+        : Logger("sockets", parent), delegate(delegate), loop(loop),
+          graph(graph){};
+
+    /**
+     * Bind the sockets \p obj declares in its "listen" property \p listen,
+     * unless they were bound already. Those which cannot be bound are logged
+     * and left out.
+     */
+    void declare(ObjectIdx obj, const std::string &listen);
+
+    /** @returns whether \p obj has any sockets. */
+    bool has(ObjectIdx obj) const
+    {
+        return objects.count(obj);
+    }
+    /** Watch the sockets of \p obj for activity. */
+    void watch(ObjectIdx obj);
+    /** Stop watching the sockets of \p obj, if they are being watched. */
+    void unwatch(ObjectIdx obj);
+
+    /**
+     * Get the FD pairs with which to spawn a process of \p obj, and the
+     * variables to add to its environment: LISTEN_FDS and LISTEN_FDNAMES.
+     * LISTEN_PID must be set by the spawner, as it alone knows the PID.
+     */
+    void spawnArgs(ObjectIdx obj, std::vector<std::pair<int, int>> &fds,
+                   std::vector<std::string> &env) const;
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <time.h>
+#include <utility>
+
+#include "Backend.hh"
+#include "Scheduler.hh"
+#include "StateStore.hh"
+
+/** Writes a batch of changed live instances to the volatile repository. */
+class LiveStateWriteJob : public DBJob
+{
+    StateStore *store;
+    std::vector<LiveInstanceRecord> records;
+    int res;
+
+  public:
+    LiveStateWriteJob(StateStore *store,
+                      std::vector<LiveInstanceRecord> &&records)
+        : store(store), records(std::move(records)){};
+
+    void run(Backend *bend)
+    {
+        res = bend->volatileLiveInstancesWrite(records);
+    }
+
+    void complete()
+    {
+        store->writeDone(res);
+    }
+};
+
+const char *StateStore::stateName(State state)
+{
+    static const char *names[] = {"offline", "starting", "online",
+                                  "stopping", "failed",   "listening"};
+    return names[state];
+}
+
+void StateStore::touch(ObjectIdx obj)
+{
+    if (obj >= (ObjectIdx)states.size())
+    {
+        states.resize(obj + 1, kOffline);
+        mainPIDs.resize(obj + 1, 0);
+        sinces.resize(obj + 1, 0);
+        generations.resize(obj + 1, 0);
+        isDirty.resize(obj + 1, false);
+    }
+
+    generations[obj]++;
+    if (!isDirty[obj])
+    {
+        isDirty[obj] = true;
+        dirty.push_back(obj);
+    }
+
+    writeSchedule();
+}
+
+void StateStore::writeSchedule()
+{
+    struct timespec ts = {0, kWriteDelayNSecs};
+
+    if (timer != -1 || writing)
+        return;
+
+    timer = loop->addTimer(this, &ts);
+    if (timer < 0)
+    {
+        loge(kErr, -timer, "Failed to schedule writing of live state");
+        timer = -1;
+    }
+}
+
+void StateStore::stateSet(ObjectIdx obj, State state)
+{
+    if (this->state(obj) == state)
+        return;
+
+    touch(obj);
+    states[obj] = state;
+    sinces[obj] = Scheduler::now();
+}
+
+void StateStore::mainPIDSet(ObjectIdx obj, pid_t pid)
+{
+    if (mainPID(obj) == pid)
+        return;
+
+    touch(obj);
+    mainPIDs[obj] = pid;
+}
+
+void StateStore::flush(bool final)
+{
+    std::vector<LiveInstanceRecord> records;
+    struct timespec ts;
+    int64_t epochOffset;
+
+    if ((writing && !final) || dirty.empty())
+        return;
+
+    if (timer != -1)
+    {
+        loop->delTimer(timer);
+        timer = -1;
+    }
+
+    /* timestamps are kept monotonic, but written as wall-clock time */
+    clock_gettime(CLOCK_REALTIME, &ts);
+    epochOffset = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 -
+                  (int64_t)Scheduler::now();
+
+    for (ObjectIdx obj : dirty)
+    {
+        const Object &object = graph->object(obj);
+
+        isDirty[obj] = false;
+        /* only instances are recorded; other objects have no row */
+        if (!object.instanceID)
+            continue;
+        records.push_back({object.name, object.instanceID,
+                           stateName((State)states[obj]), mainPIDs[obj],
+                           (int64_t)sinces[obj] + epochOffset,
+                           generations[obj]});
+    }
+    dirty.clear();
+
+    if (records.empty())
+        return;
+
+    writing = true;
+    bend->submit(new LiveStateWriteJob(this, std::move(records)));
+}
+
+void StateStore::writeDone(int res)
+{
+    writing = false;
+    if (res != 0)
+        log(kWarn, "Failed to write live state to the volatile repository\n");
+    if (!dirty.empty())
+        writeSchedule();
+}
+
+void StateStore::timerEvent(EventLoop *loop, int id)
+{
+    timer = -1;
+    flush();
+}
@@ -0,0 +1,144 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef STATESTORE_HH__
+#define STATESTORE_HH__
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Graph.hh"
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+
+class Backend;
+
+/** A live instance's state as it is to be written to the volatile repo. */
+struct LiveInstanceRecord
+{
+    std::string name;
+    /** ID of the instance in the persistent repository. */
+    int instanceID;
+    const char *state;
+    pid_t mainPID;
+    /** When it entered its state, in microseconds since the Epoch. */
+    int64_t since;
+    uint32_t generation;
+};
+
+/**
+ * The live state of every object: its state, main process, when it entered
+ * its state, and a generation number bumped on every change, by which a
+ * reader may tell whether what it saw earlier still holds.
+ *
+ * The state is kept in memory, a column to each field indexed by ObjectIdx,
+ * so that it may be read and updated on the event loop without touching
+ * SQLite, and so that a scan over one field touches no others. Changes are
+ * written behind to the volatile repository's LiveInstances, in one DB job
+ * per kWriteDelayNSecs at most; changes made while a write is in progress
+ * go out with the next.
+ */
+class StateStore : public Handler, public Logger
+{
+  public:
+    enum State
+    {
+        kOffline,
+        kStarting,
+        kOnline,
+        kStopping,
+        kFailed,
+        /** Its sockets are bound and watched, and it starts on activity. */
+        kListening,
+    };
+
+  private:
+    friend class LiveStateWriteJob;
+
+    Backend *bend;
+    EventLoop *loop;
+    const Graph *graph;
+
+    std::vector<uint8_t> states;
+    std::vector<pid_t> mainPIDs;
+    /** When each entered its state, in microseconds of Scheduler::now(). */
+    std::vector<uint64_t> sinces;
+    std::vector<uint32_t> generations;
+
+    /** Objects changed since last written, and whether each is among them. */
+    std::vector<ObjectIdx> dirty;
+    std::vector<bool> isDirty;
+
+    /** Whether a write is in progress. */
+    bool writing = false;
+    /** Timer to write out changes, or -1. */
+    int timer = -1;
+
+    /** Make room for \p obj, and mark it changed. */
+    void touch(ObjectIdx obj);
+    /** Set the timer to write out changes, unless set or writing. */
+    void writeSchedule();
+    /** A write has finished, with the result \p res. */
+    void writeDone(int res);
+
+    /* event handlers */
+    void timerEvent(EventLoop *loop, int id);
+
+  public:
+    static const long kWriteDelayNSecs = 50000000;
+
+    StateStore(Logger *parent, Backend *bend, EventLoop *loop,
+               const Graph *graph)
+        : Logger("state", parent), bend(bend), loop(loop), graph(graph){};
+
+    static const char *stateName(State state);
+
+    State state(ObjectIdx obj) const
+    {
+        return obj < (ObjectIdx)states.size() ? (State)states[obj] : kOffline;
+    }
+    /** @returns the main process of \p obj, or 0 if it has none. */
+    pid_t mainPID(ObjectIdx obj) const
+    {
+        return obj < (ObjectIdx)mainPIDs.size() ? mainPIDs[obj] : 0;
+    }
+    uint64_t since(ObjectIdx obj) const
+    {
+        return obj < (ObjectIdx)sinces.size() ? sinces[obj] : 0;
+    }
+    uint32_t generation(ObjectIdx obj) const
+    {
+        return obj < (ObjectIdx)generations.size() ? generations[obj] : 0;
+    }
+
+    /** Set the state of \p obj, if it is not already in it. */
+    void stateSet(ObjectIdx obj, State state);
+    /** Set the main process of \p obj, or clear it if \p pid is 0. */
+    void mainPIDSet(ObjectIdx obj, pid_t pid);
+
+    /**
+     * Write out the changes made since last written. Unless \p final, not
+     * while a write is in progress; if \p final, as when shutting down, they
+     * are written behind it, as DB jobs run in the order submitted.
+     */
+    void flush(bool final = false);
+};
+
+#endif
@@ -0,0 +1,245 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Timeline.hh"
+#include "ucl.h"
+
+static const char *kindName(Task::Kind kind)
+{
+    return kind == Task::kStart ? "start" : "stop";
+}
+
+/* a task finishes either way exactly once */
+static uint64_t finishTime(const uint64_t times[])
+{
+    return times[Task::kTimeReady] ? times[Task::kTimeReady]
+                                   : times[Task::kTimeFailed];
+}
+
+static double msecs(uint64_t usecs)
+{
+    return usecs / 1000.0;
+}
+
+int Timeline::transactionRecord(const Graph &graph, const Scheduler &sched,
+                                const Transaction &tx)
+{
+    TransactionRecord rec;
+
+    if (nTasks + tx.tasks.size() > kMaxTasks)
+        return -1;
+
+    rec.submitted = tx.submitted;
+    for (auto &task : tx.tasks)
+    {
+        TaskRecord taskRec = {task.kind,
+                              task.state,
+                              graph.object(task.obj).name,
+                              sched.className(task.resClass),
+                              {},
+                              task.gatedBy};
+
+        std::copy(task.times, task.times + Task::kTimeMax, taskRec.times);
+        rec.tasks.push_back(std::move(taskRec));
+    }
+
+    nTasks += tx.tasks.size();
+    transactions.push_back(std::move(rec));
+    return 0;
+}
+
+std::string Timeline::traceEvents() const
+{
+    ucl_object_t *top = ucl_object_typed_new(UCL_OBJECT);
+    ucl_object_t *events = ucl_object_typed_new(UCL_ARRAY);
+    std::string result;
+    char *json;
+
+#define Key(obj, key, val)                                                     \
+    ucl_object_insert_key(obj, val, key, 0, false)
+
+    for (size_t i = 0; i < transactions.size(); i++)
+    {
+        const TransactionRecord &tx = transactions[i];
+        const TaskRecord &root = tx.tasks[0];
+        ucl_object_t *meta = ucl_object_typed_new(UCL_OBJECT);
+        ucl_object_t *args = ucl_object_typed_new(UCL_OBJECT);
+        std::vector<size_t> byDispatch;
+        /* when each lane becomes free; tasks overlapping go on new lanes */
+        std::vector<uint64_t> laneFree;
+
+        /* each transaction is shown as a process, named for its object */
+        Key(args, "name",
+            ucl_object_fromstring(
+                (kindName(root.kind) + (" " + root.name)).c_str()));
+        Key(meta, "name", ucl_object_fromstring("process_name"));
+        Key(meta, "ph", ucl_object_fromstring("M"));
+        Key(meta, "pid", ucl_object_fromint(i + 1));
+        Key(meta, "args", args);
+        ucl_array_append(events, meta);
+
+        for (size_t j = 0; j < tx.tasks.size(); j++)
+            byDispatch.push_back(j);
+        std::sort(byDispatch.begin(), byDispatch.end(),
+                  [&](size_t a, size_t b) {
+                      return tx.tasks[a].times[Task::kTimeDispatched] <
+                             tx.tasks[b].times[Task::kTimeDispatched];
+                  });
+
+        for (size_t j : byDispatch)
+        {
+            const TaskRecord &task = tx.tasks[j];
+            uint64_t dispatched = task.times[Task::kTimeDispatched];
+            uint64_t finished = finishTime(task.times);
+            ucl_object_t *ev = ucl_object_typed_new(UCL_OBJECT);
+            ucl_object_t *evArgs = ucl_object_typed_new(UCL_OBJECT);
+            size_t lane;
+
+            Key(ev, "name",
+                ucl_object_fromstring(
+                    (kindName(task.kind) + (" " + task.name)).c_str()));
+            Key(ev, "cat", ucl_object_fromstring(task.resClass.c_str()));
+            Key(ev, "pid", ucl_object_fromint(i + 1));
+            Key(evArgs, "result",
+                ucl_object_fromstring(task.state == Task::kComplete
+                                          ? "ready"
+                                          : "failed"));
+
+            /* a task failed for want of a requirement never ran */
+            if (!dispatched)
+            {
+                Key(ev, "ph", ucl_object_fromstring("i"));
+                Key(ev, "s", ucl_object_fromstring("p"));
+                Key(ev, "ts", ucl_object_fromint(finished));
+                Key(ev, "args", evArgs);
+                ucl_array_append(events, ev);
+                continue;
+            }
+
+            for (lane = 0; lane < laneFree.size(); lane++)
+                if (laneFree[lane] <= dispatched)
+                    break;
+            if (lane == laneFree.size())
+                laneFree.push_back(0);
+            laneFree[lane] = finished;
+
+            Key(evArgs, "queued_us",
+                ucl_object_fromint(dispatched -
+                                   task.times[Task::kTimeEnqueued]));
+            if (task.times[Task::kTimeForked])
+                Key(evArgs, "fork_us",
+                    ucl_object_fromint(task.times[Task::kTimeForked] -
+                                       dispatched));
+            if (task.gatedBy != -1)
+            {
+                const TaskRecord &gate = tx.tasks[task.gatedBy];
+
+                Key(evArgs, "gated_by",
+                    ucl_object_fromstring(
+                        (kindName(gate.kind) + (" " + gate.name)).c_str()));
+            }
+
+            Key(ev, "ph", ucl_object_fromstring("X"));
+            Key(ev, "ts", ucl_object_fromint(dispatched));
+            Key(ev, "dur", ucl_object_fromint(finished - dispatched));
+            Key(ev, "tid", ucl_object_fromint(lane + 1));
+            Key(ev, "args", evArgs);
+            ucl_array_append(events, ev);
+        }
+    }
+
+    Key(top, "traceEvents", events);
+    Key(top, "displayTimeUnit", ucl_object_fromstring("ms"));
+#undef Key
+
+    json = (char *)ucl_object_emit(top, UCL_EMIT_JSON_COMPACT);
+    result = json;
+    free(json);
+    ucl_object_unref(top);
+    return result;
+}
+
+std::string Timeline::criticalPath() const
+{
+    std::string out;
+    char line[256];
+
+    for (size_t i = 0; i < transactions.size(); i++)
+    {
+        const TransactionRecord &tx = transactions[i];
+        std::vector<int> path;
+        int last = 0;
+        uint64_t lastFinished = 0;
+        size_t nFailed = 0;
+
+        for (size_t j = 0; j < tx.tasks.size(); j++)
+        {
+            if (finishTime(tx.tasks[j].times) > lastFinished)
+            {
+                last = j;
+                lastFinished = finishTime(tx.tasks[j].times);
+            }
+            if (tx.tasks[j].state == Task::kFailed)
+                nFailed++;
+        }
+
+        for (int task = last; task != -1; task = tx.tasks[task].gatedBy)
+            path.push_back(task);
+        std::reverse(path.begin(), path.end());
+
+        snprintf(line, sizeof(line), "Transaction %zu, %s ", i + 1,
+                 kindName(tx.tasks[0].kind));
+        out += line + tx.tasks[0].name;
+        snprintf(line, sizeof(line), ": %zu tasks, %zu failed, %.3f ms\n",
+                 tx.tasks.size(), nFailed, msecs(lastFinished - tx.submitted));
+        out += line;
+        snprintf(line, sizeof(line), "  %10s %10s %10s %10s  %s\n", "at ms",
+                 "queued ms", "fork ms", "ran ms", "task");
+        out += line;
+
+        for (int task : path)
+        {
+            const TaskRecord &rec = tx.tasks[task];
+            uint64_t dispatched = rec.times[Task::kTimeDispatched];
+            uint64_t finished = finishTime(rec.times);
+            char queued[16] = "-", forked[16] = "-", ran[16] = "-";
+
+            if (dispatched)
+            {
+                snprintf(queued, sizeof(queued), "%.3f",
+                         msecs(dispatched - rec.times[Task::kTimeEnqueued]));
+                snprintf(ran, sizeof(ran), "%.3f",
+                         msecs(finished - dispatched));
+            }
+            if (rec.times[Task::kTimeForked])
+                snprintf(forked, sizeof(forked), "%.3f",
+                         msecs(rec.times[Task::kTimeForked] - dispatched));
+
+            snprintf(line, sizeof(line), "  %10.3f %10s %10s %10s  %s ",
+                     msecs(finished - tx.submitted), queued, forked, ran,
+                     kindName(rec.kind));
+            out += line + rec.name +
+                   (rec.state == Task::kFailed ? " (failed)\n" : "\n");
+        }
+    }
+
+    return out;
+}
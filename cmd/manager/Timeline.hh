@@ -0,0 +1,87 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#ifndef TIMELINE_HH__
+#define TIMELINE_HH__
+
+#include <string>
+#include <vector>
+
+#include "Scheduler.hh"
+
+/**
+ * A record of when the tasks of finished transactions ran, from which it may
+ * be seen which instances held up boot. Transactions are recorded from the
+ * manager's start until kMaxTasks tasks have been; later ones are not, so
+ * that the record of boot is kept whole while memory stays bounded.
+ */
+class Timeline
+{
+    struct TaskRecord
+    {
+        Task::Kind kind;
+        Task::State state;
+        std::string name;
+        std::string resClass;
+        uint64_t times[Task::kTimeMax];
+        int gatedBy;
+    };
+
+    struct TransactionRecord
+    {
+        uint64_t submitted;
+        std::vector<TaskRecord> tasks;
+    };
+
+    std::vector<TransactionRecord> transactions;
+    size_t nTasks = 0;
+
+  public:
+    enum Format
+    {
+        /**
+         * The Trace Event Format of Chrome's about:tracing and Perfetto: a
+         * JSON object whose traceEvents are a span for each task run.
+         */
+        kTraceEvents,
+        /** Text listing each transaction's critical path. */
+        kCriticalPath,
+    };
+
+    static const size_t kMaxTasks = 65536;
+
+    /**
+     * Record a finished transaction.
+     *
+     * @returns 0 if successful.
+     * @returns -1 if it was not recorded, the record being full.
+     */
+    int transactionRecord(const Graph &graph, const Scheduler &sched,
+                          const Transaction &tx);
+
+    /** @returns the record in the Trace Event Format. */
+    std::string traceEvents() const;
+    /**
+     * @returns a report of each recorded transaction's critical path: the
+     * chain of tasks, each gated by the one before, which ended with the last
+     * to finish. Shortening any other task would not have finished the
+     * transaction sooner.
+     */
+    std::string criticalPath() const;
+};
+
+#endif
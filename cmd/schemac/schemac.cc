@@ -0,0 +1,342 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+/**
+ * schemac compiles a JSON Schema into a C++ header defining an ECISchema (see
+ * eci/Schema.hh) named k<name>, for documents to be validated against it
+ * without the schema being parsed or interpreted at runtime.
+ *
+ * Usage: schemac -n <name> -o <output.hh> <schema.json>
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "ucl.h"
+
+struct Node
+{
+    std::string types = "0";
+    std::vector<std::pair<std::string, int>> props;
+    std::vector<std::string> required;
+    int additional = -1; /* kSchemaAny */
+    int items = -1;
+    std::vector<int> anyOf;
+};
+
+class Compiler
+{
+    const ucl_object_t *top;
+    const char *path;
+    std::vector<Node> nodes;
+    /* nodes already compiled, so that $refs are shared and may recurse */
+    std::map<const ucl_object_t *, int> compiled;
+
+    [[noreturn]] void fail(const char *fmt, const char *arg);
+    const ucl_object_t *resolve(const char *ref);
+    std::string compileTypes(const ucl_object_t *obj);
+    int compileSub(const ucl_object_t *obj, bool permitBool);
+
+  public:
+    Compiler(const ucl_object_t *top, const char *path)
+        : top(top), path(path){};
+
+    int compile(const ucl_object_t *obj);
+    std::string emit(const std::string &name, int root);
+};
+
+void Compiler::fail(const char *fmt, const char *arg)
+{
+    fprintf(stderr, "schemac: %s: ", path);
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+/* Resolve a JSON pointer local to the document, e.g. #/definitions/Class */
+const ucl_object_t *Compiler::resolve(const char *ref)
+{
+    const ucl_object_t *obj = top;
+    std::string rest;
+    size_t pos = 2;
+
+    if (strncmp(ref, "#/", 2))
+        fail("unsupported $ref %s", ref);
+
+    rest = ref;
+    while (obj && pos <= rest.size())
+    {
+        size_t next = rest.find('/', pos);
+        std::string key = rest.substr(pos, next - pos);
+
+        obj = ucl_object_lookup(obj, key.c_str());
+        pos = next == std::string::npos ? rest.size() + 1 : next + 1;
+    }
+
+    if (!obj)
+        fail("unresolvable $ref %s", ref);
+
+    return obj;
+}
+
+std::string Compiler::compileTypes(const ucl_object_t *obj)
+{
+    static const std::map<std::string, std::string> kinds = {
+        {"object", "kSchemaObject"},   {"array", "kSchemaArray"},
+        {"string", "kSchemaString"},   {"integer", "kSchemaInteger"},
+        {"number", "kSchemaNumber"},   {"boolean", "kSchemaBoolean"},
+        {"null", "kSchemaNull"}};
+    ucl_object_iter_t it = NULL;
+    const ucl_object_t *type;
+    std::string types;
+
+    while ((type = ucl_iterate_object(obj, &it, true)))
+    {
+        auto kind = kinds.find(ucl_object_tostring_forced(type));
+
+        if (kind == kinds.end())
+            fail("unknown type %s", ucl_object_tostring_forced(type));
+
+        types += (types.empty() ? "" : " | ") + kind->second;
+    }
+
+    return types;
+}
+
+/* A subschema; or, if permitBool, true (anything) or false (nothing.) */
+int Compiler::compileSub(const ucl_object_t *obj, bool permitBool)
+{
+    if (permitBool && ucl_object_type(obj) == UCL_BOOLEAN)
+        return ucl_object_toboolean(obj) ? -1 : -2;
+    else if (ucl_object_type(obj) != UCL_OBJECT)
+        fail("subschema of %s is not an object", ucl_object_key(obj));
+
+    return compile(obj);
+}
+
+int Compiler::compile(const ucl_object_t *obj)
+{
+    const ucl_object_t *ref = ucl_object_lookup(obj, "$ref");
+    ucl_object_iter_t it = NULL;
+    const ucl_object_t *kw;
+    int iNode;
+
+    /* other keywords beside a $ref are ignored */
+    if (ref)
+        return compile(resolve(ucl_object_tostring_forced(ref)));
+
+    if (compiled.count(obj))
+        return compiled[obj];
+
+    iNode = nodes.size();
+    compiled[obj] = iNode;
+    nodes.emplace_back();
+
+    while ((kw = ucl_iterate_object(obj, &it, true)))
+    {
+        const char *key = ucl_object_key(kw);
+
+        if (!strcmp(key, "type"))
+            nodes[iNode].types = compileTypes(kw);
+        else if (!strcmp(key, "properties"))
+        {
+            ucl_object_iter_t propIt = NULL;
+            const ucl_object_t *prop;
+
+            while ((prop = ucl_iterate_object(kw, &propIt, true)))
+            {
+                int iProp = compileSub(prop, false);
+                nodes[iNode].props.emplace_back(ucl_object_key(prop), iProp);
+            }
+        }
+        else if (!strcmp(key, "required"))
+        {
+            ucl_object_iter_t reqIt = NULL;
+            const ucl_object_t *req;
+
+            while ((req = ucl_iterate_object(kw, &reqIt, true)))
+                nodes[iNode].required.push_back(
+                    ucl_object_tostring_forced(req));
+        }
+        else if (!strcmp(key, "additionalProperties"))
+        {
+            int iAdditional = compileSub(kw, true);
+            nodes[iNode].additional = iAdditional;
+        }
+        else if (!strcmp(key, "items"))
+        {
+            int iItems = compileSub(kw, false);
+            nodes[iNode].items = iItems;
+        }
+        else if (!strcmp(key, "anyOf"))
+        {
+            ucl_object_iter_t altIt = NULL;
+            const ucl_object_t *alt;
+
+            while ((alt = ucl_iterate_object(kw, &altIt, true)))
+            {
+                int iAlt = compileSub(alt, false);
+                nodes[iNode].anyOf.push_back(iAlt);
+            }
+        }
+        /* annotations, and additionalItems, which without tuple-typed items
+         * has no effect */
+        else if (strcmp(key, "$schema") && strcmp(key, "definitions") &&
+                 strcmp(key, "description") && strcmp(key, "title") &&
+                 strcmp(key, "additionalItems"))
+            fail("unsupported keyword %s", key);
+    }
+
+    return iNode;
+}
+
+static std::string quote(const std::string &str)
+{
+    std::string out = "\"";
+
+    for (char c : str)
+        if (c == '"' || c == '\\')
+            out += std::string("\\") + c;
+        else
+            out += c;
+
+    return out + "\"";
+}
+
+std::string Compiler::emit(const std::string &name, int root)
+{
+    std::string nodesOut, propsOut, requiredOut, anyOfOut;
+    int nProps = 0, nRequired = 0, nAnyOf = 0;
+
+    for (auto &node : nodes)
+    {
+        std::sort(node.props.begin(), node.props.end());
+
+        nodesOut += "    {" + node.types + ", " + std::to_string(nProps) +
+                    ", " + std::to_string(node.props.size()) + ", " +
+                    std::to_string(nRequired) + ", " +
+                    std::to_string(node.required.size()) + ", " +
+                    std::to_string(node.additional) + ", " +
+                    std::to_string(node.items) + ", " +
+                    std::to_string(nAnyOf) + ", " +
+                    std::to_string(node.anyOf.size()) + "},\n";
+
+        for (auto &prop : node.props)
+            propsOut += "    {" + quote(prop.first) + ", " +
+                        std::to_string(prop.second) + "},\n";
+        for (auto &req : node.required)
+            requiredOut += "    " + quote(req) + ",\n";
+        for (auto alt : node.anyOf)
+            anyOfOut += "    " + std::to_string(alt) + ",\n";
+
+        nProps += node.props.size();
+        nRequired += node.required.size();
+        nAnyOf += node.anyOf.size();
+    }
+
+    /* zero-length arrays aren't permitted */
+    if (propsOut.empty())
+        propsOut = "    {NULL, 0},\n";
+    if (requiredOut.empty())
+        requiredOut = "    NULL,\n";
+    if (anyOfOut.empty())
+        anyOfOut = "    0,\n";
+
+    const char *baseName = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+    return "/* Generated by schemac from " + std::string(baseName) +
+           ". Do not edit. */\n"
+           "#pragma once\n\n"
+           "#include \"eci/Schema.hh\"\n\n"
+           "static const ECISchemaNode k" +
+           name + "_nodes[] = {\n" + nodesOut +
+           "};\n\n"
+           "static const ECISchemaProp k" +
+           name + "_props[] = {\n" + propsOut +
+           "};\n\n"
+           "static const char *const k" +
+           name + "_required[] = {\n" + requiredOut +
+           "};\n\n"
+           "static const int k" +
+           name + "_anyOf[] = {\n" + anyOfOut +
+           "};\n\n"
+           "static const ECISchema k" +
+           name + " = {\n    " + std::to_string(root) + ", k" + name +
+           "_nodes, k" + name + "_props,\n    k" + name + "_required, k" +
+           name + "_anyOf};\n";
+}
+
+int main(int argc, char *argv[])
+{
+    struct ucl_parser *parser;
+    ucl_object_t *top;
+    std::string name, outName;
+    char c;
+    int root;
+
+    while ((c = getopt(argc, argv, "n:o:")) != -1)
+        switch (c)
+        {
+        case 'n':
+            name = optarg;
+            break;
+        case 'o':
+            outName = optarg;
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: schemac -n <name> -o <output.hh> <schema.json>\n");
+            return 1;
+        }
+
+    if (name.empty() || outName.empty() || argc - optind != 1)
+    {
+        fprintf(stderr,
+                "Usage: schemac -n <name> -o <output.hh> <schema.json>\n");
+        return 1;
+    }
+
+    parser = ucl_parser_new(0);
+    ucl_parser_add_file(parser, argv[optind]);
+
+    if (ucl_parser_get_error(parser))
+    {
+        fprintf(stderr, "schemac: %s: %s\n", argv[optind],
+                ucl_parser_get_error(parser));
+        return 1;
+    }
+
+    top = ucl_parser_get_object(parser);
+    ucl_parser_free(parser);
+
+    Compiler compiler(top, argv[optind]);
+    root = compiler.compile(top);
+
+    std::ofstream out(outName);
+    out << compiler.emit(name, root);
+    out.close();
+
+    ucl_object_unref(top);
+
+    return out.fail() ? 1 : 0;
+}
@@ -16,6 +16,9 @@ included with this software
 ********************************************************************/
 
 #include <sys/time.h>
+#include <sys/types.h>
+
+#include <stddef.h>
 
 #include "eci/Platform.h"
 
@@ -46,6 +49,92 @@ extern "C"
      */
     void eciPendingProcessContinue(ECIPendingProcess *pwait);
 
+    /** An action to take on the file descriptors of a spawned process. */
+    typedef struct ECISpawnFDAction
+    {
+        enum
+        {
+            /** Close \p fd. */
+            kECISpawnClose,
+            /**
+             * Duplicate \p fd onto \p newFD. If they are the same, \p fd is
+             * instead kept open across the exec.
+             */
+            kECISpawnDup,
+            /** Open \p path with \p oflag and \p mode onto \p newFD. */
+            kECISpawnOpen,
+        } kind;
+        int fd;
+        int newFD;
+        const char *path;
+        int oflag;
+        mode_t mode;
+    } ECISpawnFDAction;
+
+    typedef struct ECISpawnAttr
+    {
+        /**
+         * NULL-terminated argument vector. argv[0] is the program, searched
+         * for in the PATH if it has no slash.
+         */
+        char *const *argv;
+        /** NULL-terminated environment, or NULL to pass on our own. */
+        char *const *envp;
+        /**
+         * Actions taken in order on the child's file descriptors, after the
+         * manner of posix_spawn_file_actions_t. Descriptors not named here are
+         * inherited unless close-on-exec.
+         */
+        const ECISpawnFDAction *fdActions;
+        size_t nFDActions;
+        /** Whether the child should begin a new session. */
+        int newSession;
+        /**
+         * Whether the child should be our parent's rather than ours, as are
+         * those the manager's fork server spawns. Only supported on Linux.
+         */
+        int forParent;
+        /**
+         * If non-NULL, the cgroup.procs file of a (v2) cgroup which the child
+         * enters before anything else, so that all it forks is born there.
+         */
+        const char *cgroupProcs;
+        /**
+         * If non-NULL, the name of a variable to be set in the child's
+         * environment to its own PID, as LISTEN_PID must be for socket
+         * activation.
+         */
+        const char *pidEnv;
+    } ECISpawnAttr;
+
+    /**
+     * Split a command at spaces into an argument vector for eciSpawn(). The
+     * vector and its strings are one allocation, so that it may be built once,
+     * kept for as long as it is needed, and freed with free().
+     *
+     * @returns the vector, or NULL if out of memory.
+     */
+    char **eciArgvBuild(const char *cmd);
+
+    /**
+     * Spawn a process running the program \p attr describes. The child
+     * borrows our address space until it has exec'd, as with vfork(), rather
+     * than copying our page tables as fork() would; so spawning costs the same
+     * however large we grow.
+     *
+     * The child's signal handlers are reset and its signal mask cleared. If the
+     * exec or any of the file actions fails, the child reports the error over a
+     * close-on-exec pipe and exits; since we are suspended until the child has
+     * exec'd or exited, the pipe is read without blocking.
+     *
+     * @returns 0 if successful, with the child's PID in \p pid.
+     * @returns -errno if the child could not be created or could not exec. A
+     * child which could not exec has been reaped, unless \p attr->forParent,
+     * in which case it is left to our parent and its PID is still stored.
+     * @returns -ENOTSUP if \p attr->forParent is not supported.
+     */
+    int eciSpawn(const ECISpawnAttr *attr, pid_t *pid);
+
     /**
      * Inspect the result of a wait() call. Returns 0 for a healthy exit, and
      * either signal number or return code if not.
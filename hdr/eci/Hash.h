@@ -0,0 +1,51 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2015-2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+/**
+ * Non-cryptographic content hashing
+ */
+
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Hash \p len bytes at \p data with the 64-bit xxHash algorithm (XXH64),
+     * starting from \p seed. The result is the same on all platforms.
+     */
+    uint64_t eciHash64(const void *data, size_t len, uint64_t seed);
+
+    /**
+     * Hash the contents of the file at \p path with eciHash64() and a seed of
+     * 0. The file is mapped into memory rather than read.
+     *
+     * @returns 0 if successful.
+     * @returns -errno if the file could not be opened or mapped.
+     */
+    int eciHashFile(const char *path, uint64_t *hash);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
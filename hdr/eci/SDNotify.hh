@@ -16,4 +16,151 @@ included with this software
 ********************************************************************/
 /**
  * SystemD-Notify server
- */
\ No newline at end of file
+ */
+
+#ifndef ECI_SDNOTIFY_HH__
+#define ECI_SDNOTIFY_HH__
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+#include "eci/Platform.h"
+
+struct msghdr;
+
+/**
+ * A notification, as parsed from a message. Its strings point into the
+ * message, and are valid only for as long as the delegate is being told of
+ * it; fields not in the message are left zero or NULL.
+ */
+struct SDNotifyMsg
+{
+    /** Credentials of the sender, or -1 if they could not be had. */
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+
+    /** READY=1, RELOADING=1, STOPPING=1 */
+    bool ready, reloading, stopping;
+    /** STATUS= */
+    const char *status;
+    /** ERRNO= */
+    int errnum;
+    /** MAINPID=, or 0 */
+    pid_t mainPID;
+    /** WATCHDOG=1, WATCHDOG=trigger */
+    bool watchdog, watchdogTrigger;
+    /** WATCHDOG_USEC=, or 0 */
+    uint64_t watchdogUsec;
+    /** FDSTORE=1, FDSTOREREMOVE=1 */
+    bool fdStore, fdStoreRemove;
+    /** FDNAME= */
+    const char *fdName;
+
+    /**
+     * FDs sent with it. The delegate may keep any, setting them to -1 here;
+     * the rest are closed once it returns. A BARRIER=1 is answered by just
+     * this closing of the FD sent with it.
+     */
+    int *fds;
+    size_t nFDs;
+};
+
+struct SDNotifyDelegate
+{
+    /** A well-formed notification \p msg has been received. */
+    virtual void notifyReceived(SDNotifyMsg &msg) = 0;
+};
+
+/**
+ * Receives sd_notify(3) notifications on a socket bound at the path given to
+ * listen(), to which NOTIFY_SOCKET is set for those who are to send them.
+ *
+ * Where ECI_SD_NOTIFY_TYPE is "datagram", as with systemd, each notification
+ * is a datagram, which the kernel marks with the credentials of its sender.
+ * They are drained with recvmmsg(), kBatch at a time, into buffers allocated
+ * once, and are parsed in place; those without credentials are dropped.
+ *
+ * Where it is "stream", for platforms which cannot pass credentials on Unix
+ * datagram sockets, each notification is sent over a connection of its own,
+ * and ends when the sender shuts it down; the credentials are the peer's, as
+ * the kernel records them when it connects. Where it is "insecure", likewise,
+ * but the credentials cannot be had, and so are left -1.
+ */
+class SDNotifyServer : public Handler, public Logger
+{
+    struct Conn;
+
+    SDNotifyDelegate *delegate;
+    EventLoop *loop;
+    std::string path;
+    int fd = -1;
+
+    /** Receive buffers, kBatch of each; allocated by listen(). */
+    std::vector<char> bufs;
+    std::vector<char> controls;
+
+    /** Connections yet to finish sending, by FD; for the stream variants. */
+    std::unordered_map<int, std::unique_ptr<Conn>> conns;
+
+    /** Drain the datagrams waiting on the socket. */
+    void datagramsDrain();
+    /** Check and deliver the datagram of \p len bytes received in \p mh. */
+    void datagramReceived(struct msghdr *mh, size_t len);
+    /** Accept the connections waiting on the socket. */
+    void connsAccept();
+    /** Read what \p conn has sent, and deliver it once it is finished. */
+    void connRead(Conn &conn);
+    void connClose(int fd);
+    /** Parse \p len bytes of \p buf, and deliver the result. */
+    void deliver(char *buf, size_t len, SDNotifyMsg &msg);
+
+    /* event handlers */
+    void fdEvent(EventLoop *loop, int fd, int revents);
+
+  public:
+    /** Most datagrams received in one call. */
+    static const size_t kBatch = 32;
+    /** Largest notification accepted, less a byte to terminate it. */
+    static const size_t kMaxMsgBytes = 4096;
+    /** Most FDs accepted with a notification; more are closed unseen. */
+    static const size_t kMaxFDs = 32;
+
+    SDNotifyServer(Logger *parent, SDNotifyDelegate *delegate,
+                   EventLoop *loop);
+    ~SDNotifyServer();
+
+    /**
+     * Bind the socket at \p path, replacing any left there, and begin
+     * receiving on it.
+     *
+     * @returns 0 if successful.
+     * @returns -ENOTSUP if there is no SD-Notify interface on this platform.
+     * @returns -errno if the socket could not be set up.
+     */
+    int listen(const char *path);
+
+    /** @returns the path of the socket, or empty if not listening. */
+    const std::string &socketPath() const
+    {
+        return path;
+    }
+
+    /**
+     * Parse the notification in the \p len bytes of \p buf into \p msg, in
+     * place: each line is NUL-terminated where it ends, so \p buf must have
+     * room for one byte more. Nothing is allocated. Unknown variables are
+     * ignored, as are malformed values.
+     */
+    static void parse(char *buf, size_t len, SDNotifyMsg &msg);
+};
+
+#endif
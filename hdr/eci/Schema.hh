@@ -0,0 +1,95 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#pragma once
+
+#include <string>
+
+#include "ucl.h"
+
+/**
+ * A JSON Schema (draft-04) compiled to flat tables by schemac(1), so that
+ * documents may be validated without interpreting the schema each time. Only
+ * the subset of keywords used by our own schemas is supported: "type",
+ * "properties", "required", "additionalProperties", "items" (as a single
+ * schema), "anyOf", and "$ref" (resolved at compile time.)
+ */
+
+/** Bits of ECISchemaNode::types. */
+enum ECISchemaType
+{
+    kSchemaObject = 0x1,
+    kSchemaArray = 0x2,
+    kSchemaString = 0x4,
+    kSchemaInteger = 0x8,
+    kSchemaNumber = 0x10, /* implies integer */
+    kSchemaBoolean = 0x20,
+    kSchemaNull = 0x40,
+};
+
+/* Special values of ECISchemaNode::additional and ECISchemaNode::items. */
+enum
+{
+    /** Anything is permitted. */
+    kSchemaAny = -1,
+    /** Nothing is permitted. */
+    kSchemaNone = -2,
+};
+
+struct ECISchemaNode
+{
+    /** Permitted types; 0 if any. */
+    unsigned types;
+    /** Named properties, sorted by name, in ECISchema::props. */
+    int firstProp, nProps;
+    /** Required property names, in ECISchema::required. */
+    int firstRequired, nRequired;
+    /** Node against which other properties are validated, or special value. */
+    int additional;
+    /** Node against which array items are validated, or special value. */
+    int items;
+    /** Alternative nodes, one of which must validate, in ECISchema::anyOf. */
+    int firstAnyOf, nAnyOf;
+};
+
+struct ECISchemaProp
+{
+    const char *name;
+    int node;
+};
+
+struct ECISchema
+{
+    /** Node against which a document is validated. */
+    int root;
+    const ECISchemaNode *nodes;
+    const ECISchemaProp *props;
+    const char *const *required;
+    const int *anyOf;
+
+    /**
+     * Validate a document.
+     *
+     * @param err If validation fails, set to a description of why, prefixed
+     * with the JSON pointer of the offending element.
+     */
+    bool validate(const ucl_object_t *obj, std::string &err) const;
+
+  private:
+    bool validateNode(int iNode, const ucl_object_t *obj, std::string &path,
+                      std::string *err) const;
+};
@@ -17,6 +17,7 @@ included with this software
 
 #pragma once
 
+#include <cstdint>
 #include <list>
 #include <queue>
 #include <string>
@@ -30,12 +31,14 @@ typedef bool (*WSRPCDeserialisationFun)(const ucl_object_t *obj, void *out);
 ucl_object_t *wsRPCSerialisevoid(void *in);
 ucl_object_t *wsRPCSerialisebool(bool *in);
 ucl_object_t *wsRPCSerialiseint(int *in);
+ucl_object_t *wsRPCSerialiseint64_t(int64_t *in);
 ucl_object_t *wsRPCSerialisestring(std::string *in);
 
 /* this only checks if the object is of JSON type null */
 bool wsRPCDeserialisevoid(const ucl_object_t *obj, void *out);
 bool wsRPCDeserialisebool(const ucl_object_t *obj, bool *out);
 bool wsRPCDeserialiseint(const ucl_object_t *obj, int *out);
+bool wsRPCDeserialiseint64_t(const ucl_object_t *obj, int64_t *out);
 bool wsRPCDeserialisestring(const ucl_object_t *obj, std::string *out);
 
 class WSRPCTransport;
@@ -83,6 +86,13 @@ struct WSRPCReq
     ucl_object_t *result;
     /* error to send back, if needed */
     WSRPCError err;
+    /**
+     * If set by the method implementation function, no reply is sent when it
+     * returns, and any result is discarded. The implementation must instead
+     * reply later with WSRPCTransport::sendReply() or sendError(), using
+     * \p id, unless the transport has by then disconnected.
+     */
+    bool deferred;
 };
 
 /**
@@ -200,12 +210,13 @@ class WSRPCTransport
     /* Send an object.. */
     bool writeObj(ucl_object_t *obj);
 
-    void sendError(int id, WSRPCError &err);
-    void sendReply(int id, ucl_object_t *obj);
-
   public:
     int fd = -1;
 
+    /* Send an error reply, or a reply (taking ownership of \p obj.) */
+    void sendError(int id, WSRPCError &err);
+    void sendReply(int id, ucl_object_t *obj);
+
     /**
      * The "client" constructor - use when a transport is to serve as a client
      * to a server.
@@ -19,7 +19,10 @@ included with this software
 #include <sys/signal.h>
 #include <sys/wait.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +30,26 @@ included with this software
 
 #include "eci/Core.h"
 
+#ifdef ECI_PLAT_LINUX
+#include <sched.h>
+#endif
+
+extern char **environ;
+
+/** What a spawned child needs to know, in our address space. */
+typedef struct SpawnChild
+{
+    const ECISpawnAttr *attr;
+    /** The PATH to search, fetched by the parent. */
+    const char *searchPath;
+    /** Write end of the error pipe. */
+    int errFD;
+    /** The environment to exec with. */
+    char *const *envp;
+    /** Where in envp the child is to write its PID, or NULL. */
+    char *pidStr;
+} SpawnChild;
+
 int eciCloseOnExec(int fd)
 {
     int flags;
@@ -99,6 +122,367 @@ void eciPendingProcessContinue(ECIPendingProcess *pwait)
     free(pwait);
 }
 
+char **eciArgvBuild(const char *cmd)
+{
+    size_t nArgs = 0, len = strlen(cmd);
+    char **argv, *strs, *str;
+    const char *c;
+
+    for (c = cmd; *c; c++)
+        if (*c != ' ' && (c == cmd || c[-1] == ' '))
+            nArgs++;
+
+    argv = malloc(sizeof(char *) * (nArgs + 1) + len + 1);
+    if (!argv)
+        return NULL;
+
+    strs = (char *)(argv + nArgs + 1);
+    memcpy(strs, cmd, len + 1);
+    nArgs = 0;
+    for (str = strs; *str; str++)
+        if (*str == ' ')
+            *str = '\0';
+        else if (str == strs || str[-1] == '\0')
+            argv[nArgs++] = str;
+    argv[nArgs] = NULL;
+
+    return argv;
+}
+
+/*
+ * Exec the program, searching the PATH as execvp() does. We may not allocate
+ * here, so the paths tried are built on the stack.
+ */
+static void spawnExec(SpawnChild *sc)
+{
+    const char *file = sc->attr->argv[0];
+    char *const *envp = sc->envp;
+    const char *dir = sc->searchPath, *end;
+    char path[MAXPATHLEN];
+    size_t fileLen = strlen(file);
+    int err = ENOENT;
+
+    if (strchr(file, '/'))
+    {
+        execve(file, sc->attr->argv, envp);
+        return;
+    }
+
+    for (; dir; dir = *end ? end + 1 : NULL)
+    {
+        size_t dirLen;
+
+        end = strchr(dir, ':');
+        if (!end)
+            end = dir + strlen(dir);
+        dirLen = end - dir;
+
+        if (dirLen + fileLen + 2 > sizeof(path))
+            continue;
+        /* an empty entry is the current directory */
+        memcpy(path, dir, dirLen);
+        if (dirLen)
+            path[dirLen++] = '/';
+        memcpy(path + dirLen, file, fileLen + 1);
+
+        execve(path, sc->attr->argv, envp);
+        /* a permission error is reported only if nothing else is found */
+        if (errno == EACCES)
+            err = EACCES;
+        else if (errno != ENOENT && errno != ENOTDIR)
+            return;
+    }
+
+    errno = err;
+}
+
+static int spawnFDActionsApply(SpawnChild *sc)
+{
+    const ECISpawnAttr *attr = sc->attr;
+    size_t i;
+    int maxFD = 0;
+    /* the descriptor each action duplicates, once out of harm's way */
+    int srcFDs[attr->nFDActions ? attr->nFDActions : 1];
+
+    /* move the error pipe out of the way of the descriptors we install */
+    for (i = 0; i < attr->nFDActions; i++)
+        if (attr->fdActions[i].newFD > maxFD)
+            maxFD = attr->fdActions[i].newFD;
+    if (sc->errFD <= maxFD)
+    {
+        int fd = fcntl(sc->errFD, F_DUPFD, maxFD + 1);
+
+        if (fd == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
+            return -1;
+        sc->errFD = fd;
+    }
+
+    /*
+     * Likewise each descriptor to be duplicated, lest an earlier action
+     * install another over it before it is duplicated itself.
+     */
+    for (i = 0; i < attr->nFDActions; i++)
+    {
+        const ECISpawnFDAction *act = &attr->fdActions[i];
+
+        srcFDs[i] = act->fd;
+        if (act->kind == kECISpawnDup && act->fd != act->newFD &&
+            act->fd <= maxFD)
+        {
+            srcFDs[i] = fcntl(act->fd, F_DUPFD, maxFD + 1);
+            if (srcFDs[i] == -1 || fcntl(srcFDs[i], F_SETFD, FD_CLOEXEC) == -1)
+                return -1;
+        }
+    }
+
+    for (i = 0; i < attr->nFDActions; i++)
+    {
+        const ECISpawnFDAction *act = &attr->fdActions[i];
+        int fd;
+
+        switch (act->kind)
+        {
+        case kECISpawnClose:
+            close(act->fd);
+            break;
+
+        case kECISpawnDup:
+            if (act->fd == act->newFD)
+            {
+                if (fcntl(act->fd, F_SETFD, 0) == -1)
+                    return -1;
+            }
+            else if (dup2(srcFDs[i], act->newFD) == -1)
+                return -1;
+            break;
+
+        case kECISpawnOpen:
+            fd = open(act->path, act->oflag, act->mode);
+            if (fd == -1)
+                return -1;
+            if (fd != act->newFD)
+            {
+                if (dup2(fd, act->newFD) == -1)
+                    return -1;
+                close(fd);
+            }
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Move the calling process into the cgroup whose procs file is given. */
+static int spawnCGroupEnter(const char *procs)
+{
+    int fd = open(procs, O_WRONLY | O_CLOEXEC);
+    int r, err;
+
+    if (fd == -1)
+        return -1;
+    /* "0" stands for the writer */
+    r = write(fd, "0", 1);
+    err = errno;
+    close(fd);
+    errno = err;
+    return r == 1 ? 0 : -1;
+}
+
+/* Write \p pid in decimal to \p str, without the help of stdio. */
+static void spawnPIDFormat(char *str, pid_t pid)
+{
+    char digits[sizeof(pid_t) * 3];
+    int n = 0;
+
+    do
+        digits[n++] = '0' + pid % 10;
+    while ((pid /= 10) > 0);
+    while (n)
+        *str++ = digits[--n];
+    *str = '\0';
+}
+
+/*
+ * Copy the environment, less any variable named \p attr->pidEnv, and add that
+ * variable with room for the child to write in its PID, which it alone knows.
+ * The copy is one allocation, freed with free().
+ */
+static char **spawnPIDEnvBuild(SpawnChild *sc)
+{
+    const char *name = sc->attr->pidEnv;
+    size_t nameLen = strlen(name), nEnv, i, j = 0;
+    char **envp, *str;
+
+    for (nEnv = 0; sc->envp[nEnv]; nEnv++)
+        ;
+    envp = malloc(sizeof(char *) * (nEnv + 2) + nameLen + 1 +
+                  sizeof(pid_t) * 3 + 1);
+    if (!envp)
+        return NULL;
+
+    for (i = 0; i < nEnv; i++)
+        if (strncmp(sc->envp[i], name, nameLen) != 0 ||
+            sc->envp[i][nameLen] != '=')
+            envp[j++] = sc->envp[i];
+
+    str = (char *)(envp + nEnv + 2);
+    memcpy(str, name, nameLen);
+    str[nameLen] = '=';
+    sc->pidStr = str + nameLen + 1;
+    *sc->pidStr = '\0';
+    envp[j++] = str;
+    envp[j] = NULL;
+
+    sc->envp = envp;
+    return envp;
+}
+
+/*
+ * Runs in the child, in our address space, and so may call only
+ * async-signal-safe functions; it never returns.
+ */
+static int spawnChild(void *arg)
+{
+    SpawnChild *sc = arg;
+    struct sigaction dfl;
+    sigset_t none;
+    int sig, err;
+
+    /*
+     * Our handlers would run in the parent's memory, so reset them before
+     * unblocking signals. Those for SIGKILL and SIGSTOP cannot be set.
+     */
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    sigemptyset(&dfl.sa_mask);
+    for (sig = 1; sig < NSIG; sig++)
+        sigaction(sig, &dfl, NULL);
+
+    if (sc->pidStr)
+        spawnPIDFormat(sc->pidStr, getpid());
+
+    if ((sc->attr->cgroupProcs &&
+         spawnCGroupEnter(sc->attr->cgroupProcs) == -1) ||
+        (sc->attr->newSession && setsid() == -1) ||
+        spawnFDActionsApply(sc) == -1)
+        goto fail;
+
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    spawnExec(sc);
+
+fail:
+    err = errno;
+    write(sc->errFD, &err, sizeof(err));
+    _exit(127);
+    return 127;
+}
+
+int eciSpawn(const ECISpawnAttr *attr, pid_t *pid)
+{
+    SpawnChild sc;
+    sigset_t all, old;
+    char **pidEnvp = NULL;
+    int errPipe[2];
+    int err = 0;
+    ssize_t n;
+    pid_t newPid;
+#ifdef ECI_PLAT_LINUX
+    /* we are suspended while the child runs, so it may have this stack */
+    char stack[32768] __attribute__((aligned(16)));
+#endif
+
+#ifndef ECI_PLAT_LINUX
+    if (attr->forParent)
+        return -ENOTSUP;
+#endif
+
+    sc.attr = attr;
+    sc.searchPath = getenv("PATH");
+    if (!sc.searchPath)
+        sc.searchPath = "/bin:/usr/bin";
+    sc.envp = attr->envp ? attr->envp : environ;
+    sc.pidStr = NULL;
+
+    if (attr->pidEnv && !(pidEnvp = spawnPIDEnvBuild(&sc)))
+        return -ENOMEM;
+
+#ifdef ECI_PLAT_LINUX
+    if (pipe2(errPipe, O_CLOEXEC) == -1)
+    {
+        err = -errno;
+        free(pidEnvp);
+        return err;
+    }
+#else
+    if (pipe(errPipe) == -1)
+    {
+        err = -errno;
+        free(pidEnvp);
+        return err;
+    }
+    if (fcntl(errPipe[0], F_SETFD, FD_CLOEXEC) == -1 ||
+        fcntl(errPipe[1], F_SETFD, FD_CLOEXEC) == -1)
+    {
+        err = -errno;
+        close(errPipe[0]);
+        close(errPipe[1]);
+        free(pidEnvp);
+        return err;
+    }
+#endif
+    sc.errFD = errPipe[1];
+
+    /* no handler of ours may run in the child while it shares our memory */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+#ifdef ECI_PLAT_LINUX
+    newPid = clone(spawnChild, stack + sizeof(stack),
+                   CLONE_VM | CLONE_VFORK | SIGCHLD |
+                       (attr->forParent ? CLONE_PARENT : 0),
+                   &sc);
+#else
+    newPid = vfork();
+    if (newPid == 0)
+        spawnChild(&sc);
+#endif
+    if (newPid == -1)
+        err = -errno;
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    close(errPipe[1]);
+    /* the child has exec'd, with a copy of it, or has failed */
+    free(pidEnvp);
+
+    if (newPid == -1)
+    {
+        close(errPipe[0]);
+        return err;
+    }
+
+    /* the child has exec'd or exited by now, so this will not block */
+    do
+        n = read(errPipe[0], &err, sizeof(err));
+    while (n == -1 && errno == EINTR);
+    close(errPipe[0]);
+
+    if (n == sizeof(err))
+    {
+        if (attr->forParent)
+            *pid = newPid;
+        else
+            while (waitpid(newPid, NULL, 0) == -1 && errno == EINTR)
+                ;
+        return -err;
+    }
+
+    *pid = newPid;
+    return 0;
+}
+
 int eciExitWasAbnormal(int wstat)
 {
     if (WIFEXITED(wstat))
@@ -25,6 +25,7 @@ included with this software
 #include <cstring>
 #include <ctime>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -131,7 +132,7 @@ int EventLoop::addTimer(Handler *handler, struct timespec *ts)
     int entryId = -1;
     int r;
 
-    for (int i = 0; i < 256; i++)
+    for (int i = 0; i < 255; i++)
         if (!timers[i].valid)
         {
             entryId = i;
@@ -211,7 +212,7 @@ int EventLoop::delFD(int fd)
     for (int i = 0; i < nPFDs; i++)
         if (pFDs[i].fd == fd)
         {
-            memmove(&pFDs[i], &pFDs[i + 1], sizeof(*pFDs) * (nPFDs - i));
+            memmove(&pFDs[i], &pFDs[i + 1], sizeof(*pFDs) * (nPFDs - i - 1));
             nPFDs--;
             return 0;
         }
@@ -262,12 +263,19 @@ int EventLoop::init()
     for (int i = 0; i < NSIG; i++)
         signalsFired[i] = false;
 
-    for (int i = 0; i < 256; i++)
+    for (int i = 0; i < 255; i++)
         timers[i].valid = false;
 
     if (pipe(sigPipe) == -1)
         return -errno;
 
+    /* the handler must never block on it, nor we on draining it */
+    for (int i = 0; i < 2; i++)
+        if (fcntl(sigPipe[i], F_SETFL,
+                  fcntl(sigPipe[i], F_GETFL) | O_NONBLOCK) == -1 ||
+            fcntl(sigPipe[i], F_SETFD, FD_CLOEXEC) == -1)
+            return -errno;
+
     r = addSignal(NULL, SIGALRM);
     if (r < 0)
         return r;
@@ -319,6 +327,10 @@ sigfired:
                         {
                             timers[timID].fired = false;
                             timers[timID].valid = false;
+                            if (timer_delete(timers[timID].timer) == -1)
+                                loge(kWarn, errno,
+                                     "Error deleting POSIX timer (entry %d)",
+                                     timID);
                             timers[timID].timer = 0;
                             for (auto it = timerSources.begin();
                                  it != timerSources.end(); it++)
@@ -381,26 +393,34 @@ runpoll:
 
     if (pFDs[0].revents)
     {
+        char buf[64];
+
         assert(pFDs[0].revents = POLLIN);
         pFDs[0].revents = 0; /* signal selfpipe written to */
+        /* else poll() would return at once ever after */
+        while (read(sigPipe[0], buf, sizeof(buf)) > 0)
+            ;
     }
 
     for (int i = 1; i < nPFDs; i++)
         if (pFDs[i].revents)
         {
-            int fd = pFDs[i].fd;
+            int fd = pFDs[i].fd, revents = pFDs[i].revents;
 
+            pFDs[i].revents = 0;
             for (auto it = fdSources.begin(); it != fdSources.end(); it++)
                 if (it->fd == fd)
                 {
-                    it->handler->fdEvent(this, fd, pFDs[i].revents);
+                    it->handler->fdEvent(this, fd, revents);
                     goto proceed3;
                 }
 
             log(kWarn, "Did not find a source descriptor for FD %d\n", fd);
 
         proceed3:
-            pFDs[i].revents = 0;
+            /* a handler may delete FDs, moving those after them down */
+            while (i > 0 && (i >= nPFDs || pFDs[i].fd != fd))
+                i--;
         }
 
     /* can happen */
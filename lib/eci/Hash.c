@@ -0,0 +1,160 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2015-2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "eci/Hash.h"
+
+#define P1 0x9E3779B185EBCA87ULL
+#define P2 0xC2B2AE3D27D4EB4FULL
+#define P3 0x165667B19E3779F9ULL
+#define P4 0x85EBCA77C2B2AE63ULL
+#define P5 0x27D4EB2F165667C5ULL
+
+#define Rotl64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+/* Read little-endian, whatever the host's byte order or alignment rules. */
+static uint64_t read64(const unsigned char *p)
+{
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+           (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 |
+           (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+static uint32_t read32(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+           (uint32_t)p[3] << 24;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input)
+{
+    acc += input * P2;
+    acc = Rotl64(acc, 31);
+    return acc * P1;
+}
+
+static uint64_t merge64(uint64_t acc, uint64_t val)
+{
+    acc ^= round64(0, val);
+    return acc * P1 + P4;
+}
+
+uint64_t eciHash64(const void *data, size_t len, uint64_t seed)
+{
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + P1 + P2;
+        uint64_t v2 = seed + P2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - P1;
+
+        do
+        {
+            v1 = round64(v1, read64(p));
+            v2 = round64(v2, read64(p + 8));
+            v3 = round64(v3, read64(p + 16));
+            v4 = round64(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = Rotl64(v1, 1) + Rotl64(v2, 7) + Rotl64(v3, 12) + Rotl64(v4, 18);
+        h = merge64(h, v1);
+        h = merge64(h, v2);
+        h = merge64(h, v3);
+        h = merge64(h, v4);
+    }
+    else
+        h = seed + P5;
+
+    h += (uint64_t)len;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= round64(0, read64(p));
+        h = Rotl64(h, 27) * P1 + P4;
+    }
+
+    if (p + 4 <= end)
+    {
+        h ^= (uint64_t)read32(p) * P1;
+        h = Rotl64(h, 23) * P2 + P3;
+        p += 4;
+    }
+
+    for (; p < end; p++)
+    {
+        h ^= *p * P5;
+        h = Rotl64(h, 11) * P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+int eciHashFile(const char *path, uint64_t *hash)
+{
+    struct stat sb;
+    void *data;
+    int fd = open(path, O_RDONLY);
+    int r = 0;
+
+    if (fd == -1)
+        return -errno;
+
+    if (fstat(fd, &sb) == -1)
+    {
+        r = -errno;
+        goto cleanup;
+    }
+
+    /* an empty file can't be mapped */
+    if (sb.st_size == 0)
+    {
+        *hash = eciHash64(NULL, 0, 0);
+        goto cleanup;
+    }
+
+    data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        r = -errno;
+        goto cleanup;
+    }
+
+    *hash = eciHash64(data, sb.st_size, 0);
+    munmap(data, sb.st_size);
+
+cleanup:
+    close(fd);
+    return r;
+}
@@ -0,0 +1,565 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "eci/SDNotify.hh"
+
+#if defined(ECI_SD_NOTIFY_TYPE_stream) || defined(ECI_SD_NOTIFY_TYPE_insecure)
+#define SD_NOTIFY_STREAM
+#endif
+
+/* credentials the kernel attaches to each datagram, where it does */
+#if defined(SCM_CREDENTIALS)
+/* Linux style; with SO_PASSCRED set, every datagram has them */
+#define CRED_TYPE SCM_CREDENTIALS
+typedef struct ucred Cred;
+#define CRED_PID(c) (c)->pid
+#define CRED_UID(c) (c)->uid
+#define CRED_GID(c) (c)->gid
+#elif defined(SCM_CREDS) && defined(__NetBSD__)
+/* NetBSD style; with LOCAL_CREDS set, every datagram has them */
+#define CRED_TYPE SCM_CREDS
+typedef struct sockcred Cred;
+#define CRED_PID(c) (c)->sc_pid
+#define CRED_UID(c) (c)->sc_euid
+#define CRED_GID(c) (c)->sc_egid
+#define CRED_SIZE SOCKCREDSIZE(CMGROUP_MAX)
+#elif defined(SCM_CREDS)
+/* FreeBSD style; the sender must attach them, and the kernel fills them in */
+#define CRED_TYPE SCM_CREDS
+typedef struct cmsgcred Cred;
+#define CRED_PID(c) (c)->cmcred_pid
+#define CRED_UID(c) (c)->cmcred_euid
+#define CRED_GID(c) (c)->cmcred_gid
+#endif
+
+#if defined(CRED_TYPE) && !defined(CRED_SIZE)
+#define CRED_SIZE sizeof(Cred)
+#endif
+
+#ifdef MSG_CMSG_CLOEXEC
+#define RECV_FLAGS (MSG_DONTWAIT | MSG_CMSG_CLOEXEC)
+#else
+#define RECV_FLAGS MSG_DONTWAIT
+#endif
+
+/* Room for the control messages of one notification. */
+static size_t controlSize()
+{
+    return CMSG_SPACE(sizeof(int) * SDNotifyServer::kMaxFDs)
+#ifdef CRED_TYPE
+           + CMSG_SPACE(CRED_SIZE)
+#endif
+        ;
+}
+
+static void fdsClose(const int *fds, size_t nFDs)
+{
+    for (size_t i = 0; i < nFDs; i++)
+        if (fds[i] != -1)
+            close(fds[i]);
+}
+
+/*
+ * Collect the FDs passed in \p mh into \p fds, of room for \p room, closing
+ * any beyond; and the credentials, if any, into \p msg, else leaving them -1.
+ *
+ * @returns the number of FDs collected.
+ */
+static size_t cmsgsRead(struct msghdr *mh, SDNotifyMsg &msg, int *fds,
+                        size_t room)
+{
+    size_t nFDs = 0;
+
+    msg.pid = -1;
+    msg.uid = (uid_t)-1;
+    msg.gid = (gid_t)-1;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(mh); cmsg;
+         cmsg = CMSG_NXTHDR(mh, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+
+        if (cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int *passed = (int *)CMSG_DATA(cmsg);
+
+            for (size_t i = 0; i < n; i++)
+                if (nFDs < room)
+                    fds[nFDs++] = passed[i];
+                else
+                    close(passed[i]);
+        }
+#ifdef CRED_TYPE
+        else if (cmsg->cmsg_type == CRED_TYPE &&
+                 cmsg->cmsg_len >= CMSG_LEN(sizeof(Cred)))
+        {
+            Cred cred;
+
+            /* CMSG_DATA() need not be aligned for it */
+            memcpy(&cred, CMSG_DATA(cmsg), sizeof(cred));
+            msg.pid = CRED_PID(&cred);
+            msg.uid = CRED_UID(&cred);
+            msg.gid = CRED_GID(&cred);
+        }
+#endif
+    }
+
+    return nFDs;
+}
+
+/* Parse \p str as a decimal number no greater than \p max. */
+static bool numberParse(const char *str, uint64_t max, uint64_t &val)
+{
+    char *end;
+
+    if (*str < '0' || *str > '9')
+        return false;
+    errno = 0;
+    val = strtoull(str, &end, 10);
+    return !errno && !*end && val <= max;
+}
+
+void SDNotifyServer::parse(char *buf, size_t len, SDNotifyMsg &msg)
+{
+    buf[len] = '\0';
+
+    for (char *line = buf, *end; line < buf + len; line = end + 1)
+    {
+        char *val;
+        uint64_t num;
+
+        if ((end = (char *)memchr(line, '\n', buf + len - line)) == NULL)
+            end = buf + len;
+        *end = '\0';
+
+        if ((val = strchr(line, '=')) == NULL)
+            continue;
+        *val++ = '\0';
+
+#define IS(key) !strcmp(line, key)
+#define IS_SET(key) (IS(key) && !strcmp(val, "1"))
+        if (IS_SET("READY"))
+            msg.ready = true;
+        else if (IS_SET("RELOADING"))
+            msg.reloading = true;
+        else if (IS_SET("STOPPING"))
+            msg.stopping = true;
+        else if (IS("STATUS"))
+            msg.status = val;
+        else if (IS("ERRNO") && numberParse(val, INT_MAX, num))
+            msg.errnum = (int)num;
+        else if (IS("MAINPID") && numberParse(val, INT_MAX, num) && num > 0)
+            msg.mainPID = (pid_t)num;
+        else if (IS_SET("WATCHDOG"))
+            msg.watchdog = true;
+        else if (IS("WATCHDOG") && !strcmp(val, "trigger"))
+            msg.watchdogTrigger = true;
+        else if (IS("WATCHDOG_USEC") && numberParse(val, UINT64_MAX, num))
+            msg.watchdogUsec = num;
+        else if (IS_SET("FDSTORE"))
+            msg.fdStore = true;
+        else if (IS_SET("FDSTOREREMOVE"))
+            msg.fdStoreRemove = true;
+        else if (IS("FDNAME"))
+            msg.fdName = val;
+#undef IS_SET
+#undef IS
+    }
+}
+
+void SDNotifyServer::deliver(char *buf, size_t len, SDNotifyMsg &msg)
+{
+    parse(buf, len, msg);
+#ifdef ECI_SD_NOTIFY_TYPE_insecure
+    /* with no credentials, we must take the sender's word for who it is */
+    if (msg.pid <= 0)
+        msg.pid = msg.mainPID;
+#endif
+
+    if (msg.pid <= 0)
+        log(kWarn, "Dropping notification without credentials\n");
+    else
+        delegate->notifyReceived(msg);
+    fdsClose(msg.fds, msg.nFDs);
+}
+
+/*
+ * Datagrams
+ */
+
+void SDNotifyServer::datagramReceived(struct msghdr *mh, size_t len)
+{
+    int fds[kMaxFDs];
+    SDNotifyMsg msg = {};
+
+    msg.fds = fds;
+    msg.nFDs = cmsgsRead(mh, msg, fds, kMaxFDs);
+
+    if (mh->msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+        log(kWarn, "Dropping notification from PID %d: exceeds %zu bytes or "
+                   "%zu FDs\n",
+            (int)msg.pid, kMaxMsgBytes, kMaxFDs);
+    else
+    {
+        deliver((char *)mh->msg_iov->iov_base, len, msg);
+        return;
+    }
+
+    fdsClose(fds, msg.nFDs);
+}
+
+void SDNotifyServer::datagramsDrain()
+{
+    size_t ctlSize = controlSize();
+    struct iovec iovs[kBatch];
+    struct msghdr *mh;
+    int n;
+
+#ifdef MSG_WAITFORONE
+    struct mmsghdr mmsgs[kBatch];
+
+    /* a full batch may have left more behind it */
+    do
+    {
+        for (size_t i = 0; i < kBatch; i++)
+        {
+            mh = &mmsgs[i].msg_hdr;
+            iovs[i].iov_base = &bufs[i * (kMaxMsgBytes + 1)];
+            iovs[i].iov_len = kMaxMsgBytes;
+            memset(mh, 0, sizeof(*mh));
+            mh->msg_iov = &iovs[i];
+            mh->msg_iovlen = 1;
+            mh->msg_control = &controls[i * ctlSize];
+            mh->msg_controllen = ctlSize;
+        }
+
+        if ((n = recvmmsg(fd, mmsgs, kBatch, RECV_FLAGS, NULL)) == -1)
+            break;
+        for (int i = 0; i < n; i++)
+            datagramReceived(&mmsgs[i].msg_hdr, mmsgs[i].msg_len);
+    } while ((size_t)n == kBatch);
+#else
+    struct msghdr mhs[1];
+    ssize_t len;
+
+    /* without recvmmsg(), one at a time, but as many as kBatch at once */
+    mh = &mhs[0];
+    for (n = 0; (size_t)n < kBatch; n++)
+    {
+        iovs[0].iov_base = &bufs[0];
+        iovs[0].iov_len = kMaxMsgBytes;
+        memset(mh, 0, sizeof(*mh));
+        mh->msg_iov = &iovs[0];
+        mh->msg_iovlen = 1;
+        mh->msg_control = &controls[0];
+        mh->msg_controllen = ctlSize;
+
+        if ((len = recvmsg(fd, mh, RECV_FLAGS)) == -1)
+        {
+            n = -1;
+            break;
+        }
+        datagramReceived(mh, len);
+    }
+#endif
+
+    if (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        loge(kErr, errno, "Failed to receive notifications");
+}
+
+/*
+ * Streams
+ */
+
+struct SDNotifyServer::Conn
+{
+    int fd;
+    pid_t pid;
+    uid_t uid;
+    gid_t gid;
+    char buf[kMaxMsgBytes + 1];
+    size_t len = 0;
+    int fds[kMaxFDs];
+    size_t nFDs = 0;
+    /* it sent more than we accept; read on till it ends, then drop it */
+    bool overflowed = false;
+};
+
+void SDNotifyServer::connsAccept()
+{
+    int connFD;
+
+    while ((connFD = accept(fd, NULL, NULL)) != -1)
+    {
+        std::unique_ptr<Conn> conn(new Conn);
+        int r;
+
+        conn->fd = connFD;
+        conn->pid = -1;
+        conn->uid = (uid_t)-1;
+        conn->gid = (gid_t)-1;
+
+#if defined(SO_PEERCRED) && defined(ECI_SD_NOTIFY_TYPE_stream)
+        {
+#if defined(__OpenBSD__)
+            struct sockpeercred cred;
+#else
+            struct ucred cred;
+#endif
+            socklen_t credLen = sizeof(cred);
+
+            /* recorded as it connected, so they are those of its sender */
+            if (getsockopt(connFD, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) ==
+                0)
+            {
+                conn->pid = cred.pid;
+                conn->uid = cred.uid;
+                conn->gid = cred.gid;
+            }
+        }
+#endif
+
+        if (fcntl(connFD, F_SETFD, FD_CLOEXEC) == -1 ||
+            fcntl(connFD, F_SETFL, O_NONBLOCK) == -1)
+            r = -errno;
+        else
+            r = loop->addFD(this, connFD, POLLIN);
+        if (r != 0)
+        {
+            loge(kErr, -r, "Failed to set up notification connection");
+            close(connFD);
+            continue;
+        }
+
+        conns[connFD] = std::move(conn);
+    }
+
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        loge(kErr, errno, "Failed to accept notification connection");
+}
+
+void SDNotifyServer::connRead(Conn &conn)
+{
+    union
+    {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * kMaxFDs)];
+    } control;
+    char discard[512];
+    ssize_t n;
+
+    for (;;)
+    {
+        struct iovec iov;
+        struct msghdr mh;
+        /* the peer's credentials were had as it was accepted */
+        SDNotifyMsg unused;
+        size_t room = kMaxMsgBytes - conn.len;
+
+        if (room)
+        {
+            iov.iov_base = conn.buf + conn.len;
+            iov.iov_len = room;
+        }
+        else
+        {
+            conn.overflowed = true;
+            iov.iov_base = discard;
+            iov.iov_len = sizeof(discard);
+        }
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &iov;
+        mh.msg_iovlen = 1;
+        mh.msg_control = control.buf;
+        mh.msg_controllen = sizeof(control.buf);
+
+        if ((n = recvmsg(conn.fd, &mh, RECV_FLAGS)) <= 0)
+            break;
+
+        conn.nFDs += cmsgsRead(&mh, unused, conn.fds + conn.nFDs,
+                               kMaxFDs - conn.nFDs);
+        if (!conn.overflowed)
+            conn.len += n;
+    }
+
+    if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+
+    if (n == -1)
+        loge(kWarn, errno, "Failed to read notification from PID %d",
+             (int)conn.pid);
+    else if (conn.overflowed)
+        log(kWarn, "Dropping notification from PID %d: exceeds %zu bytes\n",
+            (int)conn.pid, kMaxMsgBytes);
+    else
+    {
+        SDNotifyMsg msg = {};
+
+        msg.pid = conn.pid;
+        msg.uid = conn.uid;
+        msg.gid = conn.gid;
+        msg.fds = conn.fds;
+        msg.nFDs = conn.nFDs;
+        deliver(conn.buf, conn.len, msg);
+        conn.nFDs = 0;
+    }
+
+    connClose(conn.fd);
+}
+
+void SDNotifyServer::connClose(int connFD)
+{
+    auto it = conns.find(connFD);
+
+    if (it == conns.end())
+        return;
+
+    fdsClose(it->second->fds, it->second->nFDs);
+    loop->delFD(connFD);
+    close(connFD);
+    conns.erase(it);
+}
+
+/*
+ * Common
+ */
+
+void SDNotifyServer::fdEvent(EventLoop *loop, int fd, int revents)
+{
+    auto it = conns.end();
+
+    if (fd == this->fd)
+#ifdef SD_NOTIFY_STREAM
+        connsAccept();
+#else
+        datagramsDrain();
+#endif
+    else if ((it = conns.find(fd)) != conns.end())
+        connRead(*it->second);
+}
+
+int SDNotifyServer::listen(const char *path)
+{
+#if defined(ECI_SD_NOTIFY_TYPE_datagram) || defined(SD_NOTIFY_STREAM)
+    struct sockaddr_un sun;
+    struct stat sb;
+    int one = 1, r;
+
+    if (fd != -1)
+        return -EALREADY;
+    if (strlen(path) >= sizeof(sun.sun_path))
+        return -ENAMETOOLONG;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strcpy(sun.sun_path, path);
+
+    /* one left by an earlier run is in the way; anything else is not */
+    if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+        unlink(path);
+
+#ifdef SD_NOTIFY_STREAM
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+#else
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+#endif
+    if (fd == -1)
+        return -errno;
+
+#if defined(SCM_CREDENTIALS) && !defined(SD_NOTIFY_STREAM)
+    if (setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one)) == -1)
+        goto fail;
+#elif defined(__NetBSD__) && !defined(SD_NOTIFY_STREAM)
+    if (setsockopt(fd, 0, LOCAL_CREDS, &one, sizeof(one)) == -1)
+        goto fail;
+#else
+    (void)one;
+#endif
+
+    if (fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+        fcntl(fd, F_SETFL, O_NONBLOCK) == -1 ||
+        bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1)
+        goto fail;
+
+    /* senders may not run as we do */
+    if (chmod(path, 0777) == -1)
+        goto fail;
+
+#ifdef SD_NOTIFY_STREAM
+    if (::listen(fd, SOMAXCONN) == -1)
+        goto fail;
+#else
+    bufs.resize(kBatch * (kMaxMsgBytes + 1));
+    controls.resize(kBatch * controlSize());
+#endif
+
+    if ((r = loop->addFD(this, fd, POLLIN)) != 0)
+    {
+        errno = -r;
+        goto fail;
+    }
+
+    this->path = path;
+    log(kInfo, "Receiving notifications (%s) at %s\n", ECI_SD_NOTIFY_TYPE,
+        path);
+    return 0;
+
+fail:
+    r = -errno;
+    close(fd);
+    fd = -1;
+    return r;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+SDNotifyServer::SDNotifyServer(Logger *parent, SDNotifyDelegate *delegate,
+                               EventLoop *loop)
+    : Logger("sdnotify", parent), delegate(delegate), loop(loop)
+{
+}
+
+SDNotifyServer::~SDNotifyServer()
+{
+    for (auto &conn : conns)
+    {
+        fdsClose(conn.second->fds, conn.second->nFDs);
+        close(conn.first);
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+        unlink(path.c_str());
+    }
+}
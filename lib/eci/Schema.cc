@@ -0,0 +1,163 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2020-2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+
+#include <cstring>
+
+#include "eci/Schema.hh"
+
+static unsigned typeOf(const ucl_object_t *obj)
+{
+    switch (ucl_object_type(obj))
+    {
+    case UCL_OBJECT:
+        return kSchemaObject;
+    case UCL_ARRAY:
+        return kSchemaArray;
+    case UCL_STRING:
+        return kSchemaString;
+    case UCL_INT:
+        return kSchemaInteger | kSchemaNumber;
+    case UCL_FLOAT:
+    case UCL_TIME:
+        return kSchemaNumber;
+    case UCL_BOOLEAN:
+        return kSchemaBoolean;
+    case UCL_NULL:
+        return kSchemaNull;
+    default:
+        return 0;
+    }
+}
+
+bool ECISchema::validate(const ucl_object_t *obj, std::string &err) const
+{
+    std::string path;
+    return validateNode(root, obj, path, &err);
+}
+
+bool ECISchema::validateNode(int iNode, const ucl_object_t *obj,
+                             std::string &path, std::string *err) const
+{
+    const ECISchemaNode &node = nodes[iNode];
+    unsigned type = typeOf(obj);
+    size_t pathLen = path.size();
+
+    if (node.types && !(node.types & type))
+    {
+        if (err)
+            *err = (path.empty() ? "/" : path) + ": wrong type";
+        return false;
+    }
+
+    if (node.nAnyOf)
+    {
+        bool any = false;
+
+        for (int i = 0; i < node.nAnyOf && !any; i++)
+        {
+            any = validateNode(anyOf[node.firstAnyOf + i], obj, path, NULL);
+            path.resize(pathLen);
+        }
+
+        if (!any)
+        {
+            if (err)
+                *err = (path.empty() ? "/" : path) +
+                       ": matches none of the permitted alternatives";
+            return false;
+        }
+    }
+
+    if (type == kSchemaObject)
+    {
+        const ECISchemaProp *first = props + node.firstProp;
+        const ECISchemaProp *last = first + node.nProps;
+        ucl_object_iter_t it = NULL;
+        const ucl_object_t *member;
+
+        for (int i = 0; i < node.nRequired; i++)
+            if (!ucl_object_lookup(obj, required[node.firstRequired + i]))
+            {
+                if (err)
+                    *err = path + "/" + required[node.firstRequired + i] +
+                           ": required property missing";
+                return false;
+            }
+
+        while ((member = ucl_iterate_object(obj, &it, true)))
+        {
+            const char *key = ucl_object_key(member);
+            const ECISchemaProp *lo = first, *hi = last;
+            int iChild = node.additional;
+
+            /* properties are sorted, so binary search them */
+            while (lo < hi)
+            {
+                const ECISchemaProp *mid = lo + (hi - lo) / 2;
+                int cmp = strcmp(key, mid->name);
+
+                if (cmp == 0)
+                {
+                    iChild = mid->node;
+                    break;
+                }
+                else if (cmp < 0)
+                    hi = mid;
+                else
+                    lo = mid + 1;
+            }
+
+            path.append("/").append(key);
+
+            if (iChild == kSchemaNone)
+            {
+                if (err)
+                    *err = path + ": property not permitted";
+                return false;
+            }
+            else if (iChild != kSchemaAny &&
+                     !validateNode(iChild, member, path, err))
+                return false;
+
+            path.resize(pathLen);
+        }
+    }
+    else if (type == kSchemaArray && node.items != kSchemaAny)
+    {
+        ucl_object_iter_t it = NULL;
+        const ucl_object_t *item;
+        int i = 0;
+
+        while ((item = ucl_iterate_object(obj, &it, true)))
+        {
+            path.append("/").append(std::to_string(i++));
+
+            if (node.items == kSchemaNone)
+            {
+                if (err)
+                    *err = path + ": item not permitted";
+                return false;
+            }
+            else if (!validateNode(node.items, item, path, err))
+                return false;
+
+            path.resize(pathLen);
+        }
+    }
+
+    return true;
+}
@@ -164,6 +164,11 @@ ucl_object_t *wsRPCSerialiseint(int *in)
     return ucl_object_fromint(*in);
 }
 
+ucl_object_t *wsRPCSerialiseint64_t(int64_t *in)
+{
+    return ucl_object_fromint(*in);
+}
+
 ucl_object_t *wsRPCSerialisestring(std::string *in)
 {
     return ucl_object_fromstring(in->c_str());
@@ -192,6 +197,14 @@ bool wsRPCDeserialiseint(const ucl_object_t *obj, int *out)
     return true;
 }
 
+bool wsRPCDeserialiseint64_t(const ucl_object_t *obj, int64_t *out)
+{
+    if (ucl_object_type(obj) != UCL_INT)
+        return false;
+    *out = ucl_object_toint(obj);
+    return true;
+}
+
 bool wsRPCDeserialisestring(const ucl_object_t *obj, std::string *out)
 {
     if (ucl_object_type(obj) != UCL_STRING)
@@ -454,6 +467,7 @@ void WSRPCTransport::processMessage(ucl_object_t *obj)
         req.method_name = ucl_object_tostring(ucl_object_lookup(obj, "method"));
         req.params = ucl_object_lookup(obj, "params");
         req.result = NULL;
+        req.deferred = false;
         if (svcs)
             for (auto svc : *svcs)
             {
@@ -462,6 +476,11 @@ void WSRPCTransport::processMessage(ucl_object_t *obj)
                     continue;
                 else if (res == 1)
                     sendError(req.id, req.err);
+                else if (req.deferred)
+                {
+                    if (req.result)
+                        ucl_object_unref(req.result);
+                }
                 else if (req.id)
                     sendReply(req.id, req.result);
                 return;
@@ -31,6 +31,16 @@ union PropertyValue {
 		int<> props;
 };
 
+/**
+ * What an instance's processes have used, as accounted by its cgroup. Memory
+ * and processes are 0 where their controllers are not enabled.
+ */
+struct InstanceUsage {
+	int64_t cpuUsec;
+	int64_t memoryBytes;
+	int64_t nProcesses;
+};
+
 program io.eComCloud.eci.IManager
 {
 	version manager1
@@ -42,5 +52,27 @@ program io.eComCloud.eci.IManager
 		string subscribe(int hello) = 0;
 
 		int snapshot(int instanceID, string name) = 0;
+
+		/**
+		 * Start or stop an instance, and whatever its dependencies require,
+		 * in a new transaction. Returns the number of tasks in it, or a
+		 * negative errno.
+		 */
+		int start(string name) = 0;
+		int stop(string name) = 0;
+
+		/**
+		 * Profile the transactions run since the manager started, chiefly
+		 * those of boot. Format 0 gives Chrome trace events, as JSON; format
+		 * 1 gives a text report of each transaction's critical path.
+		 */
+		string profile(int format) = 0;
+
+		/**
+		 * Get the CPU time and memory used by an instance's processes,
+		 * read at most once per manager event loop iteration. Fails if the
+		 * instance is not tracked by cgroup.
+		 */
+		InstanceUsage usage(string name) = 0;
 	} = 1;
 } = 0x40DD1001;
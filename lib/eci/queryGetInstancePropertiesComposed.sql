@@ -19,17 +19,19 @@ ServiceValues(PropertyID, FK_PropertyValueID)
  * Collect together the instance- and service-parented property IDs and their
  * associated property value IDs, with a column to indicate whether they came
  * from a service or an instance, and also for their layer of origin and their
- * key.
+ * key. Keys are interned, so they are compared by string ID.
  */
 AllValues
-  AS(SELECT 0 as Instance, PropertyID, FK_PropertyValueID, Bundle.Layer, Val.PropertyKey
+  AS(SELECT 0 as Instance, PropertyID, FK_PropertyValueID, Bundle.Layer,
+	   Val.FK_Key_StringID AS KeyID
 	 FROM ServiceValues
 	 INNER JOIN PropertyValues Val
 	   ON Val.PropertyValueID = FK_PropertyValueID
 	 INNER JOIN Bundles Bundle
 	   ON Bundle.BundleID = Val.FK_BundleID
 	 UNION
-	 SELECT 1 as Instance, PropertyID, FK_PropertyValueID, Bundle.Layer, Val.PropertyKey
+	 SELECT 1 as Instance, PropertyID, FK_PropertyValueID, Bundle.Layer,
+	   Val.FK_Key_StringID AS KeyID
 	 FROM InstanceValues
 	 INNER JOIN PropertyValues Val
 	   ON Val.PropertyValueID = FK_PropertyValueID
@@ -40,21 +42,21 @@ AllValues
  * Now, for each unique property key in the AllValues temporary table, get the
  * highest of the Instance column.
  */
-MaxInstance(PropertyKey, Instance)
-	AS(SELECT PropertyKey, MAX(Instance)
+MaxInstance(KeyID, Instance)
+	AS(SELECT KeyID, MAX(Instance)
 	  FROM AllValues
-	  GROUP BY PropertyKey),
+	  GROUP BY KeyID),
 
 /**
  * And for each property name in the MaxInstance temporary table, get its
  * highest layer for that instance level.
  */
-MaxLayerForHighestInstance(PropertyKey, Instance, Layer)
-	AS(SELECT AllValues.PropertyKey, MaxInstance.Instance, MAX(Layer)
+MaxLayerForHighestInstance(KeyID, Instance, Layer)
+	AS(SELECT AllValues.KeyID, MaxInstance.Instance, MAX(Layer)
 		FROM AllValues
-		JOIN MaxInstance ON AllValues.PropertyKey = MaxInstance.PropertyKey
+		JOIN MaxInstance ON AllValues.KeyID = MaxInstance.KeyID
 		WHERE AllValues.Instance = MaxInstance.Instance
-		GROUP BY AllValues.PropertyKey)
+		GROUP BY AllValues.KeyID)
 
 /**
  * Finally we retrieve from the AllValues temporary table the property ID
@@ -62,6 +64,6 @@ MaxLayerForHighestInstance(PropertyKey, Instance, Layer)
  */
 SELECT PropertyID FROM AllValues
 JOIN MaxLayerForHighestInstance
-ON MaxLayerForHighestInstance.PropertyKey = AllValues.PropertyKey
+ON MaxLayerForHighestInstance.KeyID = AllValues.KeyID
     AND MaxLayerForHighestInstance.Instance = AllValues.Instance
     AND MaxLayerForHighestInstance.Layer = AllValues.Layer;
\ No newline at end of file
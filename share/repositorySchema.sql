@@ -1,9 +1,21 @@
 BEGIN TRANSACTION;
+/*
+ * Interned strings. Service names, property group names, and property keys
+ * recur throughout the repository, so each is stored once here and referred
+ * to by its ID, which is compared and grouped on in place of the text. Strings
+ * are never deleted.
+ */
+CREATE TABLE IF NOT EXISTS "Strings" (
+	"StringID"	INTEGER NOT NULL UNIQUE,
+	"Value"	TEXT NOT NULL UNIQUE,
+	PRIMARY KEY("StringID" AUTOINCREMENT)
+);
 CREATE TABLE IF NOT EXISTS "Services" (
 	"ServiceID"	INTEGER NOT NULL UNIQUE,
-	"Name"	TEXT NOT NULL,
+	"FK_Name_StringID"	INTEGER NOT NULL,
 	"Type"	TEXT NOT NULL,
-	PRIMARY KEY("ServiceID" AUTOINCREMENT)
+	PRIMARY KEY("ServiceID" AUTOINCREMENT),
+	FOREIGN KEY("FK_Name_StringID") REFERENCES "Strings"("StringID")
 );
 CREATE TABLE IF NOT EXISTS "Instances" (
 	"InstanceID"	INTEGER NOT NULL UNIQUE,
@@ -52,21 +64,45 @@ CREATE TABLE IF NOT EXISTS "PropertyValues" (
 	"PropertyValueID"	INTEGER NOT NULL UNIQUE,
 	"FK_BundleID"	INTEGER,
 	"Type"	TEXT NOT NULL CHECK("Type" = 'String' OR "Type" = 'Page'),
-	"PropertyKey"	TEXT NOT NULL,
+	"FK_Key_StringID"	INTEGER NOT NULL,
 	"StringValue"	TEXT,
 	"FK_PageValue_PropertyGroupID"	INTEGER,
 	PRIMARY KEY("PropertyValueID" AUTOINCREMENT),
 	FOREIGN KEY("FK_PageValue_PropertyGroupID") REFERENCES "PropertyGroups"("PropertyGroupID"),
-	FOREIGN KEY("FK_BundleID") REFERENCES "Bundles"("BundleID")
+	FOREIGN KEY("FK_BundleID") REFERENCES "Bundles"("BundleID"),
+	FOREIGN KEY("FK_Key_StringID") REFERENCES "Strings"("StringID")
 );
 CREATE TABLE IF NOT EXISTS "PropertyGroups" (
 	"PropertyGroupID"	INTEGER NOT NULL UNIQUE,
-	"Name"				STRING NOT NULL,
+	"FK_Name_StringID"	INTEGER NOT NULL,
 	"RefCount"	INTEGER NOT NULL DEFAULT 0,
 	"FK_Parent_ServiceID"	INTEGER,
 	"FK_Parent_PropertyGroupID"	INTEGER,
 	PRIMARY KEY("PropertyGroupID" AUTOINCREMENT),
 	FOREIGN KEY("FK_Parent_PropertyGroupID") REFERENCES "PropertyGroups"("PropertyGroupID"),
-	FOREIGN KEY("FK_Parent_ServiceID") REFERENCES "Services"("ServiceID")
+	FOREIGN KEY("FK_Parent_ServiceID") REFERENCES "Services"("ServiceID"),
+	FOREIGN KEY("FK_Name_StringID") REFERENCES "Strings"("StringID")
+);
+CREATE INDEX IF NOT EXISTS "IdxInstances_Parent" ON "Instances" (
+	"FK_Parent_ServiceID", "Name"
 );
+CREATE INDEX IF NOT EXISTS "IdxServices_Name"
+	ON "Services" ("FK_Name_StringID");
+CREATE INDEX IF NOT EXISTS "IdxBundles_Filename" ON "Bundles" ("Filename");
+CREATE INDEX IF NOT EXISTS "IdxSnapshotProperty_Snapshot"
+	ON "SnapshotProperty" ("FK_SnapshotID");
+CREATE INDEX IF NOT EXISTS "IdxProperties_Instance"
+	ON "Properties" ("FK_Parent_InstanceID");
+CREATE INDEX IF NOT EXISTS "IdxProperties_Service"
+	ON "Properties" ("FK_Parent_ServiceID");
+CREATE INDEX IF NOT EXISTS "IdxProperties_PropertyGroup"
+	ON "Properties" ("FK_Parent_PropertyGroupID");
+CREATE INDEX IF NOT EXISTS "IdxProperties_PropertyValue"
+	ON "Properties" ("FK_PropertyValueID");
+CREATE INDEX IF NOT EXISTS "IdxPropertyValues_Bundle"
+	ON "PropertyValues" ("FK_BundleID");
+CREATE INDEX IF NOT EXISTS "IdxPropertyGroups_Service"
+	ON "PropertyGroups" ("FK_Parent_ServiceID", "FK_Name_StringID");
+CREATE INDEX IF NOT EXISTS "IdxPropertyGroups_PropertyGroup"
+	ON "PropertyGroups" ("FK_Parent_PropertyGroupID", "FK_Name_StringID");
 COMMIT;
@@ -21,8 +21,19 @@ CREATE TABLE "LiveInstances" (
 	"PersistentFK_Parent_ServiceID"		INTEGER,
 	/* A persistent instance must have a parent InstanceID only. */
 	"PersistentFK_Parent_InstanceID"	INTEGER,
+	/*
+	 * The manager's record of the instance, written behind from memory, and so
+	 * possibly a little out of date: its state, main process ID (0 if none),
+	 * when it entered its state (microseconds since the Epoch), and the
+	 * generation of the record, which increases with every change.
+	 */
+	"State"								TEXT NOT NULL DEFAULT 'offline',
+	"MainPID"							INTEGER NOT NULL DEFAULT 0,
+	"StateSince"						INTEGER NOT NULL DEFAULT 0,
+	"Generation"						INTEGER NOT NULL DEFAULT 0,
 	PRIMARY KEY("LiveInstanceID" AUTOINCREMENT)
 );
+CREATE UNIQUE INDEX "IdxLiveInstances_Name" ON "LiveInstances" ("Name");
 CREATE TABLE "Metadata" (
 	"Version"	INTEGER NOT NULL
 );
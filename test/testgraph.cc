@@ -0,0 +1,103 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+/**
+ * testgraph checks that Graph::cycles() finds each cycle among the edges
+ * asked about once, whole, and nothing which is not on one.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "manager/Graph.hh"
+
+static int nFailed = 0;
+
+static void expect(bool cond, const char *what)
+{
+    if (!cond)
+    {
+        fprintf(stderr, "failed: %s\n", what);
+        nFailed++;
+    }
+}
+
+static ObjectIdx declare(Graph &graph, const char *name,
+                         const std::vector<ObjectDecl::Dep> &deps)
+{
+    static int instanceID = 0;
+    ObjectDecl decl;
+
+    decl.instanceID = ++instanceID;
+    decl.name = name;
+    decl.deps = deps;
+    return graph.objectDeclare(decl);
+}
+
+int main()
+{
+    Graph graph;
+    std::vector<std::vector<ObjectIdx>> cycles;
+    ObjectIdx a, b, c;
+
+    /* a requires b requires c requires a; d hangs off the cycle */
+    a = declare(graph, "a", {{Edge::kRequires, false, "b"}});
+    b = declare(graph, "b", {{Edge::kRequires, false, "c"}});
+    c = declare(graph, "c", {{Edge::kRequires, false, "a"}});
+    declare(graph, "d",
+            {{Edge::kRequires, false, "a"}, {Edge::kAfter, false, "a"}});
+    /* e and f are ordered against each other both ways, but require not */
+    declare(graph, "e", {{Edge::kAfter, false, "f"}});
+    declare(graph, "f", {{Edge::kAfter, false, "e"}});
+
+    graph.cycles(EdgeMask(kRequires), cycles);
+    expect(cycles.size() == 1, "one requires cycle reported");
+    if (cycles.size() == 1)
+    {
+        std::vector<ObjectIdx> members = cycles[0];
+
+        std::sort(members.begin(), members.end());
+        expect(members == std::vector<ObjectIdx>({a, b, c}),
+               "the requires cycle is a, b, and c");
+    }
+
+    cycles.clear();
+    graph.cycles(EdgeMask(kAfter), cycles);
+    expect(cycles.size() == 1 && cycles[0].size() == 2,
+           "one after cycle reported, of e and f");
+
+    /* redeclared without it, c breaks the cycle */
+    declare(graph, "c", {});
+    cycles.clear();
+    graph.cycles(EdgeMask(kRequires), cycles);
+    expect(cycles.empty(), "no requires cycle once broken");
+
+    /* an object requiring itself is a cycle of one */
+    declare(graph, "c", {{Edge::kRequires, false, "c"}});
+    cycles.clear();
+    graph.cycles(EdgeMask(kRequires), cycles);
+    expect(cycles.size() == 1 && cycles[0] == std::vector<ObjectIdx>({c}),
+           "a self-requirement reported once");
+
+    if (nFailed)
+    {
+        fprintf(stderr, "%d checks failed\n", nFailed);
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+/**
+ * testhash checks eciHash64() against the vectors of the reference XXH64's
+ * sanity check, on which addsys's skipping of unchanged bundles relies: a
+ * bundle hashed differently by another build would be imported again, or,
+ * worse, a changed one skipped.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+
+#include "eci/Hash.h"
+
+/* The reference's seed, and the generator of its sanity buffer. */
+static const uint64_t kPrime32 = 2654435761U;
+static const uint64_t kPrime64 = 11400714785074694797ULL;
+
+static const struct
+{
+    size_t len;
+    uint64_t seed;
+    uint64_t expected;
+} kVectors[] = {
+    {0, 0, 0xEF46DB3751D8E999ULL},
+    {0, kPrime32, 0xAC75FDA2929B17EFULL},
+    {1, 0, 0xE934A84ADB052768ULL},
+    {1, kPrime32, 0x5014607643A9B4C3ULL},
+    {4, 0, 0x9136A0DCA57457EEULL},
+    {14, 0, 0x8282DCC4994E35C8ULL},
+    {14, kPrime32, 0xC3BD6BF63DEB6DF0ULL},
+    /* over 32 bytes, so through the four-lane loop */
+    {222, 0, 0xB641AE8CB691C174ULL},
+    {222, kPrime32, 0x20CB8AB7AE10C14AULL},
+};
+
+int main()
+{
+    unsigned char buf[222];
+    uint64_t gen = kPrime32;
+    int nFailed = 0;
+
+    for (size_t i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] = gen >> 56;
+        gen *= kPrime64;
+    }
+
+    for (auto &vec : kVectors)
+    {
+        uint64_t got = eciHash64(vec.len ? buf : NULL, vec.len, vec.seed);
+
+        if (got != vec.expected)
+        {
+            fprintf(stderr,
+                    "eciHash64 of %zu bytes, seed %" PRIu64 ": expected "
+                    "%016" PRIX64 ", got %016" PRIX64 "\n",
+                    vec.len, vec.seed, vec.expected, got);
+            nFailed++;
+        }
+    }
+
+    if (nFailed)
+    {
+        fprintf(stderr, "%d of %zu vectors failed\n", nFailed,
+                sizeof(kVectors) / sizeof(*kVectors));
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
@@ -0,0 +1,201 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+/**
+ * testmigrate checks that a persistent repository made with the first schema
+ * is brought up to date when sys.manager's backend attaches to it. It creates
+ * such a repository at the path given, holding a service with an instance and
+ * a few properties, has the backend migrate it, then checks that the rows,
+ * with their names and keys, came through, and that nothing of the
+ * migrations was left behind.
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "baselineRepositorySchema.sql.h"
+#include "eci/Core.h"
+#include "eci/Event.hh"
+#include "eci/Logger.hh"
+#include "eci/Platform.h"
+#include "manager/Backend.hh"
+#include "sqlite3.h"
+
+/* What addsys would have imported from a bundle, in the baseline schema. */
+static const char *kFixture =
+    "INSERT INTO Metadata(Version) VALUES (1);"
+    "INSERT INTO Bundles(BundleID, RefCount, Filename, MD5Sum, Layer) "
+    "VALUES (1, 1, 'test.ucl', 0, 1);"
+    "INSERT INTO Services(ServiceID, Name, Type) VALUES (1, 'test', 'Service');"
+    "INSERT INTO Instances(InstanceID, Name, FK_Parent_ServiceID) "
+    "VALUES (1, 'i0', 1);"
+    "INSERT INTO PropertyGroups(PropertyGroupID, Name, RefCount, "
+    "FK_Parent_ServiceID) VALUES (1, 'methods', 1, 1);"
+    "INSERT INTO PropertyValues(PropertyValueID, FK_BundleID, Type, "
+    "PropertyKey, StringValue, FK_PageValue_PropertyGroupID) "
+    "VALUES (1, 1, 'String', 'testProp', 'hello', NULL), "
+    "(2, 1, 'Page', 'methods', NULL, 1);"
+    "INSERT INTO Properties(PropertyID, FK_Parent_InstanceID, "
+    "FK_Parent_ServiceID, FK_PropertyValueID) "
+    "VALUES (1, 1, NULL, 1), (2, NULL, 1, 2);";
+
+/* Queries of the migrated repository, each with the one value it must give. */
+static const struct
+{
+    const char *sql;
+    const char *expected;
+} kChecks[] = {
+    {"SELECT Version FROM Metadata;", MStr(ECI_BACKEND_SCHEMA_VERSION)},
+    {"SELECT count(*) FROM Properties "
+     "JOIN PropertyValues Val ON Val.PropertyValueID = FK_PropertyValueID "
+     "JOIN Instances ON InstanceID = FK_Parent_InstanceID "
+     "OR Properties.FK_Parent_ServiceID = Instances.FK_Parent_ServiceID;",
+     "2"},
+    {"SELECT Str.Value FROM Services "
+     "JOIN Strings Str ON Str.StringID = FK_Name_StringID;",
+     "test"},
+    {"SELECT Str.Value FROM PropertyGroups "
+     "JOIN Strings Str ON Str.StringID = FK_Name_StringID;",
+     "methods"},
+    {"SELECT group_concat(Prop, ',') FROM (SELECT Str.Value || '=' || "
+     "ifnull(Val.StringValue, '') AS Prop FROM Properties "
+     "JOIN PropertyValues Val ON Val.PropertyValueID = FK_PropertyValueID "
+     "JOIN Strings Str ON Str.StringID = Val.FK_Key_StringID "
+     "ORDER BY PropertyID);",
+     "testProp=hello,methods="},
+    {"SELECT count(*) FROM sqlite_master "
+     "WHERE type = 'trigger' OR name = 'MigrationProgress' "
+     "OR name GLOB '*_migrate';",
+     "0"},
+    {"SELECT count(*) FROM sqlite_master WHERE name = 'IdxServices_Name';",
+     "1"},
+    {"SELECT count(*) FROM pragma_foreign_key_check;", "0"},
+    {"PRAGMA integrity_check;", "ok"},
+};
+
+class TestMigrate : Logger
+{
+    const char *pathDb;
+
+    /* Create the repository as the baseline schema had it. */
+    void create();
+    /* Attach sys.manager's backend to it, which migrates it. */
+    void migrate();
+    /* @returns the number of checks failed. */
+    int check();
+
+  public:
+    TestMigrate() : Logger("testmigrate"){};
+
+    int main(int argc, char *argv[]);
+};
+
+void TestMigrate::create()
+{
+    sqlite3 *conn;
+
+    if (unlink(pathDb) == -1 && errno != ENOENT)
+        edie(errno, "Failed to delete old repository %s", pathDb);
+
+    if (sqlite3_open_v2(pathDb, &conn,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                        NULL) != SQLITE_OK ||
+        sqlite3_exec(conn, kbaselineRepositorySchema_sql, NULL, NULL, NULL) !=
+            SQLITE_OK ||
+        sqlite3_exec(conn, kFixture, NULL, NULL, NULL) != SQLITE_OK)
+        die("Failed to create baseline repository: %s\n",
+            sqlite3_errmsg(conn));
+
+    sqlite3_close(conn);
+}
+
+void TestMigrate::migrate()
+{
+    EventLoop loop(this);
+    Backend bend(NULL, &loop);
+
+    if (loop.init() < 0)
+        die("Failed to initialise event loop\n");
+
+    /* dies should any migration fail */
+    bend.init(pathDb, NULL, false, false, false, 0);
+    bend.shutdown();
+}
+
+int TestMigrate::check()
+{
+    sqlite3 *conn;
+    int nFailed = 0;
+
+    if (sqlite3_open_v2(pathDb, &conn, SQLITE_OPEN_READONLY, NULL) !=
+        SQLITE_OK)
+        die("Failed to open migrated repository: %s\n", sqlite3_errmsg(conn));
+
+    for (auto &check : kChecks)
+    {
+        sqlite3_stmt *stmt;
+        const char *got = NULL;
+
+        if (sqlite3_prepare_v2(conn, check.sql, -1, &stmt, NULL) != SQLITE_OK)
+            die("Failed to prepare check: %s\n", sqlite3_errmsg(conn));
+
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            got = (const char *)sqlite3_column_text(stmt, 0);
+
+        if (!got || strcmp(got, check.expected))
+        {
+            log(kErr, "%s: expected %s, got %s\n", check.sql, check.expected,
+                got ? got : sqlite3_errmsg(conn));
+            nFailed++;
+        }
+
+        sqlite3_finalize(stmt);
+    }
+
+    sqlite3_close(conn);
+
+    return nFailed;
+}
+
+int TestMigrate::main(int argc, char *argv[])
+{
+    int nFailed;
+
+    if (argc != 2)
+        die("Usage: %s <repository path>\n", argv[0]);
+    pathDb = argv[1];
+
+    create();
+    migrate();
+    nFailed = check();
+
+    if (nFailed)
+    {
+        log(kErr, "%d of %zu checks failed\n", nFailed,
+            sizeof(kChecks) / sizeof(*kChecks));
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    TestMigrate testmigrate;
+    return testmigrate.main(argc, argv);
+}
@@ -0,0 +1,285 @@
+/*******************************************************************
+
+    PROPRIETARY NOTICE
+
+These coded instructions, statements, and computer programs contain
+proprietary information of eComCloud Object Solutions, and they are
+protected under copyright law. They may not be distributed, copied,
+or used except under the provisions of the terms of the Source Code
+Licence Agreement, in the file "LICENCE.md", which should have been
+included with this software
+
+    Copyright Notice
+
+    (c) 2021 eComCloud Object Solutions.
+        All rights reserved.
+********************************************************************/
+/**
+ * testsched runs transactions over small graphs through the Scheduler, with
+ * tasks finished by hand rather than by methods, and checks that they run in
+ * the order their after-dependencies give, no more of a resource class at
+ * once than its cap allows, and that a task fails unrun when one it requires
+ * does.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+
+#include "eci/Logger.hh"
+#include "manager/Graph.hh"
+#include "manager/Scheduler.hh"
+
+class TestSched : Logger, SchedulerDelegate
+{
+    Graph graph;
+    Scheduler sched;
+    /* tasks dispatched, in the order they were, and those yet to finish */
+    std::vector<int> runOrder;
+    std::deque<int> running;
+    /* most tasks of each class which ran at once */
+    std::vector<int> maxRunning;
+    /* objects whose tasks are to fail */
+    std::vector<ObjectIdx> failing;
+    bool txDone;
+    int nFailed = 0;
+
+    void taskRun(Transaction *tx, int task);
+    void transactionDone(Transaction *tx);
+
+    void expect(bool cond, const char *what);
+    ObjectIdx declare(const char *name,
+                      const std::vector<ObjectDecl::Dep> &deps);
+    /* @returns the task of that kind for \p obj in \p tx, or -1 */
+    static int taskOf(const Transaction &tx, Task::Kind kind, ObjectIdx obj);
+    /* @returns where \p task came in the run order, or -1 if it never ran */
+    int ranAt(int task);
+    /* Order and submit \p tx, then finish its tasks oldest first. */
+    void run(Transaction &tx);
+
+    void testAfter();
+    void testCap();
+    void testRequiresFails();
+    void testStopStart();
+
+  public:
+    TestSched() : Logger("testsched"), sched(this, this){};
+
+    int main();
+};
+
+void TestSched::taskRun(Transaction *tx, int task)
+{
+    int cls = tx->tasks[task].resClass;
+    int n = 1;
+
+    for (int other : running)
+        if (tx->tasks[other].resClass == cls)
+            n++;
+    if (maxRunning.size() <= (size_t)cls)
+        maxRunning.resize(cls + 1);
+    maxRunning[cls] = std::max(maxRunning[cls], n);
+
+    runOrder.push_back(task);
+    running.push_back(task);
+}
+
+void TestSched::transactionDone(Transaction *tx)
+{
+    txDone = true;
+}
+
+void TestSched::expect(bool cond, const char *what)
+{
+    if (!cond)
+    {
+        log(kErr, "failed: %s\n", what);
+        nFailed++;
+    }
+}
+
+ObjectIdx TestSched::declare(const char *name,
+                             const std::vector<ObjectDecl::Dep> &deps)
+{
+    static int instanceID = 0;
+    ObjectDecl decl;
+
+    decl.instanceID = ++instanceID;
+    decl.name = name;
+    decl.deps = deps;
+    return graph.objectDeclare(decl);
+}
+
+int TestSched::taskOf(const Transaction &tx, Task::Kind kind, ObjectIdx obj)
+{
+    for (size_t i = 0; i < tx.tasks.size(); i++)
+        if (tx.tasks[i].kind == kind && tx.tasks[i].obj == obj)
+            return i;
+    return -1;
+}
+
+int TestSched::ranAt(int task)
+{
+    auto it = std::find(runOrder.begin(), runOrder.end(), task);
+    return it == runOrder.end() ? -1 : it - runOrder.begin();
+}
+
+void TestSched::run(Transaction &tx)
+{
+    runOrder.clear();
+    running.clear();
+    maxRunning.clear();
+    txDone = false;
+
+    if (tx.order(graph, this) < 0)
+    {
+        expect(false, "transaction ordered");
+        return;
+    }
+
+    sched.submit(&tx);
+    while (!running.empty())
+    {
+        int task = running.front();
+        ObjectIdx obj = tx.tasks[task].obj;
+
+        running.pop_front();
+        sched.taskDone(&tx, task,
+                       std::find(failing.begin(), failing.end(), obj) ==
+                           failing.end());
+    }
+
+    expect(txDone && tx.finished(), "transaction finished");
+}
+
+/* x requires and comes after y, so starts after it; z it requires only */
+void TestSched::testAfter()
+{
+    Transaction tx;
+    ObjectIdx x, y, z;
+    int startX, startY, startZ;
+
+    x = declare("x", {{Edge::kRequires, false, "y"},
+                      {Edge::kAfter, false, "y"},
+                      {Edge::kRequires, false, "z"}});
+    y = declare("y", {});
+    z = declare("z", {});
+
+    tx.objectStart(sched, graph, x);
+    run(tx);
+
+    startX = taskOf(tx, Task::kStart, x);
+    startY = taskOf(tx, Task::kStart, y);
+    startZ = taskOf(tx, Task::kStart, z);
+    expect(ranAt(startY) != -1 && ranAt(startY) < ranAt(startX),
+           "x started after y");
+    expect(ranAt(startZ) < ranAt(startX), "z started unordered, so at once");
+    expect(tx.tasks[startX].gatedBy == startY, "x was gated by y");
+    expect(tx.tasks[startX].state == Task::kComplete, "x started");
+}
+
+/* four mounts wanted at once, but no more than two of them run together */
+void TestSched::testCap()
+{
+    Transaction tx;
+    ObjectIdx all;
+    std::vector<ObjectDecl::Dep> deps;
+    const char *mounts[] = {"mount$a", "mount$b", "mount$c", "mount$d"};
+
+    for (auto mount : mounts)
+    {
+        declare(mount, {});
+        deps.push_back({Edge::kRequires, false, mount});
+        deps.push_back({Edge::kAfter, false, mount});
+    }
+    all = declare("all-mounts", deps);
+
+    sched.classCapSet("mount", 2);
+    tx.objectStart(sched, graph, all);
+    run(tx);
+
+    expect(runOrder.size() == 5, "every task ran");
+    expect(maxRunning[sched.classGetOrCreate("mount")] == 2,
+           "two mounts ran at once, and no more");
+    expect(runOrder.back() == taskOf(tx, Task::kStart, all),
+           "all-mounts started after every mount");
+    sched.classCapSet("mount", 0);
+}
+
+/* p requires and comes after q, and r after p; q fails, and so must they */
+void TestSched::testRequiresFails()
+{
+    Transaction tx;
+    ObjectIdx p, q, r;
+
+    p = declare("p", {{Edge::kRequires, false, "q"},
+                      {Edge::kAfter, false, "q"}});
+    q = declare("q", {});
+    r = declare("r", {{Edge::kRequires, false, "p"},
+                      {Edge::kAfter, false, "p"}});
+
+    failing.push_back(q);
+    tx.objectStart(sched, graph, r);
+    run(tx);
+    failing.clear();
+
+    expect(runOrder.size() == 1, "only q ran");
+    for (ObjectIdx obj : {p, q, r})
+        expect(tx.tasks[taskOf(tx, Task::kStart, obj)].state ==
+                   Task::kFailed,
+               "p, q, and r failed");
+    expect(tx.tasks[taskOf(tx, Task::kStart, r)].times[Task::kTimeFailed],
+           "r's failure was timed");
+}
+
+/*
+ * Starting s starts u and v, which s and u require; but s conflicts with v,
+ * so v is stopped, and with it u and s, which require it. Each is stopped
+ * before it is started, however the tasks were added.
+ */
+void TestSched::testStopStart()
+{
+    Transaction tx;
+    ObjectIdx s, u, v;
+
+    s = declare("s", {{Edge::kRequires, false, "u"},
+                      {Edge::kConflicts, false, "v"}});
+    u = declare("u", {{Edge::kRequires, false, "v"}});
+    v = declare("v", {});
+
+    tx.objectStart(sched, graph, s);
+    run(tx);
+
+    for (ObjectIdx obj : {s, u, v})
+    {
+        int start = taskOf(tx, Task::kStart, obj);
+        int stop = taskOf(tx, Task::kStop, obj);
+
+        expect(start != -1 && stop != -1,
+               "s, u, and v both started and stopped");
+        expect(ranAt(stop) != -1 && ranAt(stop) < ranAt(start),
+               "s, u, and v stopped before started");
+    }
+}
+
+int TestSched::main()
+{
+    testAfter();
+    testCap();
+    testRequiresFails();
+    testStopStart();
+
+    if (nFailed)
+    {
+        log(kErr, "%d checks failed\n", nFailed);
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
+
+int main()
+{
+    TestSched testsched;
+    return testsched.main();
+}